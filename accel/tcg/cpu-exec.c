@@ -171,33 +171,71 @@ uint32_t curr_cflags(CPUState *cpu)
     return cflags;
 }
 
+/*
+ * Insert @tb at the front of its jump cache set, evicting the entry
+ * that was inserted least recently.
+ */
+static inline void tb_jmp_cache_insert(CPUState *cpu, target_ulong pc,
+                                       TranslationBlock *tb)
+{
+    CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+    TranslationBlock **set = tb_jmp_cache_set(jc, tb_jmp_cache_hash_func(pc));
+    unsigned int i;
+
+    for (i = TB_JMP_CACHE_WAYS - 1; i > 0; i--) {
+        qatomic_set(&set[i], qatomic_read(&set[i - 1]));
+    }
+    qatomic_set(&set[0], tb);
+}
+
+static inline bool tb_lookup_match(CPUState *cpu, TranslationBlock *tb,
+                                   target_ulong pc, target_ulong cs_base,
+                                   uint32_t flags, uint32_t cflags)
+{
+    return tb &&
+           tb->pc == pc &&
+           tb->cs_base == cs_base &&
+           tb->flags == flags &&
+           tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+           (tb_cflags(tb) & ~CF_LOOKUP_IGNORE) == (cflags & ~CF_LOOKUP_IGNORE);
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base,
                                           uint32_t flags, uint32_t cflags)
 {
-    TranslationBlock *tb;
-    uint32_t hash;
+    CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+    TranslationBlock *tb, **set;
+    unsigned int i;
 
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(cflags & CF_INVALID));
 
-    hash = tb_jmp_cache_hash_func(pc);
-    tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash]);
-
-    if (likely(tb &&
-               tb->pc == pc &&
-               tb->cs_base == cs_base &&
-               tb->flags == flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               tb_cflags(tb) == cflags)) {
-        return tb;
+    if (likely(tb_jmp_cache_default)) {
+        /* Default geometry: constant hash and a single way */
+        QEMU_BUILD_BUG_ON(TB_JMP_CACHE_DEFAULT_WAYS != 1);
+        tb = qatomic_rcu_read(&jc->array[
+                 tb_jmp_cache_hash_bits(pc, TB_JMP_CACHE_DEFAULT_BITS)]);
+        if (likely(tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags))) {
+            return tb;
+        }
+    } else {
+        set = tb_jmp_cache_set(jc, tb_jmp_cache_hash_func(pc));
+        for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+            tb = qatomic_rcu_read(&set[i]);
+            if (tb_lookup_match(cpu, tb, pc, cs_base, flags, cflags)) {
+                return tb;
+            }
+        }
     }
+    qatomic_set(&cpu->tb_jmp_cache_miss, cpu->tb_jmp_cache_miss + 1);
+
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return NULL;
     }
-    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_insert(cpu, pc, tb);
     return tb;
 }
 
@@ -333,6 +371,29 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     return tb->tc.ptr;
 }
 
+/*
+ * Called at the start of a TB that has become hot.  Invalidate it, so that
+ * it is retranslated as a superblock when execution resumes.
+ */
+void HELPER(tb_hot)(CPUArchState *env, void *ptr)
+{
+    CPUState *cpu = env_cpu(env);
+    TranslationBlock *tb = ptr;
+
+    /* The guest pc is not stored when entering through a chained jump.  */
+    cpu_restore_state(cpu, GETPC(), true);
+    if (cpu->cflags_next_tb == -1) {
+        mmap_lock();
+        qemu_thread_jit_write();
+        tb_phys_invalidate(tb, -1);
+        qemu_thread_jit_execute();
+        mmap_unlock();
+        qatomic_inc(&tb_ctx.tb_hot_count);
+        cpu->cflags_next_tb = curr_cflags(cpu) | CF_HOT;
+    }
+    cpu_loop_exit(cpu);
+}
+
 /* Execute a TB, and fix up the CPU state afterwards if necessary */
 /*
  * Disable CFI checks.
@@ -506,7 +567,7 @@ static bool tb_lookup_cmp(const void *p, const void *d)
         tb->cs_base == desc->cs_base &&
         tb->flags == desc->flags &&
         tb->trace_vcpu_dstate == desc->trace_vcpu_dstate &&
-        tb_cflags(tb) == desc->cflags) {
+        (tb_cflags(tb) & ~CF_LOOKUP_IGNORE) == desc->cflags) {
         /* check next page if needed */
         if (tb->page_addr[1] == -1) {
             return true;
@@ -535,7 +596,7 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     desc.env = cpu->env_ptr;
     desc.cs_base = cs_base;
     desc.flags = flags;
-    desc.cflags = cflags;
+    desc.cflags = cflags & ~CF_LOOKUP_IGNORE;
     desc.trace_vcpu_dstate = *cpu->trace_dstate;
     desc.pc = pc;
     phys_pc = get_page_addr_code(desc.env, pc);
@@ -984,7 +1045,7 @@ int cpu_exec(CPUState *cpu)
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+                tb_jmp_cache_insert(cpu, pc, tb);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1021,11 +1082,16 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
 {
     static bool tcg_target_initialized;
     CPUClass *cc = CPU_GET_CLASS(cpu);
+    unsigned int entries = TB_JMP_CACHE_SIZE * TB_JMP_CACHE_WAYS;
+    CPUJumpCache *jc;
 
     if (!tcg_target_initialized) {
         cc->tcg_ops->initialize();
         tcg_target_initialized = true;
     }
+    jc = g_malloc0(sizeof(*jc) + entries * sizeof(jc->array[0]));
+    jc->entries = entries;
+    qatomic_rcu_set(&cpu->tb_jmp_cache, jc);
     tlb_init(cpu);
     qemu_plugin_vcpu_init_hook(cpu);
 
@@ -1037,12 +1103,19 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
 /* undo the initializations in reverse order */
 void tcg_exec_unrealizefn(CPUState *cpu)
 {
+    CPUJumpCache *jc;
+
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_free_notifier_list(cpu);
 #endif /* !CONFIG_USER_ONLY */
 
     qemu_plugin_vcpu_exit_hook(cpu);
     tlb_destroy(cpu);
+
+    /* Other threads may still find the CPU with CPU_FOREACH */
+    jc = cpu->tb_jmp_cache;
+    qatomic_rcu_set(&cpu->tb_jmp_cache, NULL);
+    g_free_rcu(jc, rcu);
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -100,10 +100,20 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
-    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
+    CPUJumpCache *jc;
+    TranslationBlock **set;
+    unsigned int i;
 
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
-        qatomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
+    RCU_READ_LOCK_GUARD();
+    jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+    if (!jc) {
+        return;
+    }
+
+    /* The sets of a page are adjacent, and so are the ways of a set */
+    set = tb_jmp_cache_set(jc, tb_jmp_cache_hash_page(page_addr));
+    for (i = 0; i < TB_JMP_PAGE_SIZE * TB_JMP_CACHE_WAYS; i++) {
+        qatomic_set(&set[i], NULL);
     }
 }
 
@@ -787,7 +797,7 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
      * If the length is larger than the jump cache size, then it will take
      * longer to clear each entry individually than it will to clear it all.
      */
-    if (d.len >= (TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
+    if (d.len >= ((uint64_t)TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
         cpu_tb_jmp_cache_clear(cpu);
         return;
     }
@@ -16,7 +16,21 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
                               int cflags);
 
 void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
+
+/* Executions after which a TB is retranslated with CF_HOT; 0 disables. */
+extern uint32_t tb_hot_threshold;
 void page_init(void);
 void tb_htable_init(void);
+/* Start @n_workers threads for asynchronous translation (MTTCG only). */
+void tb_async_init(unsigned n_workers);
+
+/* Persistent translation cache, enabled when @path is set. */
+void tb_cache_init(const char *path);
+bool tb_cache_lookup(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, const void *host_pc,
+                     int *gen_code_size, int *search_size);
+void tb_cache_store(CPUState *cpu, const TranslationBlock *tb,
+                    tb_page_addr_t phys_pc, const void *host_pc,
+                    int search_size);
 
 #endif /* ACCEL_TCG_INTERNAL_H */
@@ -0,0 +1,461 @@
+/*
+ * Persistent translation block cache
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * The host code of a TB is kept in a file together with its metadata and
+ * the guest code it was translated from, so that later runs of the same
+ * configuration can skip the translation.
+ *
+ * Host code is not relocated: it contains the addresses of helpers, of
+ * the TB itself and of the epilogue in code_gen_buffer.  An entry is therefore
+ * only used when the TB being generated is placed at the very same host
+ * address, in a process whose layout matches the fingerprint stored in
+ * the file header.  This is the case for the deterministic startup of
+ * identical guests with address space randomization disabled.
+ *
+ * Several processes may share the file.  Entries are only ever appended,
+ * with O_APPEND and under an exclusive lock on the file, and each has a
+ * checksum so that readers skip what a crashed writer left behind.  A
+ * file written by another configuration is not modified in place, since
+ * other processes may have it mapped, but replaced with a new file.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/cacheflush.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qemu/xxhash.h"
+#include "exec/exec-all.h"
+#include "exec/translate-all.h"
+#include "hw/core/tcg-cpu-ops.h"
+#include "tcg/tcg.h"
+#include "trace.h"
+#include "tb-context.h"
+#include "internal.h"
+#ifdef CONFIG_POSIX
+#include <sys/file.h>
+#endif
+
+#define TB_CACHE_MAGIC      "QEMUTBC"
+#define TB_CACHE_VERSION    2
+
+/* Stop appending to the file once it reaches this size */
+#define TB_CACHE_MAX_SIZE   (1 * GiB)
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    /* SHA-256 of the process configuration, in hexadecimal */
+    char fingerprint[64];
+} TBCacheHeader;
+
+/*
+ * Each entry is followed by @size bytes of guest code and by
+ * @code_size + @search_size bytes of host code and search data,
+ * padded to a multiple of 8 bytes.
+ */
+typedef struct TBCacheEntry {
+    uint64_t host_pc;
+    uint64_t phys_pc;
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+    uint16_t size;
+    uint16_t icount;
+    uint32_t code_size;
+    uint32_t search_size;
+    uint16_t jmp_reset_offset[2];
+    /* CRC32C of the entry and its data, computed with @csum set to 0 */
+    uint32_t csum;
+    uint64_t jmp_target_arg[2];
+} TBCacheEntry;
+
+typedef enum {
+    TB_CACHE_OFF,
+    TB_CACHE_INIT,
+    TB_CACHE_ON,
+} TBCacheState;
+
+static struct {
+    char *path;
+    int state;
+    QemuMutex lock;
+    GMappedFile *mapped;
+    /* Entries of the mapped file, keyed by themselves */
+    GHashTable *entries;
+    int fd;
+} tb_cache;
+
+static size_t tb_cache_entry_size(const TBCacheEntry *e)
+{
+    return ROUND_UP(sizeof(*e) + e->size + e->code_size + e->search_size, 8);
+}
+
+static const uint8_t *tb_cache_entry_guest_code(const TBCacheEntry *e)
+{
+    return (const uint8_t *)(e + 1);
+}
+
+static const uint8_t *tb_cache_entry_host_code(const TBCacheEntry *e)
+{
+    return tb_cache_entry_guest_code(e) + e->size;
+}
+
+static uint32_t tb_cache_entry_csum(const TBCacheEntry *e)
+{
+    TBCacheEntry hdr = *e;
+    uint32_t crc;
+
+    hdr.csum = 0;
+    crc = crc32c(0xffffffff, (const uint8_t *)&hdr, sizeof(hdr));
+    return crc32c(crc, tb_cache_entry_guest_code(e),
+                  tb_cache_entry_size(e) - sizeof(*e));
+}
+
+static guint tb_cache_entry_hash(gconstpointer p)
+{
+    const TBCacheEntry *e = p;
+
+    return qemu_xxhash7(e->host_pc, e->phys_pc, e->pc ^ e->cs_base,
+                        e->flags, e->cflags ^ e->trace_vcpu_dstate);
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *ea = a;
+    const TBCacheEntry *eb = b;
+
+    return ea->host_pc == eb->host_pc &&
+           ea->phys_pc == eb->phys_pc &&
+           ea->pc == eb->pc &&
+           ea->cs_base == eb->cs_base &&
+           ea->flags == eb->flags &&
+           ea->cflags == eb->cflags &&
+           ea->trace_vcpu_dstate == eb->trace_vcpu_dstate;
+}
+
+/*
+ * Everything the generated code depends on besides the guest code and
+ * the TB lookup key: the QEMU binary and where it is loaded, the
+ * location of the code_gen_buffer, the guest base, the CPU model with
+ * its configuration and the host instructions the TCG backend uses.
+ */
+static char *tb_cache_fingerprint(CPUState *cpu)
+{
+    g_autoptr(GString) s = g_string_new(QEMU_FULL_VERSION " " TARGET_NAME);
+#ifdef CONFIG_LINUX
+    struct stat st;
+
+    if (stat("/proc/self/exe", &st) == 0) {
+        g_string_append_printf(s, " exe=%" PRIu64 ":%" PRId64,
+                               (uint64_t)st.st_size, (int64_t)st.st_mtime);
+    }
+#endif
+    g_string_append_printf(s, " text=%" PRIxPTR " buf=%p:%zu wx=%" PRIxPTR,
+                           (uintptr_t)tb_gen_code, tcg_code_gen_epilogue,
+                           tcg_code_capacity(), tcg_splitwx_diff);
+#ifdef CONFIG_USER_ONLY
+    g_string_append_printf(s, " guest_base=%" PRIxPTR " reserved_va=%lx",
+                           guest_base, (unsigned long)reserved_va);
+#endif
+    g_string_append_printf(s, " page=%d tb=%zu hot=%u counts=%p cpu=%s",
+                           TARGET_PAGE_BITS, sizeof(TranslationBlock),
+                           tb_hot_threshold, tcg_region_exec_counts(),
+                           object_get_typename(OBJECT(cpu)));
+    g_string_append(s, " host=");
+    tcg_host_features(s);
+    CPU_GET_CLASS(cpu)->tcg_ops->tb_cache_fingerprint(cpu, s);
+
+    return g_compute_checksum_for_string(G_CHECKSUM_SHA256, s->str, s->len);
+}
+
+/*
+ * Index the entries of the mapped file, stopping at the first truncated
+ * or corrupted one.  Return the offset where it starts.
+ */
+static size_t tb_cache_index(void)
+{
+    const uint8_t *p = (uint8_t *)g_mapped_file_get_contents(tb_cache.mapped);
+    size_t len = g_mapped_file_get_length(tb_cache.mapped);
+    size_t off = sizeof(TBCacheHeader);
+
+    while (off + sizeof(TBCacheEntry) <= len) {
+        const TBCacheEntry *e = (const TBCacheEntry *)(p + off);
+        size_t size = tb_cache_entry_size(e);
+
+        if (size > len - off || e->csum != tb_cache_entry_csum(e)) {
+            break;
+        }
+        /* Later entries replace earlier ones with the same key.  */
+        g_hash_table_replace(tb_cache.entries, (gpointer)e, (gpointer)e);
+        off += size;
+    }
+    return off;
+}
+
+/* Take or drop the lock that the processes sharing the file use */
+static void tb_cache_lock_file(int fd, bool lock)
+{
+#ifdef CONFIG_POSIX
+    while (flock(fd, lock ? LOCK_EX : LOCK_UN) < 0 && errno == EINTR) {
+        /* retry */
+    }
+#endif
+}
+
+/*
+ * Create a file with just @hdr and move it in place of the cache file.
+ * Processes that use the old file keep their own copy of it.
+ */
+static int tb_cache_create(const TBCacheHeader *hdr)
+{
+    g_autofree char *tmp = g_strdup_printf("%s.XXXXXX", tb_cache.path);
+    int fd, err;
+
+    fd = g_mkstemp_full(tmp, O_WRONLY | O_APPEND, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    qemu_set_cloexec(fd);
+    if (qemu_write_full(fd, hdr, sizeof(*hdr)) != sizeof(*hdr) ||
+        rename(tmp, tb_cache.path) < 0) {
+        err = errno;
+        unlink(tmp);
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static bool tb_cache_open(CPUState *cpu)
+{
+    g_autofree char *fingerprint = tb_cache_fingerprint(cpu);
+    g_autoptr(GError) gerr = NULL;
+    TBCacheHeader hdr = {
+        .magic = TB_CACHE_MAGIC,
+        .version = TB_CACHE_VERSION,
+    };
+
+    memcpy(hdr.fingerprint, fingerprint, sizeof(hdr.fingerprint));
+    tb_cache.entries = g_hash_table_new(tb_cache_entry_hash,
+                                        tb_cache_entry_equal);
+
+    tb_cache.fd = qemu_open_old(tb_cache.path, O_RDWR | O_APPEND);
+    if (tb_cache.fd >= 0) {
+        tb_cache_lock_file(tb_cache.fd, true);
+        tb_cache.mapped = g_mapped_file_new_from_fd(tb_cache.fd, FALSE, &gerr);
+        if (tb_cache.mapped &&
+            g_mapped_file_get_length(tb_cache.mapped) >= sizeof(hdr) &&
+            !memcmp(g_mapped_file_get_contents(tb_cache.mapped), &hdr,
+                    sizeof(hdr))) {
+            size_t end = tb_cache_index();
+
+            /*
+             * Cut off what a crashed writer left behind, so that entries
+             * appended by this run can be found.  No other process has
+             * indexed anything past @end.
+             */
+            if (end < g_mapped_file_get_length(tb_cache.mapped) &&
+                ftruncate(tb_cache.fd, end) < 0) {
+                tb_cache_lock_file(tb_cache.fd, false);
+                goto fail;
+            }
+            tb_cache_lock_file(tb_cache.fd, false);
+            return true;
+        }
+        if (tb_cache.mapped) {
+            g_mapped_file_unref(tb_cache.mapped);
+            tb_cache.mapped = NULL;
+        }
+        tb_cache_lock_file(tb_cache.fd, false);
+        close(tb_cache.fd);
+    }
+
+    /* Missing, or written by a different configuration: start afresh */
+    tb_cache.fd = tb_cache_create(&hdr);
+    if (tb_cache.fd < 0) {
+        goto fail;
+    }
+    return true;
+
+fail:
+    warn_report("tb-cache: cannot write '%s': %s", tb_cache.path,
+                strerror(errno));
+    if (tb_cache.fd >= 0) {
+        close(tb_cache.fd);
+        tb_cache.fd = -1;
+    }
+    return tb_cache.mapped != NULL;
+}
+
+static bool tb_cache_enabled(CPUState *cpu)
+{
+    int state = qatomic_load_acquire(&tb_cache.state);
+
+    if (likely(state != TB_CACHE_INIT)) {
+        return state == TB_CACHE_ON;
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    if (tb_cache.state == TB_CACHE_INIT) {
+        state = tb_cache_open(cpu) ? TB_CACHE_ON : TB_CACHE_OFF;
+        qatomic_store_release(&tb_cache.state, state);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+    return qatomic_read(&tb_cache.state) == TB_CACHE_ON;
+}
+
+static bool tb_cache_usable(CPUState *cpu)
+{
+    /* The code of plugins and of some translators embeds host pointers.  */
+#ifdef CONFIG_PLUGIN
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return false;
+    }
+#endif
+    return CPU_GET_CLASS(cpu)->tcg_ops->persistent_tb &&
+           CPU_GET_CLASS(cpu)->tcg_ops->tb_cache_fingerprint &&
+           tb_cache_enabled(cpu);
+}
+
+void tb_cache_init(const char *path)
+{
+    if (path && *path) {
+        tb_cache.path = g_strdup(path);
+        tb_cache.fd = -1;
+        qemu_mutex_init(&tb_cache.lock);
+        tb_cache.state = TB_CACHE_INIT;
+    }
+}
+
+bool tb_cache_lookup(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, const void *host_pc,
+                     int *gen_code_size, int *search_size)
+{
+    void *buf = tcg_splitwx_to_rw(tb->tc.ptr);
+    TBCacheEntry key = {
+        .host_pc = (uintptr_t)tb->tc.ptr,
+        .phys_pc = phys_pc,
+        .pc = tb->pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb->cflags,
+        .trace_vcpu_dstate = tb->trace_vcpu_dstate,
+    };
+    const TBCacheEntry *e;
+
+    if (!host_pc || !tb_cache_usable(cpu)) {
+        return false;
+    }
+
+    e = g_hash_table_lookup(tb_cache.entries, &key);
+    if (!e) {
+        qatomic_inc(&tb_ctx.tb_cache_miss_count);
+        return false;
+    }
+#ifdef CONFIG_USER_ONLY
+    /*
+     * Like translator_loop(), write-protect the page before comparing its
+     * contents, so that later writes invalidate the TB.  Entries never
+     * span two pages.
+     */
+    page_protect(tb->pc);
+#endif
+    if (buf + e->code_size + e->search_size > tcg_ctx->code_gen_highwater ||
+        memcmp(host_pc, tb_cache_entry_guest_code(e), e->size)) {
+        trace_tb_cache_stale(tb->pc, phys_pc);
+        qatomic_inc(&tb_ctx.tb_cache_miss_count);
+        return false;
+    }
+
+    memcpy(buf, tb_cache_entry_host_code(e), e->code_size + e->search_size);
+    flush_idcache_range((uintptr_t)tb->tc.ptr, (uintptr_t)buf, e->code_size);
+
+    tb->size = e->size;
+    tb->icount = e->icount;
+    tb->tc.size = e->code_size;
+    tb->jmp_reset_offset[0] = e->jmp_reset_offset[0];
+    tb->jmp_reset_offset[1] = e->jmp_reset_offset[1];
+    tb->jmp_target_arg[0] = e->jmp_target_arg[0];
+    tb->jmp_target_arg[1] = e->jmp_target_arg[1];
+    *gen_code_size = e->code_size;
+    *search_size = e->search_size;
+
+    trace_tb_cache_hit(tb->pc, phys_pc, tb->tc.ptr);
+    qatomic_inc(&tb_ctx.tb_cache_hit_count);
+    return true;
+}
+
+void tb_cache_store(CPUState *cpu, const TranslationBlock *tb,
+                    tb_page_addr_t phys_pc, const void *host_pc,
+                    int search_size)
+{
+    g_autoptr(GByteArray) buf = NULL;
+    static const uint8_t pad[8];
+    TBCacheEntry e = {
+        .host_pc = (uintptr_t)tb->tc.ptr,
+        .phys_pc = phys_pc,
+        .pc = tb->pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb->cflags,
+        .trace_vcpu_dstate = tb->trace_vcpu_dstate,
+        .size = tb->size,
+        .icount = tb->icount,
+        .code_size = tb->tc.size,
+        .search_size = search_size,
+        .jmp_reset_offset = { tb->jmp_reset_offset[0],
+                              tb->jmp_reset_offset[1] },
+        .jmp_target_arg = { tb->jmp_target_arg[0], tb->jmp_target_arg[1] },
+    };
+    size_t size = tb_cache_entry_size(&e);
+
+    /* Only TBs within one guest page are validated against its contents. */
+    if (!host_pc || !tb_cache_usable(cpu) ||
+        ((tb->pc ^ (tb->pc + tb->size - 1)) & TARGET_PAGE_MASK)) {
+        return;
+    }
+
+    buf = g_byte_array_sized_new(size);
+    g_byte_array_append(buf, (const guint8 *)&e, sizeof(e));
+    g_byte_array_append(buf, host_pc, e.size);
+    g_byte_array_append(buf, tcg_splitwx_to_rw(tb->tc.ptr),
+                        e.code_size + e.search_size);
+    g_byte_array_append(buf, pad, size - buf->len);
+    ((TBCacheEntry *)buf->data)->csum =
+        tb_cache_entry_csum((TBCacheEntry *)buf->data);
+
+    qemu_mutex_lock(&tb_cache.lock);
+    if (tb_cache.fd >= 0) {
+        struct stat st;
+        ssize_t ret = size;
+
+        /* Other processes append to the file too */
+        tb_cache_lock_file(tb_cache.fd, true);
+        if (fstat(tb_cache.fd, &st) < 0) {
+            ret = -1;
+        } else if (st.st_size + size <= TB_CACHE_MAX_SIZE) {
+            ret = qemu_write_full(tb_cache.fd, buf->data, size);
+        }
+        tb_cache_lock_file(tb_cache.fd, false);
+        if (ret != size) {
+            warn_report("tb-cache: cannot write '%s': %s", tb_cache.path,
+                        strerror(errno));
+            close(tb_cache.fd);
+            tb_cache.fd = -1;
+        }
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+}
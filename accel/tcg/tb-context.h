@@ -35,6 +35,14 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned evict_count;
+    unsigned evict_region_count;
+    unsigned evict_tb_count;
+    unsigned tb_hot_count;
+    unsigned tb_cache_hit_count;
+    unsigned tb_cache_miss_count;
+    unsigned tb_async_count;
+    unsigned tb_async_drop_count;
 };
 
 extern TBContext tb_ctx;
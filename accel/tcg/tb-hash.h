@@ -24,6 +24,23 @@
 #include "exec/exec-all.h"
 #include "qemu/xxhash.h"
 
+/*
+ * The per-vCPU jump cache has TB_JMP_CACHE_SIZE sets of TB_JMP_CACHE_WAYS
+ * entries each.  Both are set by the accelerator's "jmp-cache-bits" and
+ * "jmp-cache-ways" properties before any vCPU is realized.  tb_lookup()
+ * uses constants when they keep their default values.
+ */
+#define TB_JMP_CACHE_DEFAULT_BITS 12
+#define TB_JMP_CACHE_DEFAULT_WAYS 1
+
+extern unsigned int tb_jmp_cache_bits;
+extern unsigned int tb_jmp_cache_ways;
+extern bool tb_jmp_cache_default;
+
+#define TB_JMP_CACHE_BITS tb_jmp_cache_bits
+#define TB_JMP_CACHE_SIZE (1u << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_WAYS tb_jmp_cache_ways
+
 #ifdef CONFIG_SOFTMMU
 
 /* Only the bottom TB_JMP_PAGE_BITS of the jump cache hash bits vary for
@@ -41,29 +58,47 @@ static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
     return (tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK;
 }
 
-static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
+/* Set of @pc in a jump cache of 1 << @bits sets */
+static inline unsigned int tb_jmp_cache_hash_bits(target_ulong pc,
+                                                  unsigned int bits)
 {
+    unsigned int page_bits = bits / 2;
     target_ulong tmp;
-    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (((tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK)
-           | (tmp & TB_JMP_ADDR_MASK));
+    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - page_bits));
+    return (((tmp >> (TARGET_PAGE_BITS - page_bits)) &
+             ((1u << bits) - (1u << page_bits)))
+           | (tmp & ((1u << page_bits) - 1)));
 }
 
 #else
 
 /* In user-mode we can get better hashing because we do not have a TLB */
-static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
+static inline unsigned int tb_jmp_cache_hash_bits(target_ulong pc,
+                                                  unsigned int bits)
 {
-    return (pc ^ (pc >> TB_JMP_CACHE_BITS)) & (TB_JMP_CACHE_SIZE - 1);
+    return (pc ^ (pc >> bits)) & ((1u << bits) - 1);
 }
 
 #endif /* CONFIG_SOFTMMU */
 
+static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
+{
+    return tb_jmp_cache_hash_bits(pc, TB_JMP_CACHE_BITS);
+}
+
+/* Return the first entry of set @hash in the jump cache @jc */
+static inline TranslationBlock **tb_jmp_cache_set(CPUJumpCache *jc,
+                                                  unsigned int hash)
+{
+    return &jc->array[hash * TB_JMP_CACHE_WAYS];
+}
+
 static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc, uint32_t flags,
                       uint32_t cf_mask, uint32_t trace_vcpu_dstate)
 {
-    return qemu_xxhash7(phys_pc, pc, flags, cf_mask, trace_vcpu_dstate);
+    return qemu_xxhash7(phys_pc, pc, flags, cf_mask & ~CF_LOOKUP_IGNORE,
+                        trace_vcpu_dstate);
 }
 
 #endif
@@ -36,6 +36,7 @@
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
 #endif
+#include "tb-hash.h"
 #include "internal.h"
 
 struct TCGState {
@@ -44,11 +45,21 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t hot_threshold;
+    char *tb_cache;
+    uint32_t async_translate;
+    uint32_t jmp_cache_bits;
+    uint32_t jmp_cache_ways;
 };
 typedef struct TCGState TCGState;
 
 #define TYPE_TCG_ACCEL ACCEL_CLASS_NAME("tcg")
 
+#define TCG_MAX_ASYNC_TRANSLATE 64
+
+#define TCG_MIN_JMP_CACHE_BITS 8
+#define TCG_MAX_JMP_CACHE_BITS 16
+
 DECLARE_INSTANCE_CHECKER(TCGState, TCG_STATE,
                          TYPE_TCG_ACCEL)
 
@@ -106,9 +117,16 @@ static void tcg_accel_instance_init(Object *obj)
 #else
     s->splitwx_enabled = 0;
 #endif
+
+    s->jmp_cache_bits = TB_JMP_CACHE_DEFAULT_BITS;
+    s->jmp_cache_ways = TB_JMP_CACHE_DEFAULT_WAYS;
 }
 
 bool mttcg_enabled;
+uint32_t tb_hot_threshold;
+unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_DEFAULT_BITS;
+unsigned int tb_jmp_cache_ways = TB_JMP_CACHE_DEFAULT_WAYS;
+bool tb_jmp_cache_default = true;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -121,10 +139,30 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tb_hot_threshold = s->hot_threshold;
+    tb_jmp_cache_bits = s->jmp_cache_bits;
+    tb_jmp_cache_ways = s->jmp_cache_ways;
+    tb_jmp_cache_default = tb_jmp_cache_bits == TB_JMP_CACHE_DEFAULT_BITS &&
+                           tb_jmp_cache_ways == TB_JMP_CACHE_DEFAULT_WAYS;
+
+#if defined(CONFIG_SOFTMMU)
+    if (s->async_translate && !mttcg_enabled) {
+        warn_report("TCG asynchronous translation requires thread=multi");
+        s->async_translate = 0;
+    }
+#else
+    s->async_translate = 0;
+#endif
 
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    /* Each translation worker has its own TCG context */
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled,
+             max_cpus + s->async_translate);
+    if (tb_hot_threshold) {
+        tcg_region_init_exec_counts();
+    }
+    tb_cache_init(s->tb_cache);
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -132,6 +170,10 @@ static int tcg_init_machine(MachineState *ms)
      * initialize the prologue now.
      */
     tcg_prologue_init(tcg_ctx);
+
+    if (s->async_translate) {
+        tb_async_init(s->async_translate);
+    }
 #endif
 
     return 0;
@@ -196,6 +238,134 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->hot_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->hot_threshold = value;
+}
+
+static void tcg_get_async_translate(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->async_translate;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_async_translate(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value > TCG_MAX_ASYNC_TRANSLATE) {
+        error_setg(errp, "async-translate must be at most %d",
+                   TCG_MAX_ASYNC_TRANSLATE);
+        return;
+    }
+
+    s->async_translate = value;
+}
+
+static void tcg_get_jmp_cache_bits(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->jmp_cache_bits;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_jmp_cache_bits(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value < TCG_MIN_JMP_CACHE_BITS || value > TCG_MAX_JMP_CACHE_BITS) {
+        error_setg(errp, "jmp-cache-bits must be between %d and %d",
+                   TCG_MIN_JMP_CACHE_BITS, TCG_MAX_JMP_CACHE_BITS);
+        return;
+    }
+
+    s->jmp_cache_bits = value;
+}
+
+static void tcg_get_jmp_cache_ways(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->jmp_cache_ways;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_jmp_cache_ways(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value != 1 && value != 2 && value != 4) {
+        error_setg(errp, "jmp-cache-ways must be 1, 2 or 4");
+        return;
+    }
+
+    s->jmp_cache_ways = value;
+}
+
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -225,6 +395,38 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "hot-threshold", "int",
+        tcg_get_hot_threshold, tcg_set_hot_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "hot-threshold",
+        "Executions after which a translation block is retranslated "
+        "as a superblock (0 = disabled)");
+
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File keeping translated code across runs");
+
+    object_class_property_add(oc, "async-translate", "int",
+        tcg_get_async_translate, tcg_set_async_translate,
+        NULL, NULL);
+    object_class_property_set_description(oc, "async-translate",
+        "Number of threads optimizing translated code in the background "
+        "(0 = disabled)");
+
+    object_class_property_add(oc, "jmp-cache-bits", "int",
+        tcg_get_jmp_cache_bits, tcg_set_jmp_cache_bits,
+        NULL, NULL);
+    object_class_property_set_description(oc, "jmp-cache-bits",
+        "Log2 of the number of sets in the per-vCPU jump cache");
+
+    object_class_property_add(oc, "jmp-cache-ways", "int",
+        tcg_get_jmp_cache_ways, tcg_set_jmp_cache_ways,
+        NULL, NULL);
+    object_class_property_set_description(oc, "jmp-cache-ways",
+        "Associativity of the per-vCPU jump cache (1, 2 or 4)");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -894,7 +894,8 @@ static bool tb_cmp(const void *ap, const void *bp)
     return a->pc == b->pc &&
         a->cs_base == b->cs_base &&
         a->flags == b->flags &&
-        (tb_cflags(a) & ~CF_INVALID) == (tb_cflags(b) & ~CF_INVALID) &&
+        (tb_cflags(a) & ~(CF_INVALID | CF_LOOKUP_IGNORE)) ==
+        (tb_cflags(b) & ~(CF_INVALID | CF_LOOKUP_IGNORE)) &&
         a->trace_vcpu_dstate == b->trace_vcpu_dstate &&
         a->page_addr[0] == b->page_addr[0] &&
         a->page_addr[1] == b->page_addr[1];
@@ -962,11 +963,70 @@ static gboolean tb_host_size_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+/*
+ * Asynchronous translation
+ *
+ * With MTTCG, a vCPU that misses in the TB lookup can make a quick
+ * translation that skips the optimizer, and queue the TB so that a worker
+ * thread translates it again with full optimization.  The optimized TB
+ * then replaces the quick one in tb_ctx.htable.
+ */
+
+/* Above this many queued TBs, vCPUs translate with full optimization */
+#define TB_ASYNC_QUEUE_MAX 4096
+
+typedef struct TBAsyncRequest {
+    QSIMPLEQ_ENTRY(TBAsyncRequest) next;
+    CPUState *cpu;
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc;
+    unsigned flush_count;
+    unsigned evict_count;
+    /* copy of the guest code of @tb */
+    uint8_t code[];
+} TBAsyncRequest;
+
+typedef struct TBAsyncWorker {
+    QemuThread thread;
+    /* Held while translating, and by TB flush and eviction */
+    QemuMutex lock;
+    bool registered;
+} TBAsyncWorker;
+
+static struct {
+    unsigned n_workers;
+    TBAsyncWorker *workers;
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, TBAsyncRequest) queue;
+    unsigned queued;
+} tb_async;
+
+/* Wait for the workers to be done with code_gen_buffer, and hold them. */
+static void tb_async_pause(void)
+{
+    unsigned i;
+
+    for (i = 0; i < tb_async.n_workers; i++) {
+        qemu_mutex_lock(&tb_async.workers[i].lock);
+    }
+}
+
+static void tb_async_resume(void)
+{
+    unsigned i;
+
+    for (i = 0; i < tb_async.n_workers; i++) {
+        qemu_mutex_unlock(&tb_async.workers[i].lock);
+    }
+}
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
     bool did_flush = false;
 
+    tb_async_pause();
     mmap_lock();
     /* If it is already been done on request of another CPU,
      * just retry.
@@ -999,6 +1059,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
 done:
     mmap_unlock();
+    tb_async_resume();
     if (did_flush) {
         qemu_plugin_flush_cb();
     }
@@ -1207,9 +1268,22 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
-    CPU_FOREACH(cpu) {
-        if (qatomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            qatomic_set(&cpu->tb_jmp_cache[h], NULL);
+    WITH_RCU_READ_LOCK_GUARD() {
+        CPU_FOREACH(cpu) {
+            CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+            TranslationBlock **set;
+            unsigned int i;
+
+            /* The vCPU is being realized or unrealized */
+            if (!jc) {
+                continue;
+            }
+            set = tb_jmp_cache_set(jc, h);
+            for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+                if (qatomic_read(&set[i]) == tb) {
+                    qatomic_set(&set[i], NULL);
+                }
+            }
         }
     }
 
@@ -1246,6 +1320,77 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+/* Fraction of the regions that is evicted when code_gen_buffer is full */
+#define TB_EVICT_REGIONS_DIV 4
+
+static void tb_evict_tb(TranslationBlock *tb)
+{
+    tb_phys_invalidate(tb, -1);
+    qatomic_set(&tb_ctx.evict_tb_count, tb_ctx.evict_tb_count + 1);
+}
+
+/*
+ * Make room in code_gen_buffer by evicting the TBs of the oldest regions,
+ * and fall back to flushing all TBs if every region is in use.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data evict_count)
+{
+    CPUState *other_cpu;
+    size_t n;
+
+    tb_async_pause();
+    mmap_lock();
+    /*
+     * If room has already been made on request of another CPU,
+     * just retry.
+     */
+    if (tb_ctx.evict_count != evict_count.host_int ||
+        tcg_region_available()) {
+        mmap_unlock();
+        tb_async_resume();
+        return;
+    }
+
+    /*
+     * A vCPU may have cached a TB just after it was invalidated, and
+     * tb_evict_tb() cannot remove such an entry.  The memory of the TB
+     * is about to be reused, so forget every cached TB, as a flush does.
+     */
+    CPU_FOREACH(other_cpu) {
+        cpu_tb_jmp_cache_clear(other_cpu);
+    }
+
+    qemu_thread_jit_write();
+    n = tcg_region_evict(MAX(1, tcg_region_count() / TB_EVICT_REGIONS_DIV),
+                         tb_evict_tb);
+    qemu_thread_jit_execute();
+    if (n) {
+        qatomic_set(&tb_ctx.evict_region_count,
+                    tb_ctx.evict_region_count + n);
+        qatomic_mb_set(&tb_ctx.evict_count, tb_ctx.evict_count + 1);
+    }
+    mmap_unlock();
+    tb_async_resume();
+
+    if (!n) {
+        unsigned tb_flush_count = qatomic_mb_read(&tb_ctx.tb_flush_count);
+
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
+static void tb_evict(CPUState *cpu)
+{
+    unsigned evict_count = qatomic_mb_read(&tb_ctx.evict_count);
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(evict_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(evict_count));
+    }
+}
+
 #ifdef CONFIG_SOFTMMU
 /* call with @p->lock held */
 static void build_page_bitmap(PageDesc *p)
@@ -1378,6 +1523,239 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
+static bool tb_async_want(CPUState *cpu, uint32_t cflags)
+{
+    if (!tb_async.n_workers ||
+        (cflags & (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_SINGLE_STEP |
+                   CF_LAST_IO | CF_MEMI_ONLY | CF_USE_ICOUNT | CF_NOIRQ |
+                   CF_HOT)) ||
+        !CPU_GET_CLASS(cpu)->tcg_ops->async_translate ||
+        qatomic_read(&tb_async.queued) >= TB_ASYNC_QUEUE_MAX) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+#ifdef CONFIG_SOFTMMU
+static void tb_async_queue(CPUState *cpu, TranslationBlock *tb,
+                           tb_page_addr_t phys_pc, const void *host_pc)
+{
+    TBAsyncRequest *req;
+
+    /* Only TBs within one page are checked against the guest code.  */
+    if ((tb->pc ^ (tb->pc + tb->size - 1)) & TARGET_PAGE_MASK) {
+        return;
+    }
+
+    /*
+     * TB flush and eviction run in an exclusive section, so the counts
+     * cannot change while this vCPU is translating.
+     */
+    req = g_malloc(sizeof(*req) + tb->size);
+    req->cpu = cpu;
+    req->tb = tb;
+    req->phys_pc = phys_pc;
+    req->flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+    req->evict_count = qatomic_read(&tb_ctx.evict_count);
+    memcpy(req->code, host_pc, tb->size);
+
+    qemu_mutex_lock(&tb_async.lock);
+    QSIMPLEQ_INSERT_TAIL(&tb_async.queue, req, next);
+    qatomic_set(&tb_async.queued, tb_async.queued + 1);
+    qemu_cond_signal(&tb_async.cond);
+    qemu_mutex_unlock(&tb_async.lock);
+}
+
+/* Called with the worker lock held, in an RCU read-side critical section */
+static void tb_async_translate(TBAsyncRequest *req)
+{
+    TranslationBlock *quick = req->tb;
+    TranslationBlock *tb, *existing_tb;
+    tcg_insn_unit *gen_code_buf;
+    int gen_code_size, search_size;
+    void *host;
+
+    /* The quick TB may have been invalidated, or its memory reused.  */
+    if (qatomic_read(&tb_ctx.tb_flush_count) != req->flush_count ||
+        qatomic_read(&tb_ctx.evict_count) != req->evict_count ||
+        (qatomic_read(&quick->cflags) & CF_INVALID)) {
+        goto drop;
+    }
+
+    qemu_thread_jit_write();
+    tb = tcg_tb_alloc(tcg_ctx);
+    if (unlikely(!tb)) {
+        /* Never evict directly: a vCPU may wait for this worker.  */
+        async_safe_run_on_cpu(req->cpu, do_tb_evict,
+            RUN_ON_CPU_HOST_INT(qatomic_mb_read(&tb_ctx.evict_count)));
+        goto drop;
+    }
+
+    gen_code_buf = tcg_ctx->code_gen_ptr;
+    tb->tc.ptr = tcg_splitwx_to_rx(gen_code_buf);
+    tb->pc = quick->pc;
+    tb->cs_base = quick->cs_base;
+    tb->flags = quick->flags;
+    tb->cflags = quick->cflags & ~CF_QUICK;
+    tb->trace_vcpu_dstate = quick->trace_vcpu_dstate;
+    if (tb_hot_threshold) {
+        qatomic_set(tcg_tb_exec_count(tb), 0);
+    }
+    tcg_ctx->tb_cflags = tb->cflags;
+    tcg_ctx->code_snapshot = req->code;
+    tcg_ctx->code_snapshot_pc = quick->pc;
+    tcg_ctx->code_snapshot_len = quick->size;
+
+    /*
+     * Overflow of code_gen_buffer, of the maximum size of a TB or of the
+     * guest code copy: leave the quick TB in place.
+     */
+    gen_code_size = sigsetjmp(tcg_ctx->jmp_trans, 0);
+    if (unlikely(gen_code_size != 0)) {
+        goto fail;
+    }
+
+    tcg_func_start(tcg_ctx);
+
+    tcg_ctx->cpu = req->cpu;
+    gen_intermediate_code(req->cpu, tb, quick->icount);
+    tcg_ctx->cpu = NULL;
+    if (tb->size != quick->size || tb->icount != quick->icount) {
+        goto fail;
+    }
+
+    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
+    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
+    tcg_ctx->tb_jmp_reset_offset = tb->jmp_reset_offset;
+    if (TCG_TARGET_HAS_direct_jump) {
+        tcg_ctx->tb_jmp_insn_offset = tb->jmp_target_arg;
+        tcg_ctx->tb_jmp_target_addr = NULL;
+    } else {
+        tcg_ctx->tb_jmp_insn_offset = NULL;
+        tcg_ctx->tb_jmp_target_addr = tb->jmp_target_arg;
+    }
+
+    gen_code_size = tcg_gen_code(tcg_ctx, tb);
+    if (unlikely(gen_code_size < 0)) {
+        goto fail;
+    }
+    search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
+    if (unlikely(search_size < 0)) {
+        goto fail;
+    }
+    tb->tc.size = gen_code_size;
+    tcg_ctx->code_snapshot = NULL;
+
+    qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
+        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
+                 CODE_GEN_ALIGN));
+
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+
+    /*
+     * Writes to the guest code after the quick translation invalidate
+     * the quick TB, but check the copy in case the write is in flight.
+     * Unplugging the RAM does not invalidate the quick TB.
+     */
+    host = qemu_try_map_ram_ptr(req->phys_pc, tb->size);
+    if (!host || memcmp(host, req->code, tb->size)) {
+        goto drop;
+    }
+
+    tcg_tb_insert(tb);
+    tb_phys_invalidate(quick, -1);
+    existing_tb = tb_link_page(tb, req->phys_pc, -1);
+    if (unlikely(existing_tb != tb)) {
+        /* A vCPU has translated the TB again in the meantime.  */
+        tcg_tb_remove(tb);
+        goto drop;
+    }
+    qatomic_inc(&tb_ctx.tb_async_count);
+    return;
+
+ fail:
+    tcg_ctx->code_snapshot = NULL;
+    tcg_ctx->cpu = NULL;
+ drop:
+    qatomic_inc(&tb_ctx.tb_async_drop_count);
+}
+
+static void *tb_async_thread(void *opaque)
+{
+    TBAsyncWorker *w = opaque;
+    TBAsyncRequest *req;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&tb_async.lock);
+    while (true) {
+        while (QSIMPLEQ_EMPTY(&tb_async.queue)) {
+            qemu_cond_wait(&tb_async.cond, &tb_async.lock);
+        }
+        req = QSIMPLEQ_FIRST(&tb_async.queue);
+        QSIMPLEQ_REMOVE_HEAD(&tb_async.queue, next);
+        qatomic_set(&tb_async.queued, tb_async.queued - 1);
+        qemu_mutex_unlock(&tb_async.lock);
+
+        qemu_mutex_lock(&w->lock);
+        /* The TCG globals are complete once the vCPUs are running.  */
+        if (!w->registered) {
+            tcg_register_thread();
+            w->registered = true;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            tb_async_translate(req);
+        }
+        qemu_mutex_unlock(&w->lock);
+        g_free(req);
+
+        qemu_mutex_lock(&tb_async.lock);
+    }
+    return NULL;
+}
+
+void tb_async_init(unsigned n_workers)
+{
+    unsigned i;
+
+    qemu_mutex_init(&tb_async.lock);
+    qemu_cond_init(&tb_async.cond);
+    QSIMPLEQ_INIT(&tb_async.queue);
+    tb_async.workers = g_new0(TBAsyncWorker, n_workers);
+
+    for (i = 0; i < n_workers; i++) {
+        TBAsyncWorker *w = &tb_async.workers[i];
+        g_autofree char *name = g_strdup_printf("TCG translate %u", i);
+
+        qemu_mutex_init(&w->lock);
+        qemu_thread_create(&w->thread, name, tb_async_thread, w,
+                           QEMU_THREAD_DETACHED);
+    }
+    tb_async.n_workers = n_workers;
+}
+#else
+static inline void tb_async_queue(CPUState *cpu, TranslationBlock *tb,
+                                  tb_page_addr_t phys_pc, const void *host_pc)
+{
+}
+#endif /* CONFIG_SOFTMMU */
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
@@ -1388,6 +1766,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
+    void *host_pc;
     int gen_code_size, search_size, max_insns;
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
@@ -1397,11 +1776,13 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_memory_lock();
     qemu_thread_jit_write();
 
-    phys_pc = get_page_addr_code(env, pc);
+    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
 
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
         cflags = (cflags & ~CF_COUNT_MASK) | CF_LAST_IO | 1;
+    } else if (tb_async_want(cpu, cflags)) {
+        cflags |= CF_QUICK;
     }
 
     max_insns = cflags & CF_COUNT_MASK;
@@ -1413,8 +1794,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction or flush must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1428,7 +1809,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    if (tb_hot_threshold) {
+        qatomic_set(tcg_tb_exec_count(tb), 0);
+    }
     tcg_ctx->tb_cflags = cflags;
+
+    if (phys_pc != -1 &&
+        tb_cache_lookup(cpu, tb, phys_pc, host_pc,
+                        &gen_code_size, &search_size)) {
+        goto cached;
+    }
  tb_overflow:
 
 #ifdef CONFIG_PROFILER
@@ -1518,6 +1908,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tb->tc.size = gen_code_size;
 
+    if (phys_pc != -1) {
+        tb_cache_store(cpu, tb, phys_pc, host_pc, search_size);
+    }
+
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
     qatomic_set(&prof->code_in_len, prof->code_in_len + tb->size);
@@ -1594,6 +1988,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
+ cached:
     qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
@@ -1652,6 +2047,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tcg_tb_remove(tb);
         return existing_tb;
     }
+    if (cflags & CF_QUICK) {
+        tb_async_queue(cpu, tb, phys_pc, host_pc);
+    }
     return tb;
 }
 
@@ -2071,6 +2469,7 @@ void dump_exec_info(GString *buf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    CPUState *cpu;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2083,6 +2482,8 @@ void dump_exec_info(GString *buf)
      */
     g_string_append_printf(buf, "gen code size       %zu/%zu\n",
                            tcg_code_size(), tcg_code_capacity());
+    g_string_append_printf(buf, "gen code regions    %zu\n",
+                           tcg_region_count());
     g_string_append_printf(buf, "TB count            %zu\n", nb_tbs);
     g_string_append_printf(buf, "TB avg target size  %zu max=%zu bytes\n",
                            nb_tbs ? tst.target_size / nb_tbs : 0,
@@ -2109,9 +2510,30 @@ void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB evict count      %u "
+                           "(%u regions, %u TBs)\n",
+                           qatomic_read(&tb_ctx.evict_count),
+                           qatomic_read(&tb_ctx.evict_region_count),
+                           qatomic_read(&tb_ctx.evict_tb_count));
+    g_string_append_printf(buf, "TB hot count        %u\n",
+                           qatomic_read(&tb_ctx.tb_hot_count));
+    g_string_append_printf(buf, "TB cache hit/miss   %u/%u\n",
+                           qatomic_read(&tb_ctx.tb_cache_hit_count),
+                           qatomic_read(&tb_ctx.tb_cache_miss_count));
+    g_string_append_printf(buf, "TB async count      %u (%u dropped)\n",
+                           qatomic_read(&tb_ctx.tb_async_count),
+                           qatomic_read(&tb_ctx.tb_async_drop_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
 
+    g_string_append_printf(buf, "TB jump cache       %u sets, %u ways\n",
+                           TB_JMP_CACHE_SIZE, TB_JMP_CACHE_WAYS);
+    CPU_FOREACH(cpu) {
+        g_string_append_printf(buf, "  vCPU %-3d misses %zu\n",
+                               cpu->cpu_index,
+                               qatomic_read(&cpu->tb_jmp_cache_miss));
+    }
+
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
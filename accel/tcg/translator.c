@@ -16,7 +16,10 @@
 #include "exec/log.h"
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
+#include "exec/helper-proto.h"
+#include "exec/helper-gen.h"
 #include "sysemu/replay.h"
+#include "internal.h"
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -51,6 +54,38 @@ static inline void translator_page_protect(DisasContextBase *dcbase,
 #endif
 }
 
+/*
+ * Count the executions of @tb, and have it retranslated with CF_HOT once
+ * the count reaches tb_hot_threshold.
+ */
+static void gen_tb_exec_count(const TranslatorOps *ops, TranslationBlock *tb)
+{
+    TCGv_ptr ptr;
+    TCGv_i32 count;
+    TCGLabel *cold;
+
+    if (!tb_hot_threshold || !ops->hot_superblocks ||
+        (tb_cflags(tb) & (CF_HOT | CF_USE_ICOUNT | CF_NO_GOTO_TB))) {
+        return;
+    }
+
+    ptr = tcg_const_ptr(tcg_tb_exec_count(tb));
+    count = tcg_temp_new_i32();
+    cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_LTU, count, tb_hot_threshold, cold);
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+
+    ptr = tcg_const_ptr(tb);
+    gen_helper_tb_hot(cpu_env, ptr);
+    tcg_temp_free_ptr(ptr);
+    gen_set_label(cold);
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns)
 {
@@ -75,6 +110,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     /* Start translating.  */
     gen_tb_start(db->tb);
+    gen_tb_exec_count(ops, db->tb);
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -160,12 +196,32 @@ static inline void translator_maybe_page_protect(DisasContextBase *dcbase,
 #endif
 }
 
-#define GEN_TRANSLATOR_LD(fullname, type, load_fn, swap_fn)             \
+/*
+ * Return the copy of the guest code at @pc, or abandon the translation
+ * if it is not part of the snapshot.
+ */
+static const uint8_t *translator_snapshot(abi_ptr pc, size_t len)
+{
+    TCGContext *s = tcg_ctx;
+
+    if (pc - s->code_snapshot_pc >= s->code_snapshot_len ||
+        s->code_snapshot_len - (pc - s->code_snapshot_pc) < len) {
+        siglongjmp(s->jmp_trans, -3);
+    }
+    return s->code_snapshot + (pc - s->code_snapshot_pc);
+}
+
+#define GEN_TRANSLATOR_LD(fullname, type, load_fn, swap_fn, snap_fn)    \
     type fullname ## _swap(CPUArchState *env, DisasContextBase *dcbase, \
                            abi_ptr pc, bool do_swap)                    \
     {                                                                   \
+        type ret;                                                       \
         translator_maybe_page_protect(dcbase, pc, sizeof(type));        \
-        type ret = load_fn(env, pc);                                    \
+        if (unlikely(tcg_ctx->code_snapshot)) {                         \
+            ret = snap_fn(translator_snapshot(pc, sizeof(type)));       \
+        } else {                                                        \
+            ret = load_fn(env, pc);                                     \
+        }                                                               \
         if (do_swap) {                                                  \
             ret = swap_fn(ret);                                         \
         }                                                               \
@@ -109,8 +109,8 @@ static int block_latency_histogram_compare_func(const void *key, const void *it)
     return k < a ? -1 : (k < b ? 0 : 1);
 }
 
-static void block_latency_histogram_account(BlockLatencyHistogram *hist,
-                                            int64_t latency_ns)
+void block_latency_histogram_account(BlockLatencyHistogram *hist,
+                                     int64_t latency_ns)
 {
     uint64_t *pos;
 
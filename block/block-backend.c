@@ -2609,12 +2609,28 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
     if (r) {
         return r;
     }
+    return blk_co_copy_range_from_child(blk_in->root, off_in, blk_out, off_out,
+                                        bytes, read_flags, write_flags);
+}
+
+/*
+ * Like blk_co_copy_range(), but for a source that is not attached to a
+ * BlockBackend, e.g. the backing child of a block job's filter node.
+ */
+int coroutine_fn blk_co_copy_range_from_child(BdrvChild *src, int64_t off_in,
+                                              BlockBackend *blk_out,
+                                              int64_t off_out, int64_t bytes,
+                                              BdrvRequestFlags read_flags,
+                                              BdrvRequestFlags write_flags)
+{
+    int r;
+    IO_CODE();
+
     r = blk_check_byte_request(blk_out, off_out, bytes);
     if (r) {
         return r;
     }
-    return bdrv_co_copy_range(blk_in->root, off_in,
-                              blk_out->root, off_out,
+    return bdrv_co_copy_range(src, off_in, blk_out->root, off_out,
                               bytes, read_flags, write_flags);
 }
 
@@ -158,8 +158,14 @@ typedef struct BDRVRawState {
     bool discard_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool use_fixed_buffers:1;
+    bool use_iopoll:1;
+    /* References taken on the fixed buffers of the rings of the AioContext */
+    bool fixed_buffers_enabled:1;
+    bool fixed_buffers_poll:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
+    bool has_clone_range;
     bool needs_alignment;
     bool force_alignment;
     bool drop_cache;
@@ -169,6 +175,9 @@ typedef struct BDRVRawState {
         uint64_t discard_nb_failed;
         uint64_t discard_bytes_ok;
     } stats;
+#ifdef CONFIG_LINUX_IO_URING
+    LuringLatencyStats luring_stats;
+#endif
 
     PRManager *pr_mgr;
 } BDRVRawState;
@@ -551,6 +560,18 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM with io_uring (default: off)",
+        },
+        {
+            .name = "aio-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "use a polled io_uring for O_DIRECT I/O (default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -579,6 +600,62 @@ static QemuOptsList raw_runtime_opts = {
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * The ring for reads and writes if @rw, for other requests otherwise.
+ * Polled rings only work with O_DIRECT, which a reopen may have turned
+ * off, and cannot flush.
+ */
+static LuringState *raw_luring(BlockDriverState *bs, bool rw)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
+    if (rw && s->use_iopoll && (s->open_flags & O_DIRECT)) {
+        return aio_get_linux_io_uring_poll(ctx);
+    }
+    return aio_get_linux_io_uring(ctx);
+}
+
+/* Enable fixed buffers in the rings of @ctx, the node's new AioContext */
+static bool raw_luring_enable_fixed_buffers(BlockDriverState *bs,
+                                            AioContext *ctx, Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (!luring_enable_fixed_buffers(aio_get_linux_io_uring(ctx), errp)) {
+        return false;
+    }
+    if (s->use_iopoll &&
+        !luring_enable_fixed_buffers(aio_get_linux_io_uring_poll(ctx), errp)) {
+        luring_disable_fixed_buffers(aio_get_linux_io_uring(ctx));
+        return false;
+    }
+    s->fixed_buffers_enabled = true;
+    s->fixed_buffers_poll = s->use_iopoll;
+    return true;
+}
+
+/*
+ * Drop the references taken by raw_luring_enable_fixed_buffers(), before
+ * closing the node or moving it out of its AioContext
+ */
+static void raw_luring_disable_fixed_buffers(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
+    if (!s->fixed_buffers_enabled) {
+        return;
+    }
+    luring_disable_fixed_buffers(aio_get_linux_io_uring(ctx));
+    if (s->fixed_buffers_poll) {
+        luring_disable_fixed_buffers(aio_get_linux_io_uring_poll(ctx));
+    }
+    s->fixed_buffers_enabled = false;
+}
+#endif
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -628,6 +705,18 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_fixed_buffers = qemu_opt_get_bool(opts, "aio-fixed-buffers", false);
+    if (s->use_fixed_buffers && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->use_iopoll = qemu_opt_get_bool(opts, "aio-iopoll", false);
+    if (s->use_iopoll && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-iopoll requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -730,6 +819,27 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
         }
+        if (s->use_iopoll) {
+            if (!(s->open_flags & O_DIRECT)) {
+                error_setg(errp, "aio-iopoll requires cache.direct=on");
+                ret = -EINVAL;
+                goto fail;
+            }
+            if (!aio_setup_linux_io_uring_poll(bdrv_get_aio_context(bs),
+                                               errp)) {
+                error_prepend(errp, "Unable to use polled io_uring: ");
+                ret = -EINVAL;
+                goto fail;
+            }
+        }
+        if (s->use_fixed_buffers &&
+            !raw_luring_enable_fixed_buffers(bs, bdrv_get_aio_context(bs),
+                                             errp)) {
+            error_prepend(errp, "Unable to use io_uring fixed buffers: ");
+            ret = -EINVAL;
+            goto fail;
+        }
+        luring_latency_stats_init(&s->luring_stats);
     }
 #else
     if (s->use_linux_io_uring) {
@@ -742,6 +852,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->has_discard = true;
     s->has_write_zeroes = true;
+    s->has_clone_range = true;
 
     if (fstat(s->fd, &st) < 0) {
         ret = -errno;
@@ -810,6 +921,12 @@ fail:
     if (ret < 0 && s->fd != -1) {
         qemu_close(s->fd);
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (ret < 0) {
+        raw_luring_disable_fixed_buffers(bs);
+        luring_latency_stats_cleanup(&s->luring_stats);
+    }
+#endif
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
         unlink(filename);
     }
@@ -1787,6 +1904,50 @@ static off_t copy_file_range(int in_fd, off_t *in_off, int out_fd,
 }
 #endif
 
+/*
+ * Try to share the source extents with the destination instead of copying
+ * them.  Returns 0 on success and a negative errno if the caller has to copy
+ * the data itself.
+ */
+static int handle_aiocb_clone_range(RawPosixAIOData *aiocb)
+{
+#ifdef FICLONERANGE
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range range = {
+        .src_fd = aiocb->aio_fildes,
+        .src_offset = aiocb->aio_offset,
+        .src_length = aiocb->aio_nbytes,
+        .dest_offset = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    if (!s->has_clone_range) {
+        return -ENOTSUP;
+    }
+
+    do {
+        ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &range);
+    } while (ret < 0 && errno == EINTR);
+    ret = ret < 0 ? -errno : 0;
+    trace_file_clone_range(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                           aiocb->copy_range.aio_fd2,
+                           aiocb->copy_range.aio_offset2, aiocb->aio_nbytes,
+                           ret);
+
+    switch (ret) {
+    case -ENOTTY:
+    case -EOPNOTSUPP:
+    case -EXDEV:
+        /* Not a reflink capable filesystem, or not the same one */
+        s->has_clone_range = false;
+        break;
+    }
+    return ret;
+#else
+    return -ENOTSUP;
+#endif
+}
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -1794,6 +1955,14 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+    /*
+     * Unaligned ranges or ranges beyond EOF cannot be cloned, but
+     * copy_file_range() may still be able to offload them.
+     */
+    if (handle_aiocb_clone_range(aiocb) == 0) {
+        return 0;
+    }
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -2066,9 +2235,9 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
         assert(qiov->size == bytes);
-        return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+        return luring_co_submit(bs, raw_luring(bs, true), s->fd, offset, qiov,
+                                type, &s->luring_stats);
 #endif
 #ifdef CONFIG_LINUX_AIO
     } else if (s->use_linux_aio) {
@@ -2121,8 +2290,12 @@ static void raw_aio_plug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        luring_io_plug(bs, aio);
+        AioContext *ctx = bdrv_get_aio_context(bs);
+
+        luring_io_plug(bs, aio_get_linux_io_uring(ctx));
+        if (s->use_iopoll) {
+            luring_io_plug(bs, aio_get_linux_io_uring_poll(ctx));
+        }
     }
 #endif
 }
@@ -2138,8 +2311,12 @@ static void raw_aio_unplug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        luring_io_unplug(bs, aio);
+        AioContext *ctx = bdrv_get_aio_context(bs);
+
+        luring_io_unplug(bs, aio_get_linux_io_uring(ctx));
+        if (s->use_iopoll) {
+            luring_io_unplug(bs, aio_get_linux_io_uring_poll(ctx));
+        }
     }
 #endif
 }
@@ -2163,8 +2340,8 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, raw_luring(bs, false), s->fd, 0, NULL,
+                                QEMU_AIO_FLUSH, &s->luring_stats);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
@@ -2191,19 +2368,66 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
+            s->use_iopoll = false;
+        }
+    }
+    if (s->use_linux_io_uring && s->use_iopoll) {
+        Error *local_err = NULL;
+        if (!aio_setup_linux_io_uring_poll(new_context, &local_err)) {
+            error_reportf_err(local_err, "Unable to use polled io_uring, "
+                                         "falling back to interrupts: ");
+            s->use_iopoll = false;
+        }
+    }
+    if (s->use_linux_io_uring && s->use_fixed_buffers) {
+        Error *local_err = NULL;
+        if (!raw_luring_enable_fixed_buffers(bs, new_context, &local_err)) {
+            error_reportf_err(local_err, "Unable to use io_uring fixed "
+                                         "buffers: ");
+            s->use_fixed_buffers = false;
         }
     }
 #endif
 }
 
+/* Forget the io_uring fixed file of s->fd, before closing or moving it */
+static void raw_luring_unregister_fd(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_linux_io_uring && s->fd >= 0) {
+        AioContext *ctx = bdrv_get_aio_context(bs);
+
+        luring_unregister_fd(aio_get_linux_io_uring(ctx), s->fd);
+        if (s->use_iopoll) {
+            luring_unregister_fd(aio_get_linux_io_uring_poll(ctx), s->fd);
+        }
+    }
+#endif
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    raw_luring_unregister_fd(bs);
+#ifdef CONFIG_LINUX_IO_URING
+    raw_luring_disable_fixed_buffers(bs);
+#endif
+}
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
     if (s->fd >= 0) {
+        raw_luring_unregister_fd(bs);
         qemu_close(s->fd);
         s->fd = -1;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    raw_luring_disable_fixed_buffers(bs);
+    luring_latency_stats_cleanup(&s->luring_stats);
+#endif
 }
 
 /**
@@ -3069,14 +3293,45 @@ static int raw_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static BlockLatencyHistogramInfo *
+raw_latency_histogram_info(BlockLatencyHistogram *hist)
+{
+    BlockLatencyHistogramInfo *info = g_new0(BlockLatencyHistogramInfo, 1);
+    uint64List **boundaries = &info->boundaries;
+    uint64List **bins = &info->bins;
+    int i;
+
+    for (i = 0; i < hist->nbins - 1; i++) {
+        QAPI_LIST_APPEND(boundaries, hist->boundaries[i]);
+    }
+    for (i = 0; i < hist->nbins; i++) {
+        QAPI_LIST_APPEND(bins, hist->bins[i]);
+    }
+    return info;
+}
+#endif
+
 static BlockStatsSpecificFile get_blockstats_specific_file(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
-    return (BlockStatsSpecificFile) {
+    BlockStatsSpecificFile stats = {
         .discard_nb_ok = s->stats.discard_nb_ok,
         .discard_nb_failed = s->stats.discard_nb_failed,
         .discard_bytes_ok = s->stats.discard_bytes_ok,
     };
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->luring_stats.submit.bins) {
+        stats.has_io_uring_submit_latency = true;
+        stats.has_io_uring_complete_latency = true;
+        stats.io_uring_submit_latency =
+            raw_latency_histogram_info(&s->luring_stats.submit);
+        stats.io_uring_complete_latency =
+            raw_latency_histogram_info(&s->luring_stats.complete);
+    }
+#endif
+    return stats;
 }
 
 static BlockStatsSpecific *raw_get_specific_stats(BlockDriverState *bs)
@@ -3196,6 +3451,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_luring_unregister_fd(bs);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3297,6 +3553,7 @@ BlockDriver bdrv_file = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
@@ -3669,6 +3926,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
@@ -3793,6 +4051,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3923,6 +4182,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
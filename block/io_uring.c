@@ -16,12 +16,27 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "qapi/error.h"
+#include "exec/ramlist.h"
+#include "exec/memory.h"
+#include "qemu/timer.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of image fds that can be registered as fixed files */
+#define MAX_FIXED_FILES 64
+
+/*
+ * Limits on fixed buffers: the kernel refuses buffers larger than 1 GiB
+ * and, before Linux 5.13, more than UIO_MAXIOV of them.
+ */
+#define MAX_FIXED_BUF_SIZE (1ULL << 30)
+#define MAX_FIXED_BUFS 1024
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -36,6 +51,11 @@ typedef struct LuringAIOCB {
      */
     int total_read;
     QEMUIOVector resubmit_qiov;
+
+    /* Latency accounting, @stats may be NULL */
+    LuringLatencyStats *stats;
+    int64_t queued_ns;
+    int64_t submitted_ns;
 } LuringAIOCB;
 
 typedef struct LuringQueue {
@@ -51,11 +71,45 @@ typedef struct LuringState {
 
     struct io_uring ring;
 
+    /* SQPOLL | IOPOLL ring, see luring_init_polled() */
+    bool polled;
+
     /* io queue for submit at batch.  Protected by AioContext lock. */
     LuringQueue io_q;
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Image fds registered as fixed files, -1 for free slots.  Protected
+     * by AioContext lock.
+     */
+    bool fixed_files_enabled;
+    int fixed_files[MAX_FIXED_FILES];
+
+    /*
+     * Guest RAM registered as fixed buffers, see luring_enable_fixed_buffers.
+     * Number of nodes that enabled them, changed in the main loop.
+     */
+    unsigned int fixed_bufs_users;
+    RAMBlockNotifier ram_notifier;
+
+    /*
+     * Guest RAM regions reported by the notifier, changed in the main loop
+     * and protected by ram_regions_lock.  ram_regions_gen is bumped on every
+     * change.
+     */
+    QemuMutex ram_regions_lock;
+    GArray *ram_regions;
+    unsigned int ram_regions_gen;
+
+    /*
+     * Buffers currently registered with the ring, sorted by address, and the
+     * ram_regions_gen they were built from.  Only used in I/O thread.
+     */
+    struct iovec *fixed_bufs;
+    unsigned int nr_fixed_bufs;
+    unsigned int fixed_bufs_gen;
 } LuringState;
 
 /**
@@ -66,6 +120,7 @@ typedef struct LuringState {
  */
 static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
 {
+    luringcb->queued_ns = get_clock();
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
 }
@@ -102,6 +157,10 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
                       remaining);
 
+    /* The rest is read with a plain readv, even if this was READ_FIXED */
+    luringcb->sqeq.opcode = IORING_OP_READV;
+    luringcb->sqeq.buf_index = 0;
+
     /* Update sqe */
     luringcb->sqeq.off = nread;
     luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
@@ -160,6 +219,11 @@ static void luring_process_completions(LuringState *s)
         /* Change counters one-by-one because we can be nested. */
         s->io_q.in_flight--;
         trace_luring_process_completion(s, luringcb, ret);
+        if (luringcb->stats) {
+            block_latency_histogram_account(&luringcb->stats->complete,
+                                            get_clock() -
+                                            luringcb->submitted_ns);
+        }
 
         /* total_read is non-zero only for resubmitted read requests */
         total_bytes = ret + luringcb->total_read;
@@ -240,6 +304,12 @@ static int ioq_submit(LuringState *s)
             /* Prep sqe for submission */
             *sqes = luringcb->sqeq;
             QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+            if (luringcb->stats) {
+                luringcb->submitted_ns = get_clock();
+                block_latency_histogram_account(&luringcb->stats->submit,
+                                                luringcb->submitted_ns -
+                                                luringcb->queued_ns);
+            }
         }
         ret = io_uring_submit(&s->ring);
         trace_luring_io_uring_submit(s, ret);
@@ -328,6 +398,269 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/*
+ * Fixed buffers
+ *
+ * Registering guest RAM with the ring saves the kernel from pinning and
+ * mapping the pages of every request.  The notifier, which runs in the main
+ * loop, only records the RAM regions; the I/O thread re-registers them once
+ * no request is in flight, and does not use fixed buffers at all in the
+ * meantime, since a region may have been unmapped.
+ */
+
+static void luring_ram_regions_changed(LuringState *s)
+{
+    qatomic_set(&s->ram_regions_gen, s->ram_regions_gen + 1);
+}
+
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    struct iovec region = { .iov_base = host, .iov_len = size };
+
+    QEMU_LOCK_GUARD(&s->ram_regions_lock);
+    g_array_append_val(s->ram_regions, region);
+    luring_ram_regions_changed(s);
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    guint i;
+
+    QEMU_LOCK_GUARD(&s->ram_regions_lock);
+    for (i = 0; i < s->ram_regions->len; i++) {
+        if (g_array_index(s->ram_regions, struct iovec, i).iov_base == host) {
+            g_array_remove_index_fast(s->ram_regions, i);
+            luring_ram_regions_changed(s);
+            return;
+        }
+    }
+}
+
+static void luring_ram_block_resized(RAMBlockNotifier *n, void *host,
+                                     size_t old_size, size_t new_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    guint i;
+
+    QEMU_LOCK_GUARD(&s->ram_regions_lock);
+    for (i = 0; i < s->ram_regions->len; i++) {
+        struct iovec *region = &g_array_index(s->ram_regions, struct iovec, i);
+
+        if (region->iov_base == host) {
+            region->iov_len = new_size;
+            luring_ram_regions_changed(s);
+            return;
+        }
+    }
+}
+
+static gint luring_iovec_compare(gconstpointer a, gconstpointer b)
+{
+    const struct iovec *ia = a, *ib = b;
+
+    return ia->iov_base < ib->iov_base ? -1 : ia->iov_base > ib->iov_base;
+}
+
+/* Register the current RAM regions with the ring, the ring must be idle */
+static void luring_register_fixed_buffers(LuringState *s)
+{
+    GArray *bufs = g_array_new(false, false, sizeof(struct iovec));
+    unsigned int gen;
+    guint i;
+    int ret;
+
+    WITH_QEMU_LOCK_GUARD(&s->ram_regions_lock) {
+        gen = qatomic_read(&s->ram_regions_gen);
+        for (i = 0; i < s->ram_regions->len; i++) {
+            struct iovec region =
+                g_array_index(s->ram_regions, struct iovec, i);
+
+            /* Split regions in chunks the kernel accepts */
+            while (region.iov_len && bufs->len < MAX_FIXED_BUFS) {
+                struct iovec buf = {
+                    .iov_base = region.iov_base,
+                    .iov_len = MIN(region.iov_len, MAX_FIXED_BUF_SIZE),
+                };
+
+                g_array_append_val(bufs, buf);
+                region.iov_base = (uint8_t *)region.iov_base + buf.iov_len;
+                region.iov_len -= buf.iov_len;
+            }
+        }
+    }
+    g_array_sort(bufs, luring_iovec_compare);
+
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+    }
+    g_free(s->fixed_bufs);
+    s->fixed_bufs_gen = gen;
+    s->nr_fixed_bufs = bufs->len;
+    s->fixed_bufs = (struct iovec *)g_array_free(bufs, false);
+
+    if (!s->nr_fixed_bufs) {
+        return;
+    }
+    ret = io_uring_register_buffers(&s->ring, s->fixed_bufs, s->nr_fixed_bufs);
+    trace_luring_register_fixed_buffers(s, s->nr_fixed_bufs, ret);
+    if (ret < 0) {
+        /* Typically RLIMIT_MEMLOCK, keep going without fixed buffers */
+        warn_report_once("io_uring: cannot register guest RAM as fixed "
+                         "buffers: %s", strerror(-ret));
+        s->nr_fixed_bufs = 0;
+    }
+}
+
+/*
+ * Returns the index of the registered buffer that contains the whole of
+ * @qiov, or -1 if the request must use a plain readv/writev
+ */
+static int luring_fixed_buf_index(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t start, end;
+    unsigned int lo = 0, hi;
+
+    if (!s->fixed_bufs_users || qiov->niov != 1) {
+        return -1;
+    }
+    if (s->fixed_bufs_gen != qatomic_read(&s->ram_regions_gen)) {
+        if (s->io_q.in_flight || s->io_q.in_queue) {
+            return -1;
+        }
+        luring_register_fixed_buffers(s);
+    }
+
+    start = (uintptr_t)qiov->iov[0].iov_base;
+    end = start + qiov->iov[0].iov_len;
+    hi = s->nr_fixed_bufs;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        uintptr_t buf_start = (uintptr_t)s->fixed_bufs[mid].iov_base;
+        uintptr_t buf_end = buf_start + s->fixed_bufs[mid].iov_len;
+
+        if (end <= buf_start) {
+            hi = mid;
+        } else if (start >= buf_end) {
+            lo = mid + 1;
+        } else {
+            return start >= buf_start && end <= buf_end ? mid : -1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Enable fixed buffers for a node using @s.  Every successful call must be
+ * paired with luring_disable_fixed_buffers() once the node stops using @s.
+ */
+bool luring_enable_fixed_buffers(LuringState *s, Error **errp)
+{
+    int ret;
+
+    if (s->fixed_bufs_users++) {
+        return true;
+    }
+
+    /*
+     * Registered buffers keep the pages they were registered with, so
+     * discarding guest RAM would leave the ring using stale pages.
+     */
+    ret = ram_block_discard_disable(true);
+    if (ret) {
+        error_setg_errno(errp, -ret, "Cannot set discarding of RAM broken");
+        s->fixed_bufs_users--;
+        return false;
+    }
+
+    s->ram_notifier.ram_block_added = luring_ram_block_added;
+    s->ram_notifier.ram_block_removed = luring_ram_block_removed;
+    s->ram_notifier.ram_block_resized = luring_ram_block_resized;
+    ram_block_notifier_add(&s->ram_notifier);
+    return true;
+}
+
+/*
+ * Drop a reference taken by luring_enable_fixed_buffers().  The last one
+ * unpins guest RAM and allows discarding it again.  The node must be
+ * drained, so that the ring is idle.
+ */
+void luring_disable_fixed_buffers(LuringState *s)
+{
+    assert(s->fixed_bufs_users);
+    if (--s->fixed_bufs_users) {
+        return;
+    }
+
+    ram_block_notifier_remove(&s->ram_notifier);
+    WITH_QEMU_LOCK_GUARD(&s->ram_regions_lock) {
+        g_array_set_size(s->ram_regions, 0);
+        luring_ram_regions_changed(s);
+    }
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        s->nr_fixed_bufs = 0;
+    }
+    g_free(s->fixed_bufs);
+    s->fixed_bufs = NULL;
+    ram_block_discard_disable(false);
+}
+
+/*
+ * Fixed files
+ *
+ * Image fds are registered lazily, on their first request.  Callers must
+ * drop an fd with luring_unregister_fd() before closing it, or moving it
+ * to another AioContext, otherwise a new file reusing the fd number would
+ * be accessed through the old registration.
+ */
+
+/* Returns the fixed file slot of @fd, or -1 to use @fd directly */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, free_slot = -1;
+
+    if (!s->fixed_files_enabled) {
+        return -1;
+    }
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            return i;
+        }
+        if (free_slot < 0 && s->fixed_files[i] == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0 ||
+        io_uring_register_files_update(&s->ring, free_slot, &fd, 1) != 1) {
+        return -1;
+    }
+    trace_luring_register_fixed_file(s, fd, free_slot);
+    s->fixed_files[free_slot] = fd;
+    return free_slot;
+}
+
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int unused = -1;
+    int i;
+
+    if (!s->fixed_files_enabled) {
+        return;
+    }
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            trace_luring_unregister_fixed_file(s, fd, i);
+            s->fixed_files[i] = -1;
+            return;
+        }
+    }
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -344,17 +677,40 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int fixed_file = luring_fixed_file(s, fd);
+    int buf_index = -1;
+
+    if (fixed_file >= 0) {
+        fd = fixed_file;
+    }
+    if (type == QEMU_AIO_WRITE || type == QEMU_AIO_READ) {
+        buf_index = luring_fixed_buf_index(s, luringcb->qiov);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len,
+                                      offset, buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len,
+                                     offset, buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
+        /* Polled rings cannot sync */
+        assert(!s->polled);
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
     default:
@@ -362,8 +718,14 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_file >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
+    if (luringcb->stats) {
+        luringcb->queued_ns = get_clock();
+    }
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
     trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
@@ -379,7 +741,8 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                  uint64_t offset, QEMUIOVector *qiov, int type)
+                                  uint64_t offset, QEMUIOVector *qiov, int type,
+                                  LuringLatencyStats *stats)
 {
     int ret;
     LuringAIOCB luringcb = {
@@ -387,6 +750,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
+        .stats      = stats,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
@@ -419,7 +783,7 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+static LuringState *luring_init_flags(unsigned int flags, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
@@ -427,20 +791,85 @@ LuringState *luring_init(Error **errp)
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    rc = io_uring_queue_init(MAX_ENTRIES, ring, flags);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
 
     ioq_init(&s->io_q);
+
+    /* Sparse file tables need Linux 5.5, older kernels just use fds */
+    memset(s->fixed_files, -1, sizeof(s->fixed_files));
+    s->fixed_files_enabled =
+        io_uring_register_files(ring, s->fixed_files, MAX_FIXED_FILES) == 0;
+
+    qemu_mutex_init(&s->ram_regions_lock);
+    s->ram_regions = g_array_new(false, false, sizeof(struct iovec));
     return s;
 
 }
 
+LuringState *luring_init(Error **errp)
+{
+    return luring_init_flags(0, errp);
+}
+
+/*
+ * A polled ring has a kernel thread picking up submissions (SQPOLL), which
+ * also polls the device for completions (IOPOLL) instead of waiting for
+ * interrupts.  The thread keeps spinning for a while after the last
+ * submission, and completions it reaps still wake up the ring fd, so the
+ * ring plugs into the AioContext like the others: its io_poll handler
+ * checks the completion queue without system calls.
+ *
+ * Only O_DIRECT reads and writes can be polled, flushes must go to a
+ * regular ring.  SQPOLL needs Linux 5.11, or CAP_SYS_ADMIN before.
+ */
+LuringState *luring_init_polled(Error **errp)
+{
+    LuringState *s = luring_init_flags(IORING_SETUP_SQPOLL |
+                                       IORING_SETUP_IOPOLL, errp);
+
+    if (s) {
+        s->polled = true;
+    }
+    return s;
+}
+
+void luring_latency_stats_init(LuringLatencyStats *stats)
+{
+    BlockLatencyHistogram *hists[] = { &stats->submit, &stats->complete };
+    int i, j;
+
+    /* Power of two buckets from 1 microsecond to about 1 second */
+    for (i = 0; i < ARRAY_SIZE(hists); i++) {
+        hists[i]->nbins = 22;
+        hists[i]->boundaries = g_new(uint64_t, hists[i]->nbins - 1);
+        for (j = 0; j < hists[i]->nbins - 1; j++) {
+            hists[i]->boundaries[j] = (uint64_t)SCALE_US << j;
+        }
+        hists[i]->bins = g_new0(uint64_t, hists[i]->nbins);
+    }
+}
+
+void luring_latency_stats_cleanup(LuringLatencyStats *stats)
+{
+    g_free(stats->submit.boundaries);
+    g_free(stats->submit.bins);
+    g_free(stats->complete.boundaries);
+    g_free(stats->complete.bins);
+    memset(stats, 0, sizeof(*stats));
+}
+
 void luring_cleanup(LuringState *s)
 {
+    /* Nodes drop their references before the AioContext goes away */
+    assert(!s->fixed_bufs_users);
+    g_array_free(s->ram_regions, true);
+    qemu_mutex_destroy(&s->ram_regions_lock);
+    g_free(s->fixed_bufs);
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
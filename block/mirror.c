@@ -80,6 +80,8 @@ typedef struct MirrorBlockJob {
     bool unmap;
     int target_cluster_size;
     int max_iov;
+    /* Cleared after the first failed attempt to offload a copy */
+    bool use_copy_range;
     bool initial_zeroing_ongoing;
     int in_active_write_counter;
     bool prepared;
@@ -344,7 +346,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     MirrorOp *op = opaque;
     MirrorBlockJob *s = op->s;
     int nb_chunks;
-    uint64_t ret;
+    int ret;
     uint64_t max_bytes;
 
     max_bytes = s->granularity * s->max_iov;
@@ -393,6 +395,22 @@ static void coroutine_fn mirror_co_read(void *opaque)
     op->is_in_flight = true;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
+    /*
+     * The buffers are still taken above so that offloaded copies are
+     * throttled in the same way as bounce buffered ones.
+     */
+    if (s->use_copy_range) {
+        ret = blk_co_copy_range_from_child(s->mirror_top_bs->backing,
+                                           op->offset, s->target, op->offset,
+                                           op->bytes, 0, 0);
+        if (ret >= 0) {
+            mirror_write_complete(op, ret);
+            return;
+        }
+        trace_mirror_copy_range_fallback(s, op->offset, op->bytes, ret);
+        s->use_copy_range = false;
+    }
+
     ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
                          &op->qiov, 0);
     mirror_read_complete(op, ret);
@@ -1749,6 +1767,7 @@ static BlockJob *mirror_start_job(
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->use_copy_range = true;
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -0,0 +1,498 @@
+/*
+ * Allocation summary for the QCOW version 2 format
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * The allocation summary has one bit per 1 << alloc_summary_granularity_bits
+ * bytes of the guest disk.  A clear bit guarantees that no L2 entry of the
+ * active L1 table in that range is anything but unallocated, so that
+ * qcow2_co_block_status() can report the whole range as unallocated without
+ * loading a single L2 table.  This matters most for the upper layers of long
+ * backing chains, which are queried for every block status of the chain.
+ *
+ * Bits are set under s->lock before an L2 entry in their range changes to
+ * anything but unallocated.  They are never cleared incrementally (a discard
+ * only makes the summary less precise); only rebuilding the summary from the
+ * L2 tables does.
+ *
+ * While the image is open read-write, the copy in the image file is stale and
+ * QCOW2_AUTOCLEAR_ALLOC_SUMMARY is clear.  It is written back and the bit is
+ * set again on inactivation and read-only reopen.  If that never happens, or
+ * a program without support for the extension clears the bit, read-only users
+ * ignore the summary and the next read-write open rebuilds it into freshly
+ * allocated clusters: the old ones may have been freed and reused by then, so
+ * they are left for 'qemu-img check -r leaks' to collect.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/bitmap.h"
+#include "qemu/memalign.h"
+
+#include "qcow2.h"
+#include "trace.h"
+
+static int64_t alloc_summary_nb_bits(uint64_t size, int granularity_bits)
+{
+    return DIV_ROUND_UP(size, 1ULL << granularity_bits);
+}
+
+/* Bytes of the image file that hold a summary of @nb_bits bits */
+static uint64_t alloc_summary_storage_size(BDRVQcow2State *s, int64_t nb_bits)
+{
+    return ROUND_UP(MAX(DIV_ROUND_UP(nb_bits, BITS_PER_BYTE), 1),
+                    s->cluster_size);
+}
+
+/* Returns the finest granularity that keeps the summary of @size bounded */
+static int alloc_summary_granularity_bits(BDRVQcow2State *s, uint64_t size)
+{
+    int granularity_bits = MAX(s->cluster_bits,
+                               QCOW2_ALLOC_SUMMARY_MIN_GRANULARITY_BITS);
+
+    while (alloc_summary_storage_size(s, alloc_summary_nb_bits(
+               size, granularity_bits)) > QCOW2_MAX_ALLOC_SUMMARY_SIZE) {
+        granularity_bits++;
+    }
+    return granularity_bits;
+}
+
+/*
+ * Allocates storage for the in-memory summary, and frees the old storage
+ * unless @keep_old is set.  On failure, the summary is dropped.
+ */
+static int alloc_summary_alloc_storage(BlockDriverState *bs, bool keep_old)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t size = alloc_summary_storage_size(s, s->alloc_summary_bits);
+    int64_t offset;
+
+    if (s->alloc_summary_offset && !keep_old) {
+        if (size == s->alloc_summary_size) {
+            return 0;
+        }
+        qcow2_free_clusters(bs, s->alloc_summary_offset, s->alloc_summary_size,
+                            QCOW2_DISCARD_OTHER);
+        s->alloc_summary_offset = 0;
+    }
+
+    offset = qcow2_alloc_clusters(bs, size);
+    if (offset < 0) {
+        s->alloc_summary_offset = 0;
+        qcow2_alloc_summary_close(bs);
+        return offset;
+    }
+
+    s->alloc_summary_offset = offset;
+    s->alloc_summary_size = size;
+    return 0;
+}
+
+static int alloc_summary_read(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t nb_bits = s->alloc_summary_bits;
+    unsigned long *buf;
+    int ret;
+
+    buf = qemu_try_blockalign(bs->file->bs, s->alloc_summary_size);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    ret = bdrv_pread(bs->file, s->alloc_summary_offset, buf,
+                     s->alloc_summary_size);
+    if (ret >= 0) {
+        bitmap_from_le(s->alloc_summary, buf, nb_bits);
+        /* Padding in the last word must not leak into the summary */
+        bitmap_clear(s->alloc_summary, nb_bits,
+                     BITS_TO_LONGS(nb_bits) * BITS_PER_LONG - nb_bits);
+        ret = 0;
+    }
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+/*
+ * Rebuilds the summary from the active L2 tables.  On error, all bits are
+ * set, which is always correct.
+ */
+void qcow2_alloc_summary_rebuild(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t *l2_table;
+    int i, j, ret;
+
+    if (!s->alloc_summary) {
+        return;
+    }
+
+    trace_qcow2_alloc_summary_rebuild(bs, s->alloc_summary_bits);
+
+    /* The L2 tables are read directly from the image file */
+    ret = qcow2_cache_flush(bs, s->l2_table_cache);
+    l2_table = qemu_try_blockalign(bs->file->bs, s->cluster_size);
+    if (ret < 0 || l2_table == NULL) {
+        goto fail;
+    }
+
+    bitmap_zero(s->alloc_summary, s->alloc_summary_bits);
+
+    for (i = 0; i < s->l1_size; i++) {
+        uint64_t l2_offset = s->l1_table[i] & L1E_OFFSET_MASK;
+        uint64_t l2_guest_offset =
+            (uint64_t)i << (s->l2_bits + s->cluster_bits);
+
+        if (!l2_offset) {
+            continue;
+        }
+
+        ret = bdrv_pread(bs->file, l2_offset, l2_table, s->cluster_size);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        for (j = 0; j < s->l2_size; j++) {
+            if (get_l2_entry(s, l2_table, j) || get_l2_bitmap(s, l2_table, j)) {
+                qcow2_alloc_summary_mark(bs, l2_guest_offset +
+                                         ((uint64_t)j << s->cluster_bits),
+                                         s->cluster_size);
+            }
+        }
+    }
+
+    qemu_vfree(l2_table);
+    return;
+
+fail:
+    qemu_vfree(l2_table);
+    bitmap_set(s->alloc_summary, 0, s->alloc_summary_bits);
+}
+
+/* Clears all bits, for when the active L1 table maps nothing */
+void qcow2_alloc_summary_reset(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->alloc_summary) {
+        bitmap_zero(s->alloc_summary, s->alloc_summary_bits);
+    }
+}
+
+/* Flags the summary in the image file as stale while we modify the image */
+static int alloc_summary_mark_in_use(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    s->autoclear_features &= ~QCOW2_AUTOCLEAR_ALLOC_SUMMARY;
+    return qcow2_update_header(bs);
+}
+
+/* Makes a summary that could not be loaded usable again */
+static int alloc_summary_recreate(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t size = bs->total_sectors * BDRV_SECTOR_SIZE;
+
+    s->alloc_summary_granularity_bits = alloc_summary_granularity_bits(s, size);
+    s->alloc_summary_bits =
+        alloc_summary_nb_bits(size, s->alloc_summary_granularity_bits);
+    s->alloc_summary = bitmap_new(s->alloc_summary_bits);
+
+    qcow2_alloc_summary_rebuild(bs);
+    return alloc_summary_alloc_storage(bs, true);
+}
+
+static int alloc_summary_activate(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->alloc_summary) {
+        ret = alloc_summary_recreate(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret,
+                             "Could not rebuild the allocation summary");
+            qcow2_alloc_summary_close(bs);
+            return ret;
+        }
+    }
+
+    ret = alloc_summary_mark_in_use(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+        return ret;
+    }
+    return 0;
+}
+
+int qcow2_alloc_summary_load(BlockDriverState *bs, bool *header_updated,
+                             Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    bool consistent = s->autoclear_features & QCOW2_AUTOCLEAR_ALLOC_SUMMARY;
+    int64_t nb_bits;
+    int ret;
+
+    *header_updated = false;
+
+    if (!s->alloc_summary_offset) {
+        return 0;
+    }
+
+    nb_bits = alloc_summary_nb_bits(bs->total_sectors * BDRV_SECTOR_SIZE,
+                                    s->alloc_summary_granularity_bits);
+    if (DIV_ROUND_UP(nb_bits, BITS_PER_BYTE) > s->alloc_summary_size) {
+        /* Resized by a program that does not know the extension */
+        consistent = false;
+    }
+
+    if (consistent) {
+        s->alloc_summary_bits = nb_bits;
+        s->alloc_summary = bitmap_new(nb_bits);
+        ret = alloc_summary_read(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read allocation summary");
+            qcow2_alloc_summary_close(bs);
+            return ret;
+        }
+    }
+
+    if (!bdrv_is_writable(bs)) {
+        /* A stale summary is ignored until the next read-write open */
+        return 0;
+    }
+
+    ret = alloc_summary_activate(bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+    *header_updated = true;
+    return 0;
+}
+
+int qcow2_alloc_summary_reopen_rw(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->alloc_summary_offset) {
+        return 0;
+    }
+    return alloc_summary_activate(bs, errp);
+}
+
+int qcow2_alloc_summary_store(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned long *buf;
+    int ret;
+
+    if (!s->alloc_summary || bdrv_is_read_only(bs)) {
+        return 0;
+    }
+
+    trace_qcow2_alloc_summary_store(bs, s->alloc_summary_offset,
+                                    s->alloc_summary_size);
+
+    /* The header must not point to clusters that are not accounted for */
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, s->alloc_summary_offset,
+                                        s->alloc_summary_size, false);
+    if (ret < 0) {
+        return ret;
+    }
+
+    buf = qemu_try_blockalign0(bs->file->bs, s->alloc_summary_size);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    bitmap_to_le(buf, s->alloc_summary, s->alloc_summary_bits);
+
+    ret = bdrv_pwrite(bs->file, s->alloc_summary_offset, buf,
+                      s->alloc_summary_size);
+    qemu_vfree(buf);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = bdrv_flush(bs->file->bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->autoclear_features |= QCOW2_AUTOCLEAR_ALLOC_SUMMARY;
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        s->autoclear_features &= ~QCOW2_AUTOCLEAR_ALLOC_SUMMARY;
+        return ret;
+    }
+    return 0;
+}
+
+void qcow2_alloc_summary_close(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    g_free(s->alloc_summary);
+    s->alloc_summary = NULL;
+}
+
+int qcow2_alloc_summary_enable(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (s->alloc_summary) {
+        return 0;
+    }
+
+    if (s->qcow_version < 3) {
+        error_setg(errp, "The allocation summary requires compatibility level "
+                   "1.1 or above (use compat=1.1 or greater)");
+        return -EINVAL;
+    }
+
+    /* A stale summary of a read-write image has been recreated on open */
+    assert(!s->alloc_summary_offset);
+
+    ret = alloc_summary_recreate(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not create allocation summary");
+        qcow2_alloc_summary_close(bs);
+        return ret;
+    }
+
+    ret = alloc_summary_mark_in_use(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+        return ret;
+    }
+    return 0;
+}
+
+int qcow2_alloc_summary_disable(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->alloc_summary_offset) {
+        return 0;
+    }
+
+    if (s->alloc_summary) {
+        qcow2_free_clusters(bs, s->alloc_summary_offset, s->alloc_summary_size,
+                            QCOW2_DISCARD_OTHER);
+        qcow2_alloc_summary_close(bs);
+    }
+
+    s->alloc_summary_offset = 0;
+    s->alloc_summary_size = 0;
+    s->autoclear_features &= ~QCOW2_AUTOCLEAR_ALLOC_SUMMARY;
+    return qcow2_update_header(bs);
+}
+
+/*
+ * Adapts the summary to a new image size.  The granularity only ever grows
+ * (when the summary would exceed QCOW2_MAX_ALLOC_SUMMARY_SIZE otherwise);
+ * bits are merged accordingly.
+ */
+int qcow2_alloc_summary_resize(BlockDriverState *bs, uint64_t size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int old_granularity_bits = s->alloc_summary_granularity_bits;
+    int64_t old_nb_bits = s->alloc_summary_bits;
+    unsigned long *old_summary = s->alloc_summary;
+    int64_t i;
+
+    if (!old_summary) {
+        return 0;
+    }
+
+    s->alloc_summary_granularity_bits =
+        MAX(old_granularity_bits, alloc_summary_granularity_bits(s, size));
+    s->alloc_summary_bits =
+        alloc_summary_nb_bits(size, s->alloc_summary_granularity_bits);
+    s->alloc_summary = bitmap_new(s->alloc_summary_bits);
+
+    for (i = find_first_bit(old_summary, old_nb_bits); i < old_nb_bits;
+         i = find_next_bit(old_summary, old_nb_bits, i + 1))
+    {
+        qcow2_alloc_summary_mark(bs, i << old_granularity_bits,
+                                 1ULL << old_granularity_bits);
+    }
+    g_free(old_summary);
+
+    return alloc_summary_alloc_storage(bs, false) ?: qcow2_update_header(bs);
+}
+
+void qcow2_alloc_summary_mark(BlockDriverState *bs, uint64_t offset,
+                              uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t start, end;
+
+    if (!s->alloc_summary || !bytes) {
+        return;
+    }
+
+    /* The VM state area beyond the disk is not covered */
+    start = offset >> s->alloc_summary_granularity_bits;
+    if (start >= s->alloc_summary_bits) {
+        return;
+    }
+    end = MIN(DIV_ROUND_UP(offset + bytes,
+                           1ULL << s->alloc_summary_granularity_bits),
+              s->alloc_summary_bits);
+
+    bitmap_set(s->alloc_summary, start, end - start);
+}
+
+/*
+ * Returns how many bytes starting at @offset (at most @bytes) are known to be
+ * unallocated in the active L1 table, or 0 if the L2 tables must be asked.
+ */
+uint64_t qcow2_alloc_summary_unallocated(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t start, next;
+
+    if (!s->alloc_summary) {
+        return 0;
+    }
+
+    start = offset >> s->alloc_summary_granularity_bits;
+    if (start >= s->alloc_summary_bits ||
+        test_bit(start, s->alloc_summary)) {
+        return 0;
+    }
+
+    next = find_next_bit(s->alloc_summary, s->alloc_summary_bits, start);
+    return MIN(bytes,
+               ((uint64_t)next << s->alloc_summary_granularity_bits) - offset);
+}
+
+int qcow2_check_alloc_summary_refcounts(BlockDriverState *bs,
+                                        BdrvCheckResult *res,
+                                        void **refcount_table,
+                                        int64_t *refcount_table_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    /* The storage of a stale summary may have been reused */
+    if (!s->alloc_summary) {
+        return 0;
+    }
+
+    return qcow2_inc_refcounts_imrt(bs, res, refcount_table,
+                                    refcount_table_size,
+                                    s->alloc_summary_offset,
+                                    s->alloc_summary_size);
+}
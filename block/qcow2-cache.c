@@ -27,11 +27,21 @@
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Cached tables are found through a hash table of their offsets, chained
+ * through hash_next.  Unreferenced entries are kept in an LRU list, most
+ * recently used first and with the empty entries at the end, so that both
+ * lookups and replacements take constant time however large the cache is.
+ * Entry indices are used as links, -1 ends a chain or the list.
+ */
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    int      hash_next;
+    int      lru_prev;
+    int      lru_next;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -43,6 +53,18 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Heads of the hash chains, hash_mask + 1 of them */
+    int                    *hash_heads;
+    unsigned                hash_mask;
+
+    /* Unreferenced entries, least recently used at the tail */
+    int                     lru_head;
+    int                     lru_tail;
+
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -58,6 +80,112 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return (offset / c->table_size) & c->hash_mask;
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i = c->hash_heads[qcow2_cache_hash(c, offset)];
+
+    while (i >= 0 && c->entries[i].offset != offset) {
+        i = c->entries[i].hash_next;
+    }
+    return i;
+}
+
+static void qcow2_cache_hash_insert(Qcow2Cache *c, int i)
+{
+    int *head = &c->hash_heads[qcow2_cache_hash(c, c->entries[i].offset)];
+
+    c->entries[i].hash_next = *head;
+    *head = i;
+}
+
+static void qcow2_cache_hash_remove(Qcow2Cache *c, int i)
+{
+    int *link = &c->hash_heads[qcow2_cache_hash(c, c->entries[i].offset)];
+
+    while (*link != i) {
+        assert(*link >= 0);
+        link = &c->entries[*link].hash_next;
+    }
+    *link = c->entries[i].hash_next;
+    c->entries[i].hash_next = -1;
+}
+
+static void qcow2_cache_lru_remove(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->lru_prev >= 0) {
+        c->entries[t->lru_prev].lru_next = t->lru_next;
+    } else {
+        c->lru_head = t->lru_next;
+    }
+    if (t->lru_next >= 0) {
+        c->entries[t->lru_next].lru_prev = t->lru_prev;
+    } else {
+        c->lru_tail = t->lru_prev;
+    }
+    t->lru_prev = t->lru_next = -1;
+}
+
+/* Most recently used entries go to the head, empty ones to the tail */
+static void qcow2_cache_lru_insert(Qcow2Cache *c, int i, bool head)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (head) {
+        t->lru_prev = -1;
+        t->lru_next = c->lru_head;
+        if (c->lru_head >= 0) {
+            c->entries[c->lru_head].lru_prev = i;
+        } else {
+            c->lru_tail = i;
+        }
+        c->lru_head = i;
+    } else {
+        t->lru_next = -1;
+        t->lru_prev = c->lru_tail;
+        if (c->lru_tail >= 0) {
+            c->entries[c->lru_tail].lru_next = i;
+        } else {
+            c->lru_head = i;
+        }
+        c->lru_tail = i;
+    }
+}
+
+/* Forget the table cached in unreferenced entry @i */
+static void qcow2_cache_entry_clear(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    assert(t->ref == 0);
+    if (t->offset) {
+        qcow2_cache_hash_remove(c, i);
+    }
+    t->offset = 0;
+    t->lru_counter = 0;
+    qcow2_cache_lru_remove(c, i);
+    qcow2_cache_lru_insert(c, i, false);
+}
+
+/* Reset the hash table and the LRU list for a cache without tables */
+static void qcow2_cache_reset_lists(Qcow2Cache *c)
+{
+    int i;
+
+    memset(c->hash_heads, -1, (c->hash_mask + 1) * sizeof(c->hash_heads[0]));
+    c->lru_head = c->lru_tail = -1;
+    for (i = 0; i < c->size; i++) {
+        c->entries[i].hash_next = -1;
+        qcow2_cache_lru_insert(c, i, false);
+    }
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -105,8 +233,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_clear(c, i);
             i++;
             to_clean++;
         }
@@ -136,14 +263,19 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
+    /* Keep the chains short with about one bucket per entry */
+    c->hash_mask = pow2ceil(num_tables) - 1;
+    c->hash_heads = g_try_new(int, c->hash_mask + 1);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->table_array || !c->hash_heads) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->hash_heads);
         g_free(c);
-        c = NULL;
+        return NULL;
     }
 
+    qcow2_cache_reset_lists(c);
     return c;
 }
 
@@ -157,6 +289,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
 
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->hash_heads);
     g_free(c);
 
     return 0;
@@ -310,6 +443,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         c->entries[i].lru_counter = 0;
     }
 
+    qcow2_cache_reset_lists(c);
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
@@ -323,9 +457,6 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -340,29 +471,21 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        c->hits++;
+        goto found;
+    }
+    c->misses++;
 
-    if (min_lru_index == -1) {
+    if (c->lru_tail < 0) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
-    /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    /* Cache miss: write the least recently used table back and replace it */
+    i = c->lru_tail;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -373,7 +496,10 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    if (c->entries[i].offset) {
+        c->evictions++;
+    }
+    qcow2_cache_entry_clear(c, i);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -388,10 +514,13 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     c->entries[i].offset = offset;
+    qcow2_cache_hash_insert(c, i);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    if (c->entries[i].ref++ == 0) {
+        qcow2_cache_lru_remove(c, i);
+    }
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -421,6 +550,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        qcow2_cache_lru_insert(c, i, true);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -435,25 +565,24 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
 {
     int i = qcow2_cache_get_table_idx(c, table);
 
-    assert(c->entries[i].ref == 0);
-
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_clear(c, i);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats)
+{
+    stats->hits = c->hits;
+    stats->misses = c->misses;
+    stats->evictions = c->evictions;
+}
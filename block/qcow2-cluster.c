@@ -873,6 +873,7 @@ int qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
     /* compressed clusters never have the copied flag */
 
     BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
+    qcow2_alloc_summary_mark(bs, offset, s->cluster_size);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
     set_l2_entry(s, l2_slice, l2_index, cluster_offset);
     if (has_subclusters(s)) {
@@ -1059,6 +1060,8 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
     if (ret < 0) {
         goto err;
     }
+    qcow2_alloc_summary_mark(bs, m->offset,
+                             (uint64_t)m->nb_clusters << s->cluster_bits);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
 
     assert(l2_index + m->nb_clusters <= s->l2_slice_size);
@@ -1614,14 +1617,15 @@ static int do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == INV_OFFSET) {
         int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+            qcow2_alloc_pooled_clusters(bs, *nb_clusters * s->cluster_size);
         if (cluster_offset < 0) {
             return cluster_offset;
         }
         *host_offset = cluster_offset;
         return 0;
     } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
+        int64_t ret = qcow2_alloc_pooled_clusters_at(bs, *host_offset,
+                                                     *nb_clusters);
         if (ret < 0) {
             return ret;
         }
@@ -1944,6 +1948,12 @@ static int discard_in_l2_slice(BlockDriverState *bs, uint64_t offset,
             continue;
         }
 
+        if (new_l2_entry || new_l2_bitmap) {
+            qcow2_alloc_summary_mark(bs, offset +
+                                     ((uint64_t)i << s->cluster_bits),
+                                     s->cluster_size);
+        }
+
         /* First remove L2 entries */
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
         set_l2_entry(s, l2_slice, l2_index + i, new_l2_entry);
@@ -2022,6 +2032,9 @@ static int zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
     nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
+    /* All entries end up reading as zeroes */
+    qcow2_alloc_summary_mark(bs, offset, nb_clusters << s->cluster_bits);
+
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
         uint64_t old_l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
@@ -2094,6 +2107,7 @@ static int zero_l2_subclusters(BlockDriverState *bs, uint64_t offset,
     l2_bitmap &= ~QCOW_OFLAG_SUB_ALLOC_RANGE(sc, sc + nb_subclusters);
 
     if (old_l2_bitmap != l2_bitmap) {
+        qcow2_alloc_summary_mark(bs, offset, s->cluster_size);
         set_l2_bitmap(s, l2_slice, l2_index, l2_bitmap);
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
     }
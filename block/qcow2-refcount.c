@@ -1066,6 +1066,104 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
     return i;
 }
 
+/*
+ * Data cluster pool
+ *
+ * With the cluster-pool-size option, allocating writes take their clusters
+ * from a range reserved that many bytes at a time, so that concurrent
+ * first writes update the refcounts once per batch instead of once per
+ * request, and get adjacent host clusters.  Reserved clusters have a
+ * refcount of 1 without being referenced: they must be given back with
+ * qcow2_release_cluster_pool() before anything relies on refcounts
+ * matching references, and show up as leaks if QEMU dies first, which
+ * "qemu-img check -r leaks" repairs.
+ *
+ * The pool is only accessed from the AioContext of the node, and never
+ * across a yield, so taking clusters from it does not need s->lock.  Only
+ * refilling and releasing it, which update refcounts, do.
+ */
+
+/*
+ * Takes @size bytes of contiguous data clusters from the pool, without
+ * s->lock.  Returns -ENOSPC if the pool does not have them.
+ */
+int64_t qcow2_take_pooled_clusters(BlockDriverState *bs, uint64_t size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t offset;
+
+    assert(offset_into_cluster(s, size) == 0);
+
+    if (size > s->cluster_pool_size) {
+        return -ENOSPC;
+    }
+    offset = s->cluster_pool_offset;
+    s->cluster_pool_offset += size;
+    s->cluster_pool_size -= size;
+    return offset;
+}
+
+/* Allocates @size bytes of contiguous data clusters, refilling the pool */
+int64_t qcow2_alloc_pooled_clusters(BlockDriverState *bs, uint64_t size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t pool_size = ROUND_UP(s->cluster_pool_max, s->cluster_size);
+    int64_t offset;
+
+    offset = qcow2_take_pooled_clusters(bs, size);
+    if (offset >= 0) {
+        return offset;
+    }
+    if (size >= pool_size) {
+        return qcow2_alloc_clusters(bs, size);
+    }
+
+    /* The pool stays empty while the refcount updates yield */
+    qcow2_release_cluster_pool(bs);
+    offset = qcow2_alloc_clusters(bs, pool_size);
+    if (offset < 0) {
+        return offset;
+    }
+    trace_qcow2_cluster_pool_refill(bs, offset, pool_size);
+    s->cluster_pool_offset = offset + size;
+    s->cluster_pool_size = pool_size - size;
+    return offset;
+}
+
+/*
+ * Allocates up to @nb_clusters data clusters at @offset, like
+ * qcow2_alloc_clusters_at(), including those reserved in the pool.
+ */
+int64_t qcow2_alloc_pooled_clusters_at(BlockDriverState *bs, uint64_t offset,
+                                       int64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->cluster_pool_size && offset == s->cluster_pool_offset) {
+        int64_t n = MIN(nb_clusters, s->cluster_pool_size >> s->cluster_bits);
+
+        s->cluster_pool_offset += n << s->cluster_bits;
+        s->cluster_pool_size -= n << s->cluster_bits;
+        return n;
+    }
+    return qcow2_alloc_clusters_at(bs, offset, nb_clusters);
+}
+
+void qcow2_release_cluster_pool(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    uint64_t offset = s->cluster_pool_offset;
+    uint64_t size = s->cluster_pool_size;
+
+    if (size) {
+        /* Empty the pool first, freeing the clusters may yield */
+        s->cluster_pool_size = 0;
+        trace_qcow2_cluster_pool_release(bs, offset, size);
+        qcow2_free_clusters(bs, offset, size, QCOW2_DISCARD_NEVER);
+    }
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -2291,6 +2389,13 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         return ret;
     }
 
+    /* allocation summary */
+    ret = qcow2_check_alloc_summary_refcounts(bs, res, refcount_table,
+                                              nb_clusters);
+    if (ret < 0) {
+        return ret;
+    }
+
     return check_refblocks(bs, res, fix, rebuild, refcount_table, nb_clusters);
 }
 
@@ -34,6 +34,7 @@
 #endif
 
 #include "qcow2.h"
+#include "block/aio_task.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
 
@@ -453,6 +454,59 @@ static int qcow2_encdec_pool_func(void *opaque)
     return data->func(data->block, data->offset, data->buf, data->len, NULL);
 }
 
+/*
+ * Ranges larger than this are split into parts that are processed by
+ * several threads in parallel
+ */
+#define QCOW2_ENCDEC_SPLIT_SIZE (256 * KiB)
+
+typedef struct Qcow2EncDecTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    Qcow2EncDecData data;
+} Qcow2EncDecTask;
+
+static coroutine_fn int qcow2_encdec_task_entry(AioTask *task)
+{
+    Qcow2EncDecTask *t = container_of(task, Qcow2EncDecTask, task);
+
+    return qcow2_co_process(t->bs, qcow2_encdec_pool_func, &t->data);
+}
+
+static int coroutine_fn
+qcow2_co_encdec_split(BlockDriverState *bs, Qcow2EncDecData *arg,
+                      uint64_t sector_size)
+{
+    AioTaskPool *aio = aio_task_pool_new(QCOW2_MAX_THREADS);
+    size_t part = QEMU_ALIGN_UP(DIV_ROUND_UP(arg->len, QCOW2_MAX_THREADS),
+                                sector_size);
+    size_t done;
+    int ret;
+
+    for (done = 0; done < arg->len && aio_task_pool_status(aio) == 0;
+         done += part)
+    {
+        Qcow2EncDecTask *task = g_new(Qcow2EncDecTask, 1);
+
+        *task = (Qcow2EncDecTask) {
+            .task.func = qcow2_encdec_task_entry,
+            .bs = bs,
+            .data = *arg,
+        };
+        task->data.offset += done;
+        task->data.buf += done;
+        task->data.len = MIN(part, arg->len - done);
+        aio_task_pool_start_task(aio, &task->task);
+    }
+
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    g_free(aio);
+
+    return ret;
+}
+
 static int coroutine_fn
 qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
                 uint64_t guest_offset, void *buf, size_t len,
@@ -475,6 +529,10 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
+    if (len > QCOW2_ENCDEC_SPLIT_SIZE) {
+        return qcow2_co_encdec_split(bs, &arg, sector_size);
+    }
+
     return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
 }
 
@@ -72,6 +72,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
+#define  QCOW2_EXT_MAGIC_ALLOC_SUMMARY 0x414c4c43
 
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
@@ -208,6 +209,7 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
     uint64_t offset;
     int ret;
     Qcow2BitmapHeaderExt bitmaps_ext;
+    Qcow2AllocSummaryHeaderExt alloc_summary_ext;
 
     if (need_update_header != NULL) {
         *need_update_header = false;
@@ -428,6 +430,62 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             break;
         }
 
+        case QCOW2_EXT_MAGIC_ALLOC_SUMMARY:
+            if (ext.len != sizeof(alloc_summary_ext)) {
+                error_setg(errp, "alloc_summary_ext: "
+                           "Invalid extension length");
+                return -EINVAL;
+            }
+
+            ret = bdrv_pread(bs->file, offset, &alloc_summary_ext, ext.len);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "alloc_summary_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            if (!buffer_is_zero(alloc_summary_ext.reserved,
+                                sizeof(alloc_summary_ext.reserved))) {
+                error_setg(errp, "alloc_summary_ext: "
+                           "Reserved field is not zero");
+                return -EINVAL;
+            }
+
+            alloc_summary_ext.bitmap_offset =
+                be64_to_cpu(alloc_summary_ext.bitmap_offset);
+            alloc_summary_ext.bitmap_size =
+                be64_to_cpu(alloc_summary_ext.bitmap_size);
+
+            if (offset_into_cluster(s, alloc_summary_ext.bitmap_offset) ||
+                !alloc_summary_ext.bitmap_offset) {
+                error_setg(errp, "alloc_summary_ext: "
+                           "invalid bitmap offset");
+                return -EINVAL;
+            }
+
+            if (offset_into_cluster(s, alloc_summary_ext.bitmap_size) ||
+                !alloc_summary_ext.bitmap_size ||
+                alloc_summary_ext.bitmap_size > QCOW2_MAX_ALLOC_SUMMARY_SIZE) {
+                error_setg(errp, "alloc_summary_ext: "
+                           "invalid bitmap size (%" PRIu64 ")",
+                           alloc_summary_ext.bitmap_size);
+                return -EINVAL;
+            }
+
+            if (alloc_summary_ext.granularity_bits < s->cluster_bits ||
+                alloc_summary_ext.granularity_bits > 63) {
+                error_setg(errp, "alloc_summary_ext: "
+                           "invalid granularity (%d bits)",
+                           alloc_summary_ext.granularity_bits);
+                return -EINVAL;
+            }
+
+            s->alloc_summary_offset = alloc_summary_ext.bitmap_offset;
+            s->alloc_summary_size = alloc_summary_ext.bitmap_size;
+            s->alloc_summary_granularity_bits =
+                alloc_summary_ext.granularity_bits;
+            break;
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             /* If you add a new feature, make sure to also update the fast
@@ -612,6 +670,9 @@ static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would otherwise be reported as leaks */
+    qcow2_release_cluster_pool(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -698,6 +759,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_CLUSTER_POOL_SIZE,
     NULL
 };
 
@@ -809,6 +871,11 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_CLUSTER_POOL_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Data clusters to reserve at once for allocating writes",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -970,6 +1037,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t cluster_pool_max;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1071,6 +1139,18 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->cluster_pool_max = qemu_opt_get_size(opts, QCOW2_OPT_CLUSTER_POOL_SIZE,
+                                            0);
+    if (r->cluster_pool_max > QCOW2_MAX_CLUSTER_POOL_SIZE) {
+        error_setg(errp, QCOW2_OPT_CLUSTER_POOL_SIZE " must not exceed %"
+                   PRIu64, (uint64_t) QCOW2_MAX_CLUSTER_POOL_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (r->cluster_pool_max != s->cluster_pool_max) {
+        qcow2_release_cluster_pool(bs);
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1226,6 +1306,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->cluster_pool_max = r->cluster_pool_max;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1796,6 +1878,13 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         }
 
         update_header = update_header && !header_updated;
+
+        if (qcow2_alloc_summary_load(bs, &header_updated, errp) < 0) {
+            ret = -EINVAL;
+            goto fail;
+        }
+
+        update_header = update_header && !header_updated;
     }
 
     if (update_header) {
@@ -1845,6 +1934,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     }
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
+    qcow2_alloc_summary_close(bs);
     qcow2_free_snapshots(bs);
     qcow2_refcount_close(bs);
     qemu_vfree(s->l1_table);
@@ -1947,6 +2037,14 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
             goto fail;
         }
 
+        qcow2_release_cluster_pool(state->bs);
+
+        ret = qcow2_alloc_summary_store(state->bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to store allocation summary");
+            goto fail;
+        }
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2006,6 +2104,13 @@ static void qcow2_reopen_commit_post(BDRVReopenState *state)
                               "%s: Failed to make dirty bitmaps writable: ",
                               bdrv_get_node_name(state->bs));
         }
+
+        if (qcow2_alloc_summary_reopen_rw(state->bs, &local_err) < 0) {
+            /* Block status just falls back to the L2 tables */
+            error_reportf_err(local_err,
+                              "%s: Failed to reactivate allocation summary: ",
+                              bdrv_get_node_name(state->bs));
+        }
     }
 }
 
@@ -2013,6 +2118,11 @@ static void qcow2_reopen_abort(BDRVReopenState *state)
 {
     BDRVQcow2State *s = state->bs->opaque;
 
+    if (!(state->flags & BDRV_O_RDWR) && !bdrv_is_read_only(state->bs)) {
+        /* The allocation summary may have been stored in prepare */
+        qcow2_alloc_summary_reopen_rw(state->bs, NULL);
+    }
+
     if (!s->data_file) {
         /*
          * If we don't have an external data file, s->data_file was cleared by
@@ -2090,6 +2200,12 @@ static int coroutine_fn qcow2_co_block_status(BlockDriverState *bs,
         s->metadata_preallocation_checked = true;
     }
 
+    *pnum = qcow2_alloc_summary_unallocated(bs, offset, count);
+    if (*pnum) {
+        qemu_co_mutex_unlock(&s->lock);
+        return 0;
+    }
+
     bytes = MIN(INT_MAX, count);
     ret = qcow2_get_host_offset(bs, offset, &bytes, &host_offset, &type);
     qemu_co_mutex_unlock(&s->lock);
@@ -2693,6 +2809,15 @@ static int qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_release_cluster_pool(bs);
+
+    ret = qcow2_alloc_summary_store(bs);
+    if (ret) {
+        result = ret;
+        error_report("Failed to store the allocation summary: %s",
+                     strerror(-ret));
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2735,6 +2860,7 @@ static void qcow2_close(BlockDriverState *bs)
 
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
+    qcow2_alloc_summary_close(bs);
 
     g_free(s->image_data_file);
     g_free(s->image_backing_file);
@@ -2945,12 +3071,12 @@ int qcow2_update_header(BlockDriverState *bs)
     }
 
     /*
-     * Feature table.  A mere 8 feature names occupies 392 bytes, and
+     * Feature table.  A mere 9 feature names occupies 440 bytes, and
      * when coupled with the v3 minimum header of 104 bytes plus the
-     * 8-byte end-of-extension marker, that would leave only 8 bytes
-     * for a backing file name in an image with 512-byte clusters.
-     * Thus, we choose to omit this header for cluster sizes 4k and
-     * smaller.
+     * 8-byte end-of-extension marker, that would not even fit into an
+     * image with 512-byte clusters, let alone leave room for a backing
+     * file name.  Thus, we choose to omit this header for cluster sizes
+     * 4k and smaller.
      */
     if (s->qcow_version >= 3 && s->cluster_size > 4096) {
         static const Qcow2Feature features[] = {
@@ -2994,6 +3120,11 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR,
                 .name = "raw external data",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_AUTOCLEAR,
+                .bit  = QCOW2_AUTOCLEAR_ALLOC_SUMMARY_BITNR,
+                .name = "allocation summary",
+            },
         };
 
         ret = header_ext_add(buf, QCOW2_EXT_MAGIC_FEATURE_TABLE,
@@ -3024,6 +3155,23 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Allocation summary extension */
+    if (s->alloc_summary_offset) {
+        Qcow2AllocSummaryHeaderExt alloc_summary_header = {
+            .bitmap_offset = cpu_to_be64(s->alloc_summary_offset),
+            .bitmap_size = cpu_to_be64(s->alloc_summary_size),
+            .granularity_bits = s->alloc_summary_granularity_bits,
+        };
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_ALLOC_SUMMARY,
+                             &alloc_summary_header,
+                             sizeof(alloc_summary_header), buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* Keep unknown header extensions */
     QLIST_FOREACH(uext, &s->unknown_header_ext, next) {
         ret = header_ext_add(buf, uext->magic, uext->data, uext->len, buflen);
@@ -3502,6 +3650,14 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         goto out;
     }
 
+    if (version < 3 && qcow2_opts->alloc_summary) {
+        error_setg(errp, "The allocation summary is only supported with "
+                   "compatibility level 1.1 and above (use version=v3 or "
+                   "greater)");
+        ret = -EINVAL;
+        goto out;
+    }
+
     if (!qcow2_opts->has_refcount_bits) {
         qcow2_opts->refcount_bits = 16;
     }
@@ -3738,6 +3894,14 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         }
     }
 
+    /* Want an allocation summary? There you go. */
+    if (qcow2_opts->alloc_summary) {
+        ret = qcow2_alloc_summary_enable(blk_bs(blk), errp);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
     /* Want encryption? There you go. */
     if (qcow2_opts->has_encrypt) {
         ret = qcow2_set_up_encryption(blk_bs(blk), qcow2_opts->encrypt, errp);
@@ -3831,6 +3995,7 @@ static int coroutine_fn qcow2_co_create_opts(BlockDriver *drv,
         { BLOCK_OPT_COMPAT_LEVEL,       "version" },
         { BLOCK_OPT_DATA_FILE_RAW,      "data-file-raw" },
         { BLOCK_OPT_COMPRESSION_TYPE,   "compression-type" },
+        { BLOCK_OPT_ALLOC_SUMMARY,      "alloc-summary" },
         { NULL, NULL },
     };
 
@@ -4202,6 +4367,9 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Shrinking must not see the reserved clusters as used */
+    qcow2_release_cluster_pool(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4221,6 +4389,13 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
     old_length = bs->total_sectors * BDRV_SECTOR_SIZE;
     new_l1_size = size_to_l1(s, offset);
 
+    /* Preallocation below already needs to mark the new area */
+    ret = qcow2_alloc_summary_resize(bs, offset);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to resize allocation summary");
+        goto fail;
+    }
+
     if (offset < old_length) {
         int64_t last_cluster, old_file_size;
         if (prealloc != PREALLOC_MODE_OFF) {
@@ -4552,16 +4727,22 @@ fail:
     return ret;
 }
 
-static coroutine_fn int
-qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
-                                 uint64_t offset, uint64_t bytes,
-                                 QEMUIOVector *qiov, size_t qiov_offset)
+/*
+ * Compress the cluster at @offset (@bytes long, which is less than a
+ * cluster only for the last cluster of the image) into @out_buf, which
+ * must have room for a cluster.
+ *
+ * Returns the compressed length, -ENOMEM if the data does not compress
+ * to less than a cluster, or another negative errno on failure.
+ */
+static coroutine_fn ssize_t
+qcow2_co_compress_cluster(BlockDriverState *bs, uint64_t offset,
+                          uint64_t bytes, QEMUIOVector *qiov,
+                          size_t qiov_offset, uint8_t *out_buf)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret;
     ssize_t out_len;
-    uint8_t *buf, *out_buf;
-    uint64_t cluster_offset;
+    uint8_t *buf;
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
@@ -4573,57 +4754,200 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
     }
     qemu_iovec_to_buf(qiov, qiov_offset, buf, bytes);
 
-    out_buf = g_malloc(s->cluster_size);
-
     out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
                                 buf, s->cluster_size);
-    if (out_len == -ENOMEM) {
-        /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
-        if (ret < 0) {
-            goto fail;
-        }
-        goto success;
-    } else if (out_len < 0) {
-        ret = -EINVAL;
-        goto fail;
+    qemu_vfree(buf);
+
+    if (out_len < 0 && out_len != -ENOMEM) {
+        return -EINVAL;
     }
+    return out_len;
+}
+
+/*
+ * Allocate the host range for a compressed cluster at guest @offset and
+ * point the L2 entry to it
+ */
+static coroutine_fn int
+qcow2_co_alloc_compressed_cluster(BlockDriverState *bs, uint64_t offset,
+                                  ssize_t out_len, uint64_t *cluster_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
 
     qemu_co_mutex_lock(&s->lock);
     ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
-    if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
+                                                cluster_offset);
+    if (ret == 0) {
+        ret = qcow2_pre_write_overlap_check(bs, 0, *cluster_offset, out_len,
+                                            true);
     }
-
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
     qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+static coroutine_fn int
+qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
+                                 uint64_t offset, uint64_t bytes,
+                                 QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+    ssize_t out_len;
+    uint8_t *out_buf;
+    uint64_t cluster_offset;
+
+    out_buf = g_malloc(s->cluster_size);
+
+    out_len = qcow2_co_compress_cluster(bs, offset, bytes, qiov, qiov_offset,
+                                        out_buf);
+    if (out_len == -ENOMEM) {
+        /* could not compress: write normal cluster */
+        ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
+        goto out;
+    } else if (out_len < 0) {
+        ret = out_len;
+        goto out;
+    }
+
+    ret = qcow2_co_alloc_compressed_cluster(bs, offset, out_len,
+                                            &cluster_offset);
     if (ret < 0) {
-        goto fail;
+        goto out;
     }
 
     BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
     ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
-    if (ret < 0) {
-        goto fail;
-    }
-success:
-    ret = 0;
-fail:
-    qemu_vfree(buf);
+
+out:
     g_free(out_buf);
-    return ret;
+    return ret < 0 ? ret : 0;
+}
+
+typedef struct Qcow2CompressedCluster {
+    uint8_t *buf;
+    ssize_t len;
+} Qcow2CompressedCluster;
+
+typedef struct Qcow2CompressTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+    Qcow2CompressedCluster *cluster;
+} Qcow2CompressTask;
+
+static coroutine_fn int qcow2_co_compress_task_entry(AioTask *task)
+{
+    Qcow2CompressTask *t = container_of(task, Qcow2CompressTask, task);
+
+    t->cluster->len = qcow2_co_compress_cluster(t->bs, t->offset, t->bytes,
+                                                t->qiov, t->qiov_offset,
+                                                t->cluster->buf);
+    return t->cluster->len == -ENOMEM ? 0 : MIN(t->cluster->len, 0);
 }
 
-static coroutine_fn int qcow2_co_pwritev_compressed_task_entry(AioTask *task)
+/*
+ * Write several clusters compressed.  All of them are compressed in
+ * parallel first, then allocated in guest offset order, so that the
+ * compressed data ends up in the same order on the host as it would with
+ * one request per cluster.  Host-contiguous compressed clusters are
+ * written with a single request.
+ */
+static coroutine_fn int
+qcow2_co_pwritev_compressed_clusters(BlockDriverState *bs,
+                                     uint64_t offset, uint64_t bytes,
+                                     QEMUIOVector *qiov, size_t qiov_offset)
 {
-    Qcow2AioTask *t = container_of(task, Qcow2AioTask, task);
+    BDRVQcow2State *s = bs->opaque;
+    unsigned nb_clusters = DIV_ROUND_UP(bytes, s->cluster_size);
+    g_autofree Qcow2CompressedCluster *clusters = NULL;
+    AioTaskPool *aio;
+    QEMUIOVector run_qiov;
+    uint64_t run_start = 0, run_end = 0;
+    unsigned i;
+    int ret;
+
+    clusters = g_new0(Qcow2CompressedCluster, nb_clusters);
+    aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    for (i = 0; i < nb_clusters && aio_task_pool_status(aio) == 0; i++) {
+        Qcow2CompressTask *task = g_new(Qcow2CompressTask, 1);
+        uint64_t chunk_offset = (uint64_t)i * s->cluster_size;
+
+        clusters[i].buf = g_malloc(s->cluster_size);
+        *task = (Qcow2CompressTask) {
+            .task.func = qcow2_co_compress_task_entry,
+            .bs = bs,
+            .offset = offset + chunk_offset,
+            .bytes = MIN(bytes - chunk_offset, s->cluster_size),
+            .qiov = qiov,
+            .qiov_offset = qiov_offset + chunk_offset,
+            .cluster = &clusters[i],
+        };
+        aio_task_pool_start_task(aio, &task->task);
+    }
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    g_free(aio);
+    if (ret < 0) {
+        goto out;
+    }
+
+    qemu_iovec_init(&run_qiov, nb_clusters);
+    for (i = 0; i < nb_clusters; i++) {
+        uint64_t chunk_offset = (uint64_t)i * s->cluster_size;
+        uint64_t chunk_bytes = MIN(bytes - chunk_offset, s->cluster_size);
+        uint64_t cluster_offset;
+
+        if (clusters[i].len == -ENOMEM) {
+            /* could not compress: write normal cluster */
+            ret = qcow2_co_pwritev_part(bs, offset + chunk_offset, chunk_bytes,
+                                        qiov, qiov_offset + chunk_offset, 0);
+            if (ret < 0) {
+                break;
+            }
+            continue;
+        }
+
+        ret = qcow2_co_alloc_compressed_cluster(bs, offset + chunk_offset,
+                                                clusters[i].len,
+                                                &cluster_offset);
+        if (ret < 0) {
+            break;
+        }
+
+        if (run_qiov.size && cluster_offset != run_end) {
+            BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
+            ret = bdrv_co_pwritev(s->data_file, run_start, run_qiov.size,
+                                  &run_qiov, 0);
+            if (ret < 0) {
+                break;
+            }
+            qemu_iovec_reset(&run_qiov);
+        }
+        if (!run_qiov.size) {
+            run_start = cluster_offset;
+        }
+        qemu_iovec_add(&run_qiov, clusters[i].buf, clusters[i].len);
+        run_end = cluster_offset + clusters[i].len;
+    }
 
-    assert(!t->subcluster_type && !t->l2meta);
+    if (ret >= 0 && run_qiov.size) {
+        BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
+        ret = bdrv_co_pwritev(s->data_file, run_start, run_qiov.size,
+                              &run_qiov, 0);
+    }
+    qemu_iovec_destroy(&run_qiov);
 
-    return qcow2_co_pwritev_compressed_task(t->bs, t->offset, t->bytes, t->qiov,
-                                            t->qiov_offset);
+out:
+    for (i = 0; i < nb_clusters; i++) {
+        g_free(clusters[i].buf);
+    }
+    return ret < 0 ? ret : 0;
 }
 
 /*
@@ -4636,8 +4960,6 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
                                  QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    AioTaskPool *aio = NULL;
-    int ret = 0;
 
     if (has_data_file(bs)) {
         return -ENOTSUP;
@@ -4665,32 +4987,13 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         return -EINVAL;
     }
 
-    while (bytes && aio_task_pool_status(aio) == 0) {
-        uint64_t chunk_size = MIN(bytes, s->cluster_size);
-
-        if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
-        }
-
-        ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
-                             0, 0, offset, chunk_size, qiov, qiov_offset, NULL);
-        if (ret < 0) {
-            break;
-        }
-        qiov_offset += chunk_size;
-        offset += chunk_size;
-        bytes -= chunk_size;
-    }
-
-    if (aio) {
-        aio_task_pool_wait_all(aio);
-        if (ret == 0) {
-            ret = aio_task_pool_status(aio);
-        }
-        g_free(aio);
+    if (bytes <= s->cluster_size) {
+        return qcow2_co_pwritev_compressed_task(bs, offset, bytes, qiov,
+                                                qiov_offset);
     }
 
-    return ret;
+    return qcow2_co_pwritev_compressed_clusters(bs, offset, bytes, qiov,
+                                                qiov_offset);
 }
 
 static int coroutine_fn
@@ -4894,21 +5197,24 @@ static int qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    /* make_completely_empty() rebuilds the refcounts from scratch */
+    qcow2_release_cluster_pool(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size &&
         s->crypt_method_header != QCOW_CRYPT_LUKS &&
-        !has_data_file(bs)) {
+        !s->alloc_summary_offset && !has_data_file(bs)) {
         /* The following function only works for qcow2 v3 images (it
          * requires the dirty flag) and only as long as there are no
          * features that reserve extra clusters (such as snapshots,
-         * LUKS header, or persistent bitmaps), because it completely
-         * empties the image.  Furthermore, the L1 table and three
-         * additional clusters (image header, refcount table, one
-         * refcount block) have to fit inside one refcount block. It
-         * only resets the image file, i.e. does not work with an
-         * external data file. */
+         * LUKS header, persistent bitmaps, or the allocation summary),
+         * because it completely empties the image.  Furthermore, the
+         * L1 table and three additional clusters (image header, refcount
+         * table, one refcount block) have to fit inside one refcount
+         * block. It only resets the image file, i.e. does not work with
+         * an external data file. */
         return make_completely_empty(bs);
     }
 
@@ -4928,6 +5234,10 @@ static int qcow2_make_empty(BlockDriverState *bs)
         }
     }
 
+    if (ret == 0) {
+        qcow2_alloc_summary_reset(bs);
+    }
+
     return ret;
 }
 
@@ -5117,6 +5427,7 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     bdi->cluster_size = s->cluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
     bdi->is_dirty = s->incompatible_features & QCOW2_INCOMPAT_DIRTY;
+    bdi->multi_cluster_compressed_writes = true;
     return 0;
 }
 
@@ -5169,6 +5480,8 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
             .has_data_file_raw  = has_data_file(bs),
             .data_file_raw      = data_file_is_raw(bs),
             .compression_type   = s->compression_type,
+            .has_alloc_summary  = !!s->alloc_summary_offset,
+            .alloc_summary      = true,
         };
     } else {
         /* if this assertion fails, this probably means a new version was
@@ -5202,6 +5515,21 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = g_new(Qcow2CacheStats, 1);
+    stats->u.qcow2.refcount_cache = g_new(Qcow2CacheStats, 1);
+    qcow2_cache_get_stats(s->l2_table_cache, stats->u.qcow2.l2_cache);
+    qcow2_cache_get_stats(s->refcount_block_cache,
+                          stats->u.qcow2.refcount_cache);
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -5381,7 +5709,12 @@ static int qcow2_downgrade(BlockDriverState *bs, int target_version,
     /* if lazy refcounts have been used, they have already been fixed through
      * clearing the dirty flag */
 
-    /* clearing autoclear features is trivial */
+    /* clearing autoclear features is trivial, once their data is gone */
+    ret = qcow2_alloc_summary_disable(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to remove allocation summary");
+        return ret;
+    }
     s->autoclear_features = 0;
 
     ret = qcow2_expand_zero_clusters(bs, status_cb, cb_opaque);
@@ -5565,6 +5898,7 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     uint64_t new_size = 0;
     const char *backing_file = NULL, *backing_format = NULL, *data_file = NULL;
     bool lazy_refcounts = s->use_lazy_refcounts;
+    bool alloc_summary = !!s->alloc_summary_offset;
     bool data_file_raw = data_file_is_raw(bs);
     const char *compat = NULL;
     int refcount_bits = s->refcount_bits;
@@ -5573,6 +5907,9 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     Qcow2AmendHelperCBInfo helper_cb_info;
     bool encryption_update = false;
 
+    /* Changing the version or refcount order walks all refcounts */
+    qcow2_release_cluster_pool(bs);
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
@@ -5613,6 +5950,9 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
         } else if (!strcmp(desc->name, BLOCK_OPT_LAZY_REFCOUNTS)) {
             lazy_refcounts = qemu_opt_get_bool(opts, BLOCK_OPT_LAZY_REFCOUNTS,
                                                lazy_refcounts);
+        } else if (!strcmp(desc->name, BLOCK_OPT_ALLOC_SUMMARY)) {
+            alloc_summary = qemu_opt_get_bool(opts, BLOCK_OPT_ALLOC_SUMMARY,
+                                              alloc_summary);
         } else if (!strcmp(desc->name, BLOCK_OPT_REFCOUNT_BITS)) {
             refcount_bits = qemu_opt_get_number(opts, BLOCK_OPT_REFCOUNT_BITS,
                                                 refcount_bits);
@@ -5775,6 +6115,28 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
         }
     }
 
+    if (alloc_summary != !!s->alloc_summary_offset) {
+        if (alloc_summary) {
+            if (new_version < 3) {
+                error_setg(errp, "The allocation summary requires "
+                           "compatibility level 1.1 and above (use compat=1.1 "
+                           "or greater)");
+                return -EINVAL;
+            }
+            ret = qcow2_alloc_summary_enable(bs, errp);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            ret = qcow2_alloc_summary_disable(bs);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret,
+                                 "Failed to remove the allocation summary");
+                return ret;
+            }
+        }
+    }
+
     if (new_size) {
         BlockBackend *blk = blk_new_with_bs(bs, BLK_PERM_RESIZE, BLK_PERM_ALL,
                                             errp);
@@ -5932,6 +6294,12 @@ void qcow2_signal_corruption(BlockDriverState *bs, bool fatal, int64_t offset,
         .help = "Postpone refcount updates",                        \
         .def_value_str = "off"                                      \
     },                                                              \
+    {                                                               \
+        .name = BLOCK_OPT_ALLOC_SUMMARY,                            \
+        .type = QEMU_OPT_BOOL,                                      \
+        .help = "Keep a summary of allocated areas for fast "       \
+                "block status"                                      \
+    },                                                              \
     {                                                               \
         .name = BLOCK_OPT_REFCOUNT_BITS,                            \
         .type = QEMU_OPT_NUMBER,                                    \
@@ -6049,6 +6417,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -68,6 +68,10 @@
 #define QCOW2_MAX_BITMAPS 65535
 #define QCOW2_MAX_BITMAP_DIRECTORY_SIZE (1024 * QCOW2_MAX_BITMAPS)
 
+/* Allocation summary header extension constraints */
+#define QCOW2_MAX_ALLOC_SUMMARY_SIZE (8 * MiB)
+#define QCOW2_ALLOC_SUMMARY_MIN_GRANULARITY_BITS 20
+
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
@@ -128,6 +132,8 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+#define QCOW2_MAX_CLUSTER_POOL_SIZE (1 * GiB)
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -149,6 +155,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_CLUSTER_POOL_SIZE "cluster-pool-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -280,11 +287,14 @@ enum {
 enum {
     QCOW2_AUTOCLEAR_BITMAPS_BITNR       = 0,
     QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR = 1,
+    QCOW2_AUTOCLEAR_ALLOC_SUMMARY_BITNR = 2,
     QCOW2_AUTOCLEAR_BITMAPS             = 1 << QCOW2_AUTOCLEAR_BITMAPS_BITNR,
     QCOW2_AUTOCLEAR_DATA_FILE_RAW       = 1 << QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR,
+    QCOW2_AUTOCLEAR_ALLOC_SUMMARY       = 1 << QCOW2_AUTOCLEAR_ALLOC_SUMMARY_BITNR,
 
     QCOW2_AUTOCLEAR_MASK                = QCOW2_AUTOCLEAR_BITMAPS
-                                        | QCOW2_AUTOCLEAR_DATA_FILE_RAW,
+                                        | QCOW2_AUTOCLEAR_DATA_FILE_RAW
+                                        | QCOW2_AUTOCLEAR_ALLOC_SUMMARY,
 };
 
 enum qcow2_discard_type {
@@ -321,6 +331,13 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+typedef struct Qcow2AllocSummaryHeaderExt {
+    uint64_t bitmap_offset;
+    uint64_t bitmap_size;
+    uint8_t granularity_bits;
+    uint8_t reserved[7];
+} QEMU_PACKED Qcow2AllocSummaryHeaderExt;
+
 #define QCOW2_MAX_THREADS 4
 
 typedef struct BDRVQcow2State {
@@ -356,6 +373,11 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /* Reserved data clusters, see qcow2_alloc_pooled_clusters() */
+    uint64_t cluster_pool_max;
+    uint64_t cluster_pool_offset;
+    uint64_t cluster_pool_size;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -373,6 +395,13 @@ typedef struct BDRVQcow2State {
     uint64_t bitmap_directory_size;
     uint64_t bitmap_directory_offset;
 
+    /* Allocation summary, see qcow2-alloc-summary.c */
+    uint64_t alloc_summary_offset;
+    uint64_t alloc_summary_size;
+    int alloc_summary_granularity_bits;
+    int64_t alloc_summary_bits;
+    unsigned long *alloc_summary; /* NULL if absent or stale */
+
     int flags;
     int qcow_version;
     bool use_lazy_refcounts;
@@ -862,6 +891,11 @@ int64_t qcow2_refcount_area(BlockDriverState *bs, uint64_t offset,
                             uint64_t new_refblock_offset);
 
 int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size);
+int64_t qcow2_take_pooled_clusters(BlockDriverState *bs, uint64_t size);
+int64_t qcow2_alloc_pooled_clusters(BlockDriverState *bs, uint64_t size);
+int64_t qcow2_alloc_pooled_clusters_at(BlockDriverState *bs, uint64_t offset,
+                                       int64_t nb_clusters);
+void qcow2_release_cluster_pool(BlockDriverState *bs);
 int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                 int64_t nb_clusters);
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size);
@@ -976,6 +1010,27 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
+
+/* qcow2-alloc-summary.c functions */
+int qcow2_alloc_summary_load(BlockDriverState *bs, bool *header_updated,
+                             Error **errp);
+int qcow2_alloc_summary_reopen_rw(BlockDriverState *bs, Error **errp);
+int qcow2_alloc_summary_store(BlockDriverState *bs);
+void qcow2_alloc_summary_close(BlockDriverState *bs);
+int qcow2_alloc_summary_enable(BlockDriverState *bs, Error **errp);
+int qcow2_alloc_summary_disable(BlockDriverState *bs);
+int qcow2_alloc_summary_resize(BlockDriverState *bs, uint64_t size);
+void qcow2_alloc_summary_rebuild(BlockDriverState *bs);
+void qcow2_alloc_summary_reset(BlockDriverState *bs);
+void qcow2_alloc_summary_mark(BlockDriverState *bs, uint64_t offset,
+                              uint64_t bytes);
+uint64_t qcow2_alloc_summary_unallocated(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes);
+int qcow2_check_alloc_summary_refcounts(BlockDriverState *bs,
+                                        BdrvCheckResult *res,
+                                        void **refcount_table,
+                                        int64_t *refcount_table_size);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
@@ -43,6 +43,16 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * With iothread-vq-mapping, the IOThreads serving the virtqueues.  The
+     * first one is @iothread, which also hosts the BlockBackend.
+     */
+    IOThread **iothreads;
+    unsigned num_iothreads;
+
+    /* The AioContext handling each virtqueue */
+    AioContext **vq_aio_context;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -88,10 +98,34 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    g_auto(GStrv) mapping = NULL;
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    /* iothread-vq-mapping is a colon-separated list of IOThread ids */
+    if (conf->iothread_vq_mapping) {
+        if (conf->iothread) {
+            error_setg(errp, "iothread and iothread-vq-mapping properties "
+                       "cannot be set at the same time");
+            return false;
+        }
+
+        mapping = g_strsplit(conf->iothread_vq_mapping, ":", -1);
+        if (!mapping[0]) {
+            error_setg(errp, "iothread-vq-mapping must not be empty");
+            return false;
+        }
+        for (i = 0; mapping[i]; i++) {
+            if (!iothread_by_id(mapping[i])) {
+                error_setg(errp, "iothread-vq-mapping: IOThread '%s' not found",
+                           mapping[i]);
+                return false;
+            }
+        }
+    }
+
+    if (conf->iothread || mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -120,13 +154,38 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
+    if (mapping) {
+        s->num_iothreads = g_strv_length(mapping);
+        s->iothreads = g_new(IOThread *, s->num_iothreads);
+        for (i = 0; i < s->num_iothreads; i++) {
+            s->iothreads[i] = iothread_by_id(mapping[i]);
+            object_ref(OBJECT(s->iothreads[i]));
+        }
+        s->iothread = s->iothreads[0];
+        object_ref(OBJECT(s->iothread));
+    } else if (conf->iothread) {
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
+    }
+
+    if (s->iothread) {
         s->ctx = iothread_get_aio_context(s->iothread);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    /* Virtqueues are assigned to the mapped IOThreads round-robin */
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        if (s->num_iothreads) {
+            IOThread *iothread = s->iothreads[i % s->num_iothreads];
+
+            s->vq_aio_context[i] = iothread_get_aio_context(iothread);
+        } else {
+            s->vq_aio_context[i] = s->ctx;
+        }
+    }
+
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -139,6 +198,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -151,6 +211,11 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -173,7 +238,12 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
     s->starting = true;
 
-    if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    /*
+     * notify_guest_bh() only runs in s->ctx, while completions also happen
+     * in the other IOThreads of iothread-vq-mapping.
+     */
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX) &&
+        !s->num_iothreads) {
         s->batch_notifications = true;
     } else {
         s->batch_notifications = false;
@@ -243,13 +313,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+        aio_context_acquire(ctx);
+        virtio_queue_aio_attach_host_notifier(vq, ctx);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_aio_context:
@@ -278,20 +349,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/* Stop notifications for new requests from guest on one virtqueue.
  *
- * Context: BH in IOThread
+ * Context: BH in the IOThread of the virtqueue
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned i;
+    VirtQueue *vq = opaque;
 
-    for (i = 0; i < s->conf->num_queues; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
-
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
-    }
+    virtio_queue_aio_detach_host_notifier(vq, qemu_get_current_aio_context());
 }
 
 /* Context: QEMU global mutex held */
@@ -317,8 +383,16 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, vq);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
@@ -773,9 +773,18 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     VirtIOBlockReq *req;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
+    /*
+     * With iothread-vq-mapping, the requests of virtqueues served outside
+     * of the AioContext of the BlockBackend only start once they have been
+     * scheduled there, after blk_io_unplug(), so plugging is useless.
+     */
+    bool plug = !s->conf.iothread_vq_mapping ||
+        qemu_get_current_aio_context() == blk_get_aio_context(s->blk);
 
     aio_context_acquire(blk_get_aio_context(s->blk));
-    blk_io_plug(s->blk);
+    if (plug) {
+        blk_io_plug(s->blk);
+    }
 
     do {
         if (suppress_notifications) {
@@ -799,7 +808,9 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         virtio_blk_submit_multireq(s->blk, &mrb);
     }
 
-    blk_io_unplug(s->blk);
+    if (plug) {
+        blk_io_unplug(s->blk);
+    }
     aio_context_release(blk_get_aio_context(s->blk));
 }
 
@@ -1298,6 +1309,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIOBlock,
+                       conf.iothread_vq_mapping),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
@@ -211,6 +211,9 @@ struct AioContext {
      */
     struct LuringState *linux_io_uring;
 
+    /* Polled ring for O_DIRECT reads and writes, see luring_init_polled() */
+    struct LuringState *linux_io_uring_poll;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -522,6 +525,13 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/* Setup the polled LuringState bound to this AioContext */
+struct LuringState *aio_setup_linux_io_uring_poll(AioContext *ctx,
+                                                  Error **errp);
+
+/* Return the polled LuringState bound to this AioContext */
+struct LuringState *aio_get_linux_io_uring_poll(AioContext *ctx);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
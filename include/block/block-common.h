@@ -59,6 +59,11 @@ typedef struct BlockDriverInfo {
      * True if this block driver only supports compressed writes
      */
     bool needs_compressed_writes;
+    /*
+     * True if a compressed write may cover several clusters (it must still
+     * be cluster aligned); otherwise it must cover exactly one cluster
+     */
+    bool multi_cluster_compressed_writes;
 } BlockDriverInfo;
 
 typedef struct BlockFragInfo {
@@ -61,6 +61,7 @@
 #define BLOCK_OPT_DATA_FILE_RAW     "data_file_raw"
 #define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
 #define BLOCK_OPT_EXTL2             "extended_l2"
+#define BLOCK_OPT_ALLOC_SUMMARY     "alloc_summary"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
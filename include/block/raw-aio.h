@@ -17,6 +17,7 @@
 #define QEMU_RAW_AIO_H
 
 #include "block/aio.h"
+#include "block/accounting.h"
 #include "qemu/coroutine.h"
 #include "qemu/iov.h"
 
@@ -62,14 +63,30 @@ void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s,
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
+
+/* Latencies of the requests of one user of the rings, in nanoseconds */
+typedef struct LuringLatencyStats {
+    /* From luring_co_submit() to handing the request to the kernel */
+    BlockLatencyHistogram submit;
+    /* From handing the request to the kernel to its completion */
+    BlockLatencyHistogram complete;
+} LuringLatencyStats;
+
 LuringState *luring_init(Error **errp);
+LuringState *luring_init_polled(Error **errp);
 void luring_cleanup(LuringState *s);
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                uint64_t offset, QEMUIOVector *qiov, int type);
+                                  uint64_t offset, QEMUIOVector *qiov, int type,
+                                  LuringLatencyStats *stats);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 void luring_io_plug(BlockDriverState *bs, LuringState *s);
 void luring_io_unplug(BlockDriverState *bs, LuringState *s);
+bool luring_enable_fixed_buffers(LuringState *s, Error **errp);
+void luring_disable_fixed_buffers(LuringState *s);
+void luring_latency_stats_init(LuringLatencyStats *stats);
+void luring_latency_stats_cleanup(LuringLatencyStats *stats);
+void luring_unregister_fd(LuringState *s, int fd);
 #endif
 
 #ifdef _WIN32
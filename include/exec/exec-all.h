@@ -476,6 +476,11 @@ struct TranslationBlock {
 #define CF_INVALID       0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL      0x00080000 /* Generate code for a parallel context */
 #define CF_NOIRQ         0x00100000 /* Generate an uninterruptible TB */
+#define CF_HOT           0x00200000 /* Translated as a superblock */
+#define CF_QUICK         0x00400000 /* Translated without optimization,
+                                       to be replaced asynchronously */
+/* cflags that are not part of the lookup key */
+#define CF_LOOKUP_IGNORE (CF_HOT | CF_QUICK)
 #define CF_CLUSTER_MASK  0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 
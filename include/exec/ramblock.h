@@ -71,6 +71,16 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * With the mapped-ram migration capability, each page of the block
+     * is stored at a fixed offset in the migration file.  @file_bmap
+     * tracks the pages that the file holds, @bitmap_offset is where that
+     * bitmap is stored and @pages_offset is where the pages start.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    off_t pages_offset;
 };
 #endif
 #endif
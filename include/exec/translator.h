@@ -111,6 +111,11 @@ typedef struct DisasContextBase {
  *
  * @disas_log:
  *      Print instruction disassembly to log.
+ *
+ * @hot_superblocks:
+ *      The target translates TBs with CF_HOT set as superblocks, which
+ *      continue across some branches.  If set, the execution of other TBs
+ *      is counted so that they are retranslated once they become hot.
  */
 typedef struct TranslatorOps {
     void (*init_disas_context)(DisasContextBase *db, CPUState *cpu);
@@ -119,6 +124,7 @@ typedef struct TranslatorOps {
     void (*translate_insn)(DisasContextBase *db, CPUState *cpu);
     void (*tb_stop)(DisasContextBase *db, CPUState *cpu);
     void (*disas_log)(const DisasContextBase *db, CPUState *cpu);
+    bool hot_superblocks;
 } TranslatorOps;
 
 /**
@@ -167,7 +173,7 @@ bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
  * the relevant information at translation time.
  */
 
-#define GEN_TRANSLATOR_LD(fullname, type, load_fn, swap_fn)             \
+#define GEN_TRANSLATOR_LD(fullname, type, load_fn, swap_fn, snap_fn)    \
     type fullname ## _swap(CPUArchState *env, DisasContextBase *dcbase, \
                            abi_ptr pc, bool do_swap);                   \
     static inline type fullname(CPUArchState *env,                      \
@@ -177,11 +183,11 @@ bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
     }
 
 #define FOR_EACH_TRANSLATOR_LD(F)                                       \
-    F(translator_ldub, uint8_t, cpu_ldub_code, /* no swap */)           \
-    F(translator_ldsw, int16_t, cpu_ldsw_code, bswap16)                 \
-    F(translator_lduw, uint16_t, cpu_lduw_code, bswap16)                \
-    F(translator_ldl, uint32_t, cpu_ldl_code, bswap32)                  \
-    F(translator_ldq, uint64_t, cpu_ldq_code, bswap64)
+    F(translator_ldub, uint8_t, cpu_ldub_code, /* no swap */, ldub_p)   \
+    F(translator_ldsw, int16_t, cpu_ldsw_code, bswap16, ldsw_p)         \
+    F(translator_lduw, uint16_t, cpu_lduw_code, bswap16, lduw_p)        \
+    F(translator_ldl, uint32_t, cpu_ldl_code, bswap32, ldl_p)           \
+    F(translator_ldq, uint64_t, cpu_ldq_code, bswap64, ldq_p)
 
 FOR_EACH_TRANSLATOR_LD(GEN_TRANSLATOR_LD)
 
@@ -230,8 +230,16 @@ struct kvm_run;
 struct hax_vcpu_state;
 struct hvf_vcpu_state;
 
-#define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+/*
+ * Per-vCPU cache of translation blocks indexed by virtual pc, see
+ * accel/tcg/tb-hash.h.  Accessed in parallel; all accesses to the
+ * entries must be atomic.  Freed after an RCU grace period.
+ */
+typedef struct CPUJumpCache {
+    struct rcu_head rcu;
+    unsigned int entries;
+    TranslationBlock *array[];
+} CPUJumpCache;
 
 /* work queue */
 
@@ -361,8 +369,10 @@ struct CPUState {
     CPUArchState *env_ptr;
     IcountDecr *icount_decr_ptr;
 
-    /* Accessed in parallel; all accesses must be atomic */
-    TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /* Allocated by TCG; read with qatomic_rcu_read */
+    CPUJumpCache *tb_jmp_cache;
+    /* Jump cache misses; written only by the vCPU thread, read by "info jit" */
+    size_t tb_jmp_cache_miss;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -418,6 +428,12 @@ struct CPUState {
      */
     bool throttle_thread_scheduled;
 
+    /*
+     * Sleep time in microseconds imposed on the vCPU each time its dirty
+     * ring gets full, used by the per-vCPU dirty page rate limit
+     */
+    int64_t throttle_us_per_full;
+
     bool ignore_memory_transaction_failures;
 
     /* Used for user-only emulation of prctl(PR_SET_UNALIGN). */
@@ -444,10 +460,16 @@ extern __thread CPUState *current_cpu;
 
 static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
 {
+    CPUJumpCache *jc;
     unsigned int i;
 
-    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
-        qatomic_set(&cpu->tb_jmp_cache[i], NULL);
+    RCU_READ_LOCK_GUARD();
+    jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+    if (!jc) {
+        return;
+    }
+    for (i = 0; i < jc->entries; i++) {
+        qatomic_set(&jc->array[i], NULL);
     }
 }
 
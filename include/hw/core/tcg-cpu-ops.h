@@ -37,6 +37,25 @@ struct TCGCPUOps {
     void (*cpu_exec_exit)(CPUState *cpu);
     /** @debug_excp_handler: Callback for handling debug exceptions */
     void (*debug_excp_handler)(CPUState *cpu);
+    /**
+     * @persistent_tb: The translator embeds no host pointers in the code
+     * it generates, so its TBs can be kept in the persistent translation
+     * cache (see the tb-cache accelerator property).
+     */
+    bool persistent_tb;
+    /**
+     * @tb_cache_fingerprint: Append to @s the CPU configuration that the
+     * translator depends on beyond the CPU model, such as the enabled
+     * features.  Required with @persistent_tb.
+     */
+    void (*tb_cache_fingerprint)(CPUState *cpu, GString *s);
+    /**
+     * @async_translate: The translator depends only on the TB flags and
+     * on CPU configuration that does not change at run time, so that TBs
+     * can be translated again by another thread (see the async-translate
+     * accelerator property).
+     */
+    bool async_translate;
 
 #ifdef NEED_CPU_H
 #if defined(CONFIG_USER_ONLY) && defined(TARGET_I386)
@@ -36,6 +36,7 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    char *iothread_vq_mapping;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -0,0 +1,56 @@
+/*
+ * Dirty page rate limit common functions
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_DIRTYLIMIT_H
+#define QEMU_DIRTYLIMIT_H
+
+/**
+ * dirtylimit_set_vcpu:
+ * @cpu_index: index of the vCPU to limit
+ * @quota: dirty page rate limit in MB/s, 0 to cancel the limit
+ *
+ * Throttle the vCPU whenever its dirty page rate exceeds @quota.  The
+ * rate of every vCPU is measured through the KVM dirty ring while at
+ * least one vCPU is limited.  Must be called with the BQL held.
+ */
+void dirtylimit_set_vcpu(int cpu_index, uint64_t quota);
+
+/**
+ * dirtylimit_set_all:
+ * @quota: dirty page rate limit in MB/s, 0 to cancel the limits
+ *
+ * Same as dirtylimit_set_vcpu() for every vCPU.
+ */
+void dirtylimit_set_all(uint64_t quota);
+
+/**
+ * dirtylimit_set_migration:
+ * @quota: dirty page rate limit in MB/s, 0 to cancel the limit
+ *
+ * Limit every vCPU for the sake of a migration, without touching the
+ * limits set with dirtylimit_set_vcpu(), which apply again once the
+ * migration cancels its limit.  vCPUs with both limits get the lower
+ * one.  Must be called with the BQL held.
+ */
+void dirtylimit_set_migration(uint64_t quota);
+
+/**
+ * dirtylimit_in_service:
+ *
+ * Returns: %true if at least one vCPU has a dirty page rate limit.
+ */
+bool dirtylimit_in_service(void);
+
+/**
+ * dirtylimit_vcpu_execute:
+ * @cpu: the vCPU whose dirty ring just got full
+ *
+ * Called from the vCPU thread, without the BQL.  Puts the vCPU to
+ * sleep for as long as its dirty page rate limit requires.
+ */
+void dirtylimit_vcpu_execute(CPUState *cpu);
+
+#endif
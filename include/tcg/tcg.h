@@ -582,6 +582,14 @@ struct TCGContext {
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
+    /*
+     * If set, the guest code is read from this copy instead of guest
+     * memory, for asynchronous translation.
+     */
+    const uint8_t *code_snapshot;
+    target_ulong code_snapshot_pc;
+    size_t code_snapshot_len;
+
     /* These structures are private to tcg-target.c.inc.  */
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_HEAD(, TCGLabelQemuLdst) ldst_labels;
@@ -804,6 +812,12 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_available(void);
+size_t tcg_region_evict(size_t n, void (*evict_tb)(TranslationBlock *tb));
+size_t tcg_region_count(void);
+void tcg_region_init_exec_counts(void);
+const void *tcg_region_exec_counts(void);
+uint32_t *tcg_tb_exec_count(const TranslationBlock *tb);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -834,6 +848,7 @@ static inline void *tcg_malloc(int size)
 }
 
 void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
+void tcg_host_features(GString *s);
 void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
@@ -1019,7 +1034,11 @@ TCGOp *tcg_op_insert_after(TCGContext *s, TCGOp *op, TCGOpcode opc);
  */
 void tcg_remove_ops_after(TCGOp *op);
 
-void tcg_optimize(TCGContext *s);
+/*
+ * With @ebb, optimize extended basic blocks as a whole, across their
+ * conditional branches.
+ */
+void tcg_optimize(TCGContext *s, bool ebb);
 
 /* Allocate a new temporary and initialize it with a constant. */
 TCGv_i32 tcg_const_i32(int32_t val);
@@ -69,6 +69,7 @@ static envlist_t *envlist;
 static const char *cpu_model;
 static const char *cpu_type;
 static const char *seed_optarg;
+static const char *tb_cache_path;
 unsigned long mmap_min_addr;
 uintptr_t guest_base;
 bool have_guest_base;
@@ -324,6 +325,11 @@ static void handle_arg_seed(const char *arg)
     seed_optarg = arg;
 }
 
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_path = arg;
+}
+
 static void handle_arg_gdb(const char *arg)
 {
     gdbstub = g_strdup(arg);
@@ -456,6 +462,8 @@ static const struct qemu_argument arg_table[] = {
      "address",    "set guest_base address to 'address'"},
     {"R",          "QEMU_RESERVED_VA", true,  handle_arg_reserved_va,
      "size",       "reserve 'size' bytes for guest virtual address space"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "file",       "keep translated code in 'file' for later runs"},
     {"d",          "QEMU_LOG",         true,  handle_arg_log,
      "item[,...]", "enable logging of specified items "
      "(use '-d help' for a list of items)"},
@@ -735,9 +743,14 @@ int main(int argc, char **argv, char **envp)
 
     /* init tcg before creating CPUs and to get qemu_host_page_size */
     {
-        AccelClass *ac = ACCEL_GET_CLASS(current_accel());
+        AccelState *accel = current_accel();
+        AccelClass *ac = ACCEL_GET_CLASS(accel);
 
         accel_init_interfaces(ac);
+        if (tb_cache_path) {
+            object_property_set_str(OBJECT(accel), "tb-cache", tb_cache_path,
+                                    &error_abort);
+        }
         ac->init_machine(NULL);
     }
     cpu = cpu_create(cpu_type);
@@ -20,10 +20,13 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
+#include "sysemu/dirtylimit.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -101,6 +104,12 @@
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+/* 1: the migration thread synchronizes the dirty bitmap alone */
+#define DEFAULT_MIGRATE_DIRTY_SYNC_THREADS 1
+/* Per-vCPU dirty page rate limit used by the dirty-limit capability */
+#define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT 1 /* MB/s */
+/* Threads reading the pages of a mapped-ram file on the destination */
+#define DEFAULT_MIGRATE_MAPPED_RAM_THREADS 4
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -208,6 +217,9 @@ void migration_object_init(void)
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
     qemu_mutex_init(&current_incoming->page_request_mutex);
     current_incoming->page_requested = g_tree_new(page_request_addr_cmp);
+    qemu_mutex_init(&current_incoming->postcopy_prio_thread_mutex);
+    qemu_sem_init(&current_incoming->postcopy_qemufile_dst_done, 0);
+    qemu_sem_init(&current_incoming->postcopy_pause_sem_fast_load, 0);
 
     migration_object_check(current_migration, &error_fatal);
 
@@ -296,6 +308,11 @@ void migration_incoming_state_destroy(void)
         qemu_fclose(mis->from_src_file);
         mis->from_src_file = NULL;
     }
+    if (mis->postcopy_qemufile_dst) {
+        migration_ioc_unregister_yank_from_file(mis->postcopy_qemufile_dst);
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+    }
     if (mis->postcopy_remote_fds) {
         g_array_free(mis->postcopy_remote_fds, TRUE);
         mis->postcopy_remote_fds = NULL;
@@ -415,10 +432,15 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         if (!received && !g_tree_lookup(mis->page_requested, aligned)) {
             /*
              * The page has not been received, and it's not yet in the page
-             * request list.  Queue it.  Set the value of element to 1, so that
-             * things like g_tree_lookup() will return TRUE (1) when found.
+             * request list.  Queue it.  The value of the element is the time
+             * of the request, used for the fault latency statistics; it's
+             * never 0, so that things like g_tree_lookup() will return TRUE
+             * when found.
              */
-            g_tree_insert(mis->page_requested, aligned, (gpointer)1);
+            uint32_t request_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+            g_tree_insert(mis->page_requested, aligned,
+                          (gpointer)(uintptr_t)(request_us ?: 1));
             mis->page_requested_count++;
             trace_postcopy_page_req_add(aligned, mis->page_requested_count);
         }
@@ -484,6 +506,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -726,14 +750,21 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
          * right now.  Multifd needs more than one channel, we wait.
          */
         start_migration = !migrate_use_multifd();
-    } else {
+    } else if (migrate_use_multifd() && !multifd_recv_all_channels_created()) {
         /* Multiple connections */
-        assert(migrate_use_multifd());
         start_migration = multifd_recv_new_channel(ioc, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
         }
+    } else {
+        /*
+         * The postcopy preempt channel, which comes once postcopy starts,
+         * hence after all the multifd channels.
+         */
+        assert(migrate_postcopy_preempt());
+        postcopy_preempt_new_channel(mis, qemu_fopen_channel_input(ioc));
+        return;
     }
 
     if (start_migration) {
@@ -754,6 +785,10 @@ bool migration_has_all_channels(void)
 
     all_channels = multifd_recv_all_channels_created();
 
+    if (migrate_postcopy_preempt()) {
+        all_channels = all_channels && mis->postcopy_qemufile_dst != NULL;
+    }
+
     return all_channels && mis->from_src_file != NULL;
 }
 
@@ -913,6 +948,12 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->announce_rounds = s->parameters.announce_rounds;
     params->has_announce_step = true;
     params->announce_step = s->parameters.announce_step;
+    params->has_dirty_sync_threads = true;
+    params->dirty_sync_threads = s->parameters.dirty_sync_threads;
+    params->has_vcpu_dirty_limit = true;
+    params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
+    params->has_mapped_ram_threads = true;
+    params->mapped_ram_threads = s->parameters.mapped_ram_threads;
 
     if (s->parameters.has_block_bitmap_mapping) {
         params->has_block_bitmap_mapping = true;
@@ -1023,8 +1064,15 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->precopy_bytes = ram_counters.precopy_bytes;
     info->ram->downtime_bytes = ram_counters.downtime_bytes;
     info->ram->postcopy_bytes = ram_counters.postcopy_bytes;
-
-    if (migrate_use_xbzrle()) {
+    info->ram->dirty_sync_missed_zero_copy =
+        ram_counters.dirty_sync_missed_zero_copy;
+    info->ram->dirty_sync_latency = ram_counters.dirty_sync_latency;
+    info->ram->dirty_sync_latency_max = ram_counters.dirty_sync_latency_max;
+    info->ram->mapped_ram_bytes = ram_counters.mapped_ram_bytes;
+
+    if (migrate_use_xbzrle() ||
+        (migrate_use_multifd() &&
+         migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE)) {
         info->has_xbzrle_cache = true;
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
         info->xbzrle_cache->cache_size = migrate_xbzrle_cache_size();
@@ -1226,6 +1274,28 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Postcopy preempt requires postcopy-ram");
+            return false;
+        }
+
+        /*
+         * Compressed pages are written out by whichever channel is
+         * current when they get flushed, which may not be the one they
+         * were meant for.
+         */
+        if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp, "Postcopy preempt not compatible with compress");
+            return false;
+        }
+
+        if (migrate_use_tls()) {
+            error_setg(errp, "Postcopy preempt does not support TLS yet");
+            return false;
+        }
+    }
+
     if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
         WriteTrackingSupport wt_support;
         int idx;
@@ -1259,6 +1329,56 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd zero page requires multifd to be enabled");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY] &&
+        (!cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+         !cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM])) {
+        error_setg(errp, "Multifd postcopy requires multifd and postcopy-ram "
+                   "to be enabled");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        /* The pages go to their place in the file, not in the stream */
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Mapped RAM is not compatible with postcopy, "
+                       "xbzrle, compress and multifd");
+            return false;
+        }
+    }
+
+#ifdef CONFIG_LINUX
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND] &&
+        (!cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+         migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE ||
+         migrate_use_tls())) {
+        error_setg(errp,
+                   "Zero copy only available for non-compressed non-TLS multifd migration");
+        return false;
+    }
+#endif
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "dirty-limit conflicts with auto-converge");
+            return false;
+        }
+
+        if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+            error_setg(errp, "dirty-limit requires KVM with accelerator"
+                       " property 'dirty-ring-size' set");
+            return false;
+        }
+    }
+
     /* incoming side only */
     if (runstate_check(RUN_STATE_INMIGRATE) &&
         !migrate_multifd_is_allowed() &&
@@ -1267,6 +1387,14 @@ static bool migrate_caps_check(bool *cap_list,
         return false;
     }
 
+    if (runstate_check(RUN_STATE_INMIGRATE) &&
+        !migrate_multifd_is_allowed() &&
+        cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        error_setg(errp, "postcopy-preempt is not supported by current "
+                   "protocol");
+        return false;
+    }
+
     return true;
 }
 
@@ -1287,13 +1415,13 @@ static void fill_destination_migration_info(MigrationInfo *info)
     case MIGRATION_STATUS_CANCELLING:
     case MIGRATION_STATUS_CANCELLED:
     case MIGRATION_STATUS_ACTIVE:
-    case MIGRATION_STATUS_POSTCOPY_ACTIVE:
-    case MIGRATION_STATUS_POSTCOPY_PAUSED:
-    case MIGRATION_STATUS_POSTCOPY_RECOVER:
     case MIGRATION_STATUS_FAILED:
     case MIGRATION_STATUS_COLO:
         info->has_status = true;
         break;
+    case MIGRATION_STATUS_POSTCOPY_ACTIVE:
+    case MIGRATION_STATUS_POSTCOPY_PAUSED:
+    case MIGRATION_STATUS_POSTCOPY_RECOVER:
     case MIGRATION_STATUS_COMPLETED:
         info->has_status = true;
         fill_destination_postcopy_migration_info(info);
@@ -1407,6 +1535,16 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
 
     /* x_checkpoint_delay is now always positive */
 
+#ifdef CONFIG_LINUX
+    if (migrate_use_zero_copy_send() &&
+        ((params->has_multifd_compression && params->multifd_compression) ||
+         (params->tls_creds && *params->tls_creds))) {
+        error_setg(errp,
+                   "Zero copy only available for non-compressed non-TLS multifd migration");
+        return false;
+    }
+#endif
+
     if (params->has_multifd_channels && (params->multifd_channels < 1)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
                    "multifd_channels",
@@ -1414,6 +1552,27 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_dirty_sync_threads && (params->dirty_sync_threads < 1)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "dirty_sync_threads",
+                   "a value between 1 and 255");
+        return false;
+    }
+
+    if (params->has_vcpu_dirty_limit && (params->vcpu_dirty_limit < 1)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "vcpu_dirty_limit",
+                   "a value of at least 1 MB/s");
+        return false;
+    }
+
+    if (params->has_mapped_ram_threads && (params->mapped_ram_threads < 1)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "mapped_ram_threads",
+                   "a value between 1 and 255");
+        return false;
+    }
+
     if (params->has_multifd_zlib_level &&
         (params->multifd_zlib_level > 9)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zlib_level",
@@ -1576,6 +1735,15 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_announce_step) {
         dest->announce_step = params->announce_step;
     }
+    if (params->has_dirty_sync_threads) {
+        dest->dirty_sync_threads = params->dirty_sync_threads;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        dest->vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+    if (params->has_mapped_ram_threads) {
+        dest->mapped_ram_threads = params->mapped_ram_threads;
+    }
 
     if (params->has_block_bitmap_mapping) {
         dest->has_block_bitmap_mapping = true;
@@ -1693,6 +1861,15 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_announce_step) {
         s->parameters.announce_step = params->announce_step;
     }
+    if (params->has_dirty_sync_threads) {
+        s->parameters.dirty_sync_threads = params->dirty_sync_threads;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        s->parameters.vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+    if (params->has_mapped_ram_threads) {
+        s->parameters.mapped_ram_threads = params->mapped_ram_threads;
+    }
 
     if (params->has_block_bitmap_mapping) {
         qapi_free_BitmapMigrationNodeAliasList(
@@ -1823,6 +2000,11 @@ static void migrate_fd_cleanup(MigrationState *s)
         qemu_mutex_lock_iothread();
 
         multifd_save_cleanup();
+        if (s->postcopy_qemufile_src) {
+            migration_ioc_unregister_yank_from_file(s->postcopy_qemufile_src);
+            qemu_fclose(s->postcopy_qemufile_src);
+            s->postcopy_qemufile_src = NULL;
+        }
         qemu_mutex_lock(&s->qemu_file_lock);
         tmp = s->to_dst_file;
         s->to_dst_file = NULL;
@@ -2242,6 +2424,13 @@ static bool migrate_prepare(MigrationState *s, bool blk, bool blk_inc,
             return false;
         }
 
+        /* The multifd channels are not reconnected on resume */
+        if (migrate_multifd_postcopy()) {
+            error_setg(errp, "Postcopy recovery cannot work "
+                       "when multifd-postcopy capability is set");
+            return false;
+        }
+
         /* This is a resume, skip init status */
         return true;
     }
@@ -2333,6 +2522,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2421,6 +2612,15 @@ bool migrate_postcopy_blocktime(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME];
 }
 
+bool migrate_postcopy_preempt(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
+}
+
 bool migrate_use_compression(void)
 {
     MigrationState *s;
@@ -2511,6 +2711,53 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_use_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_multifd_postcopy(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY];
+}
+
+#ifdef CONFIG_LINUX
+bool migrate_use_zero_copy_send(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+}
+#endif
+
+bool migrate_use_tls(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.tls_creds && *s->parameters.tls_creds;
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2557,6 +2804,42 @@ int migrate_multifd_zstd_level(void)
     return s->parameters.multifd_zstd_level;
 }
 
+int migrate_dirty_sync_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.dirty_sync_threads;
+}
+
+uint64_t migrate_vcpu_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.vcpu_dirty_limit;
+}
+
+int migrate_mapped_ram_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.mapped_ram_threads;
+}
+
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -2871,7 +3154,7 @@ retry:
 out:
     res = qemu_file_get_error(rp);
     if (res) {
-        if (res && migration_in_postcopy()) {
+        if (res && migration_in_postcopy() && !migrate_multifd_postcopy()) {
             /*
              * Maybe there is something we can do: it looks like a
              * network down issue, and we pause for a recovery.
@@ -2959,6 +3242,17 @@ static int postcopy_start(MigrationState *ms)
     int64_t bandwidth = migrate_max_postcopy_bandwidth();
     bool restart_block = false;
     int cur_state = MIGRATION_STATUS_ACTIVE;
+
+    /*
+     * The pages requested during postcopy go through the preempt channel,
+     * so it has to be there before the destination starts faulting.  Its
+     * connection completes in the main loop, so don't hold the BQL here.
+     */
+    if (postcopy_preempt_establish_channel(ms)) {
+        migrate_set_state(&ms->state, ms->state, MIGRATION_STATUS_FAILED);
+        return -1;
+    }
+
     if (!migrate_pause_before_switchover()) {
         migrate_set_state(&ms->state, MIGRATION_STATUS_ACTIVE,
                           MIGRATION_STATUS_POSTCOPY_ACTIVE);
@@ -3360,6 +3654,14 @@ static int postcopy_do_resume(MigrationState *s)
         return ret;
     }
 
+    /* The destination waits for the new preempt channel before resuming */
+    ret = postcopy_preempt_establish_channel(s);
+    if (ret) {
+        error_report("%s: Failed to re-establish the postcopy preempt "
+                     "channel", __func__);
+        return ret;
+    }
+
     /*
      * Last handshake with destination on the resume (destination will
      * switch to postcopy-active afterwards)
@@ -3404,6 +3706,17 @@ static MigThrError postcopy_pause(MigrationState *s)
         qemu_file_shutdown(file);
         qemu_fclose(file);
 
+        /*
+         * Same for the preempt channel, which is only ever used by the
+         * migration thread too.
+         */
+        if (s->postcopy_qemufile_src) {
+            migration_ioc_unregister_yank_from_file(s->postcopy_qemufile_src);
+            qemu_file_shutdown(s->postcopy_qemufile_src);
+            qemu_fclose(s->postcopy_qemufile_src);
+            s->postcopy_qemufile_src = NULL;
+        }
+
         migrate_set_state(&s->state, s->state,
                           MIGRATION_STATUS_POSTCOPY_PAUSED);
 
@@ -3472,11 +3785,13 @@ static MigThrError migration_detect_error(MigrationState *s)
         error_free(local_error);
     }
 
-    if (state == MIGRATION_STATUS_POSTCOPY_ACTIVE && ret) {
+    if (state == MIGRATION_STATUS_POSTCOPY_ACTIVE && ret &&
+        !migrate_multifd_postcopy()) {
         /*
          * For postcopy, we allow the network to be down for a
          * while. After that, it can be continued by a
-         * recovery phase.
+         * recovery phase.  Not with multifd-postcopy though, whose
+         * channels can't be reconnected.
          */
         return postcopy_pause(s);
     } else {
@@ -3495,7 +3810,8 @@ static MigThrError migration_detect_error(MigrationState *s)
 /* How many bytes have we transferred since the beginning of the migration */
 static uint64_t migration_total_bytes(MigrationState *s)
 {
-    return qemu_ftell(s->to_dst_file) + ram_counters.multifd_bytes;
+    return qemu_ftell(s->to_dst_file) + ram_counters.multifd_bytes +
+        ram_counters.mapped_ram_bytes;
 }
 
 static void migration_calculate_complete(MigrationState *s)
@@ -3620,6 +3936,10 @@ static void migration_iteration_finish(MigrationState *s)
     cpu_throttle_stop();
 
     qemu_mutex_lock_iothread();
+    /* Same for the vCPU dirty page rate limits of dirty-limit */
+    if (migrate_dirty_limit()) {
+        dirtylimit_set_migration(0);
+    }
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
@@ -4105,6 +4425,16 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
         return;
     }
 
+    if (migrate_postcopy_preempt() && !migrate_multifd_is_allowed()) {
+        error_setg(&local_err, "postcopy-preempt is not supported by current "
+                   "protocol");
+        error_report_err(local_err);
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        migrate_fd_cleanup(s);
+        return;
+    }
+
     if (multifd_save_setup(&local_err) != 0) {
         error_report_err(local_err);
         migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
@@ -4200,6 +4530,15 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-zstd-level", MigrationState,
                       parameters.multifd_zstd_level,
                       DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_UINT8("dirty-sync-threads", MigrationState,
+                      parameters.dirty_sync_threads,
+                      DEFAULT_MIGRATE_DIRTY_SYNC_THREADS),
+    DEFINE_PROP_UINT64("vcpu-dirty-limit", MigrationState,
+                       parameters.vcpu_dirty_limit,
+                       DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT),
+    DEFINE_PROP_UINT8("mapped-ram-threads", MigrationState,
+                      parameters.mapped_ram_threads,
+                      DEFAULT_MIGRATE_MAPPED_RAM_THREADS),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -4235,8 +4574,22 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+            MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+#ifdef CONFIG_LINUX
+    DEFINE_PROP_MIG_CAP("x-zero-copy-send",
+            MIGRATION_CAPABILITY_ZERO_COPY_SEND),
+#endif
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-dirty-limit",
+            MIGRATION_CAPABILITY_DIRTY_LIMIT),
+    DEFINE_PROP_MIG_CAP("x-postcopy-preempt",
+            MIGRATION_CAPABILITY_POSTCOPY_PREEMPT),
+    DEFINE_PROP_MIG_CAP("x-multifd-postcopy",
+            MIGRATION_CAPABILITY_MULTIFD_POSTCOPY),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram",
+            MIGRATION_CAPABILITY_MAPPED_RAM),
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -4263,6 +4616,7 @@ static void migration_instance_finalize(Object *obj)
     qemu_sem_destroy(&ms->pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_rp_sem);
+    qemu_sem_destroy(&ms->postcopy_qemufile_src_sem);
     qemu_sem_destroy(&ms->rp_state.rp_sem);
     error_free(ms->error);
 }
@@ -4304,9 +4658,13 @@ static void migration_instance_init(Object *obj)
     params->has_announce_max = true;
     params->has_announce_rounds = true;
     params->has_announce_step = true;
+    params->has_dirty_sync_threads = true;
+    params->has_vcpu_dirty_limit = true;
+    params->has_mapped_ram_threads = true;
 
     qemu_sem_init(&ms->postcopy_pause_sem, 0);
     qemu_sem_init(&ms->postcopy_pause_rp_sem, 0);
+    qemu_sem_init(&ms->postcopy_qemufile_src_sem, 0);
     qemu_sem_init(&ms->rp_state.rp_sem, 0);
     qemu_sem_init(&ms->rate_limit_sem, 0);
     qemu_sem_init(&ms->wait_unplug_sem, 0);
@@ -45,6 +45,26 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/*
+ * Postcopy channels: the main migration channel, and the preempt channel
+ * carrying the pages requested by page faults when postcopy-preempt is
+ * enabled.
+ */
+enum {
+    RAM_CHANNEL_PRECOPY = 0,
+    RAM_CHANNEL_POSTCOPY = 1,
+    RAM_CHANNEL_MAX,
+};
+
+/*
+ * Page fault latencies are kept in a log-linear histogram of microseconds:
+ * each power of two is split in 1 << POSTCOPY_LATENCY_SUB_BITS buckets, so
+ * that percentiles are exact to within 1/8th.
+ */
+#define POSTCOPY_LATENCY_SUB_BITS   3
+#define POSTCOPY_LATENCY_BUCKETS    \
+    ((32 - POSTCOPY_LATENCY_SUB_BITS + 1) << POSTCOPY_LATENCY_SUB_BITS)
+
 /* This is an abstraction of a "temp huge page" for postcopy's purpose */
 typedef struct {
     /*
@@ -66,8 +86,8 @@ typedef struct {
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
-    /* Previously received RAM's RAMBlock pointer */
-    RAMBlock *last_recv_block;
+    /* Previously received RAM's RAMBlock pointer, for each channel */
+    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
     /* A hook to allow cleanup at the end of incoming migration */
     void *transport_data;
     void (*transport_cleanup)(void *data);
@@ -119,6 +139,21 @@ struct MigrationIncomingState {
     PostcopyTmpPage *postcopy_tmp_pages;
     /* This is shared for all postcopy channels */
     void     *postcopy_tmp_zero_page;
+    /* The incoming postcopy preempt channel, when enabled */
+    QEMUFile *postcopy_qemufile_dst;
+    /* Posted when postcopy_qemufile_dst is established */
+    QemuSemaphore postcopy_qemufile_dst_done;
+    /* Loads the pages coming from the postcopy preempt channel */
+    QemuThread postcopy_prio_thread;
+    bool postcopy_prio_thread_created;
+    /*
+     * Held by the preempt thread while it reads postcopy_qemufile_dst,
+     * which is only released when postcopy gets interrupted so that
+     * the broken channel can be closed.
+     */
+    QemuMutex postcopy_prio_thread_mutex;
+    /* Notify the paused preempt thread that the channel is back */
+    QemuSemaphore postcopy_pause_sem_fast_load;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
     GArray   *postcopy_remote_fds;
 
@@ -162,6 +197,13 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+
+    /*
+     * Time between a page fault being reported and the page being placed,
+     * for the faults serviced so far.  Protected by page_request_mutex.
+     */
+    uint64_t postcopy_latency_count;
+    uint64_t postcopy_latency_buckets[POSTCOPY_LATENCY_BUCKETS];
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -311,6 +353,14 @@ struct MigrationState {
     /* Needed by postcopy-pause state */
     QemuSemaphore postcopy_pause_sem;
     QemuSemaphore postcopy_pause_rp_sem;
+    /*
+     * The postcopy preempt channel, where the pages requested by the
+     * destination are sent.  Only used by the migration thread, and only
+     * established once postcopy starts.
+     */
+    QEMUFile *postcopy_qemufile_src;
+    /* Posted when the connection of the preempt channel completes */
+    QemuSemaphore postcopy_qemufile_src_sem;
     /*
      * Whether we abort the migration if decompression errors are
      * detected at the destination. It is left at false for qemu
@@ -370,11 +420,24 @@ bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_use_multifd_zero_page(void);
+bool migrate_multifd_postcopy(void);
+bool migrate_mapped_ram(void);
+#ifdef CONFIG_LINUX
+bool migrate_use_zero_copy_send(void);
+#else
+#define migrate_use_zero_copy_send() (false)
+#endif
+bool migrate_use_tls(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
 int migrate_multifd_zstd_level(void);
+int migrate_dirty_sync_threads(void);
+uint64_t migrate_vcpu_dirty_limit(void);
+int migrate_mapped_ram_threads(void);
+bool migrate_dirty_limit(void);
 
 int migrate_use_xbzrle(void);
 uint64_t migrate_xbzrle_cache_size(void);
@@ -394,6 +457,7 @@ int migrate_compress_wait_thread(void);
 int migrate_decompress_threads(void);
 bool migrate_use_events(void);
 bool migrate_postcopy_blocktime(void);
+bool migrate_postcopy_preempt(void);
 bool migrate_background_snapshot(void);
 
 /* Sending on the return path - generic and then for each message type */
@@ -0,0 +1,271 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * lz4 streaming needs the data of the previous block to stay unchanged
+ * at the same address, which guest memory doesn't.  So both sides go
+ * through a pair of staging buffers and alternate between them: the
+ * packet being (de)compressed can then use the previous one as its
+ * dictionary.
+ */
+struct lz4_data {
+    /* stream for compression */
+    LZ4_stream_t *stream;
+    /* stream for decompression */
+    LZ4_streamDecode_t *stream_decode;
+    /* staging buffers holding the uncompressed pages */
+    uint8_t *buf[2];
+    /* staging buffer used by the current packet */
+    int cur;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+static void lz4_data_free(struct lz4_data *z)
+{
+    if (z->stream) {
+        LZ4_freeStream(z->stream);
+    }
+    if (z->stream_decode) {
+        LZ4_freeStreamDecode(z->stream_decode);
+    }
+    g_free(z->buf[0]);
+    g_free(z->buf[1]);
+    g_free(z->zbuff);
+    g_free(z);
+}
+
+static int lz4_data_alloc_buffers(struct lz4_data *z, uint32_t zbuff_len)
+{
+    z->buf[0] = g_try_malloc(MULTIFD_PACKET_SIZE);
+    z->buf[1] = g_try_malloc(MULTIFD_PACKET_SIZE);
+    z->zbuff_len = zbuff_len;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->buf[0] || !z->buf[1] || !z->zbuff) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->stream = LZ4_createStream();
+    if (!z->stream) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: lz4 createStream failed", p->id);
+        return -1;
+    }
+    /* This is the maximum size of the compressed buffer */
+    if (lz4_data_alloc_buffers(z, LZ4_compressBound(MULTIFD_PACKET_SIZE))) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 buffers", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Close the channel and return memory.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    lz4_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare data to be able to send
+ *
+ * Copy all the pages that we are going to send into the staging
+ * buffer and compress them as one block of the channel stream.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+    size_t page_size = qemu_target_page_size();
+    uint8_t *buf = z->buf[z->cur];
+    int ret = 0;
+    uint32_t i;
+
+    if (p->normal_num) {
+        for (i = 0; i < p->normal_num; i++) {
+            memcpy(buf + i * page_size, p->pages->block->host + p->normal[i],
+                   page_size);
+        }
+
+        ret = LZ4_compress_fast_continue(z->stream, (const char *)buf,
+                                         (char *)z->zbuff,
+                                         p->normal_num * page_size,
+                                         z->zbuff_len, 1);
+        if (ret <= 0) {
+            error_setg(errp, "multifd %u: lz4 compression failed", p->id);
+            return -1;
+        }
+        z->cur ^= 1;
+
+        p->iov[p->iovs_num].iov_base = z->zbuff;
+        p->iov[p->iovs_num].iov_len = ret;
+        p->iovs_num++;
+    }
+    p->next_packet_size = ret;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the decompression stream and buffers.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->stream_decode = LZ4_createStreamDecode();
+    if (!z->stream_decode) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: lz4 createStreamDecode failed", p->id);
+        return -1;
+    }
+    if (lz4_data_alloc_buffers(z, LZ4_compressBound(MULTIFD_PACKET_SIZE))) {
+        lz4_data_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 buffers", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: cleanup receive side
+ *
+ * Free the decompression stream and buffers.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    lz4_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, uncompress it into the staging buffer
+ * and copy the pages to their place.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    size_t page_size = qemu_target_page_size();
+    uint32_t expected_size = p->normal_num * page_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->data;
+    uint8_t *buf = z->buf[z->cur];
+    int ret;
+    uint32_t i;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u max %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = LZ4_decompress_safe_continue(z->stream_decode,
+                                       (const char *)z->zbuff, (char *)buf,
+                                       in_size, MULTIFD_PACKET_SIZE);
+    if (ret < 0) {
+        error_setg(errp, "multifd %u: lz4 decompression failed", p->id);
+        return -1;
+    }
+    if (ret != expected_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, ret, expected_size);
+        return -1;
+    }
+    z->cur ^= 1;
+
+    for (i = 0; i < p->normal_num; i++) {
+        memcpy(p->host + p->normal[i], buf + i * page_size, page_size);
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
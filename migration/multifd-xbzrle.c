@@ -0,0 +1,469 @@
+/*
+ * Multifd XBZRLE compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/host-utils.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "ram.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Every normal page of a packet is described by one be32 header word
+ * in front of the page data:
+ *   - MULTIFD_XBZRLE_UNCHANGED: no data, the page didn't change
+ *   - MULTIFD_XBZRLE_RAW: a full page follows
+ *   - anything else: length of the xbzrle encoded data that follows
+ */
+#define MULTIFD_XBZRLE_UNCHANGED 0
+#define MULTIFD_XBZRLE_RAW       UINT32_MAX
+
+/*
+ * The destination applies the xbzrle deltas on top of its current
+ * copy of the page, so the sender must always encode against exactly
+ * what it sent last time for that page, whatever channel sent it.
+ * The cache is therefore shared by all channels, but split in one
+ * partition per channel, selected by page address, each with its own
+ * lock.  A page always lands in the same partition, and channels only
+ * contend when they work on pages of the same partition.
+ */
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} XBZRLEPartition;
+
+static struct {
+    XBZRLEPartition *parts;
+    uint32_t nparts;
+    /* number of channels using the partitions */
+    uint32_t users;
+    /* protects xbzrle_counters, updated once per packet */
+    QemuMutex stats_lock;
+    /* a page full of zeros, for pages sent as zero pages */
+    uint8_t *zero_page;
+} multifd_xbzrle;
+
+struct xbzrle_data {
+    /* page header words */
+    uint32_t *hdr;
+    /* encoded (or raw) page data */
+    uint8_t *buf;
+    /* size of the data buffer */
+    uint32_t buf_len;
+    /* stable copy of the page being encoded */
+    uint8_t *current;
+};
+
+static XBZRLEPartition *xbzrle_partition(ram_addr_t addr)
+{
+    return &multifd_xbzrle.parts[(addr >> qemu_target_page_bits()) %
+                                 multifd_xbzrle.nparts];
+}
+
+static int xbzrle_partitions_init(Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    uint32_t nparts = migrate_multifd_channels();
+    uint64_t part_pages = migrate_xbzrle_cache_size() / page_size / nparts;
+    uint32_t i;
+
+    if (multifd_xbzrle.users++) {
+        return 0;
+    }
+
+    if (!part_pages) {
+        error_setg(errp, "multifd: xbzrle cache size too small for "
+                   "%u channels", nparts);
+        multifd_xbzrle.users--;
+        return -1;
+    }
+    part_pages = pow2floor(part_pages);
+
+    multifd_xbzrle.parts = g_new0(XBZRLEPartition, nparts);
+    multifd_xbzrle.nparts = nparts;
+    for (i = 0; i < nparts; i++) {
+        XBZRLEPartition *part = &multifd_xbzrle.parts[i];
+
+        part->cache = cache_init(part_pages * page_size, page_size, errp);
+        if (!part->cache) {
+            while (i--) {
+                cache_fini(multifd_xbzrle.parts[i].cache);
+                qemu_mutex_destroy(&multifd_xbzrle.parts[i].lock);
+            }
+            g_free(multifd_xbzrle.parts);
+            multifd_xbzrle.parts = NULL;
+            multifd_xbzrle.users--;
+            return -1;
+        }
+        qemu_mutex_init(&part->lock);
+    }
+    qemu_mutex_init(&multifd_xbzrle.stats_lock);
+    multifd_xbzrle.zero_page = g_malloc0(page_size);
+    return 0;
+}
+
+static void xbzrle_partitions_cleanup(void)
+{
+    uint32_t i;
+
+    if (--multifd_xbzrle.users) {
+        return;
+    }
+
+    for (i = 0; i < multifd_xbzrle.nparts; i++) {
+        cache_fini(multifd_xbzrle.parts[i].cache);
+        qemu_mutex_destroy(&multifd_xbzrle.parts[i].lock);
+    }
+    g_free(multifd_xbzrle.parts);
+    multifd_xbzrle.parts = NULL;
+    multifd_xbzrle.nparts = 0;
+    qemu_mutex_destroy(&multifd_xbzrle.stats_lock);
+    g_free(multifd_xbzrle.zero_page);
+    multifd_xbzrle.zero_page = NULL;
+}
+
+/**
+ * multifd_xbzrle_zero_page: insert a zero page in the multifd xbzrle cache
+ *
+ * Pages found to be zero by the migration thread are sent on the main
+ * stream and zeroed on the destination.  Update the cache so that the
+ * next delta for the page is not encoded against its old contents.
+ *
+ * @addr: ram_addr_t of the zero page
+ */
+void multifd_xbzrle_zero_page(ram_addr_t addr)
+{
+    XBZRLEPartition *part;
+
+    if (!multifd_xbzrle.parts) {
+        return;
+    }
+
+    part = xbzrle_partition(addr);
+    WITH_QEMU_LOCK_GUARD(&part->lock) {
+        cache_insert(part->cache, addr, multifd_xbzrle.zero_page,
+                     ram_counters.dirty_sync_count);
+    }
+}
+
+/* Multifd xbzrle compression */
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Setup each channel with its buffers and the shared page cache.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x;
+    size_t page_size = qemu_target_page_size();
+    uint32_t page_count = MULTIFD_PACKET_SIZE / page_size;
+
+    if (xbzrle_partitions_init(errp) < 0) {
+        return -1;
+    }
+
+    x = g_new0(struct xbzrle_data, 1);
+    x->hdr = g_new0(uint32_t, page_count);
+    /* In the worst case every page is sent raw */
+    x->buf_len = MULTIFD_PACKET_SIZE;
+    x->buf = g_try_malloc(x->buf_len);
+    x->current = g_try_malloc(page_size);
+    if (!x->buf || !x->current) {
+        g_free(x->buf);
+        g_free(x->current);
+        g_free(x->hdr);
+        g_free(x);
+        xbzrle_partitions_cleanup();
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffers",
+                   p->id);
+        return -1;
+    }
+    p->data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Release the buffers and our reference on the shared page cache.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+
+    if (!x) {
+        return;
+    }
+    g_free(x->hdr);
+    g_free(x->buf);
+    g_free(x->current);
+    g_free(x);
+    p->data = NULL;
+    xbzrle_partitions_cleanup();
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode every page against the copy in the page cache and create a
+ * buffer with the page headers followed by the encoded data.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+    RAMBlock *block = p->pages->block;
+    size_t page_size = qemu_target_page_size();
+    /* only used to age cache entries, a stale value is harmless */
+    uint64_t generation = ram_counters.dirty_sync_count;
+    uint64_t cache_miss = 0, pages = 0, overflow = 0, bytes = 0;
+    uint32_t out_size = 0;
+    uint32_t i;
+
+    for (i = 0; i < p->normal_num; i++) {
+        ram_addr_t addr = block->offset + p->normal[i];
+        XBZRLEPartition *part = xbzrle_partition(addr);
+        uint8_t *host = block->host + p->normal[i];
+        uint8_t *cached;
+        int encoded_len;
+
+        qemu_mutex_lock(&part->lock);
+        if (!cache_is_cached(part->cache, addr, generation)) {
+            cache_miss++;
+            if (cache_insert(part->cache, addr, host, generation) == 0) {
+                /* send what we cached, the guest may change the page */
+                host = get_cached_data(part->cache, addr);
+            }
+            memcpy(x->buf + out_size, host, page_size);
+            qemu_mutex_unlock(&part->lock);
+            x->hdr[i] = cpu_to_be32(MULTIFD_XBZRLE_RAW);
+            out_size += page_size;
+            continue;
+        }
+
+        pages++;
+        cached = get_cached_data(part->cache, addr);
+        memcpy(x->current, host, page_size);
+        encoded_len = xbzrle_encode_buffer(cached, x->current, page_size,
+                                           x->buf + out_size, page_size);
+        if (encoded_len != 0) {
+            memcpy(cached, x->current, page_size);
+        }
+        qemu_mutex_unlock(&part->lock);
+
+        if (encoded_len == 0) {
+            x->hdr[i] = cpu_to_be32(MULTIFD_XBZRLE_UNCHANGED);
+        } else if (encoded_len < 0) {
+            overflow++;
+            memcpy(x->buf + out_size, x->current, page_size);
+            x->hdr[i] = cpu_to_be32(MULTIFD_XBZRLE_RAW);
+            out_size += page_size;
+            bytes += page_size;
+        } else {
+            x->hdr[i] = cpu_to_be32(encoded_len);
+            out_size += encoded_len;
+            bytes += encoded_len;
+        }
+    }
+
+    /*
+     * Pages sent as zero pages are zeroed on the destination, make
+     * sure that a later delta is not encoded against stale data.
+     */
+    for (i = 0; i < p->zero_num; i++) {
+        ram_addr_t addr = block->offset + p->zero[i];
+        XBZRLEPartition *part = xbzrle_partition(addr);
+
+        WITH_QEMU_LOCK_GUARD(&part->lock) {
+            cache_insert(part->cache, addr, multifd_xbzrle.zero_page,
+                         generation);
+        }
+    }
+
+    WITH_QEMU_LOCK_GUARD(&multifd_xbzrle.stats_lock) {
+        xbzrle_counters.cache_miss += cache_miss;
+        xbzrle_counters.pages += pages;
+        xbzrle_counters.overflow += overflow;
+        xbzrle_counters.bytes += bytes;
+    }
+
+    p->iov[p->iovs_num].iov_base = x->hdr;
+    p->iov[p->iovs_num].iov_len = p->normal_num * sizeof(uint32_t);
+    p->iovs_num++;
+    p->iov[p->iovs_num].iov_base = x->buf;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = p->normal_num * sizeof(uint32_t) + out_size;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    return 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Create the buffers for the page headers and the encoded data.  The
+ * receive side doesn't need a cache, deltas are applied on top of the
+ * guest pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    x->hdr = g_new0(uint32_t, page_count);
+    x->buf_len = MULTIFD_PACKET_SIZE;
+    x->buf = g_try_malloc(x->buf_len);
+    if (!x->buf) {
+        g_free(x->hdr);
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffer",
+                   p->id);
+        return -1;
+    }
+    p->data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * Release the buffers.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->data;
+
+    if (!x) {
+        return;
+    }
+    g_free(x->hdr);
+    g_free(x->buf);
+    g_free(x);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the page headers and the encoded buffer, and apply every page
+ * on top of the current guest page.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+    size_t page_size = qemu_target_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t hdr_size = p->normal_num * sizeof(uint32_t);
+    uint32_t in_size, pos = 0;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (p->next_packet_size < hdr_size ||
+        p->next_packet_size - hdr_size > x->buf_len) {
+        error_setg(errp, "multifd %u: packet size %u out of range",
+                   p->id, p->next_packet_size);
+        return -1;
+    }
+    in_size = p->next_packet_size - hdr_size;
+
+    ret = qio_channel_read_all(p->c, (void *)x->hdr, hdr_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = qio_channel_read_all(p->c, (void *)x->buf, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t len = be32_to_cpu(x->hdr[i]);
+        uint8_t *host = p->host + p->normal[i];
+        bool raw = false;
+
+        if (len == MULTIFD_XBZRLE_UNCHANGED) {
+            continue;
+        }
+        if (len == MULTIFD_XBZRLE_RAW) {
+            raw = true;
+            len = page_size;
+        }
+        if (len > in_size - pos) {
+            error_setg(errp, "multifd %u: xbzrle page %u overruns packet",
+                       p->id, i);
+            return -1;
+        }
+        if (raw) {
+            memcpy(host, x->buf + pos, page_size);
+        } else if (xbzrle_decode_buffer(x->buf + pos, len, host,
+                                        page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode xbzrle page %u",
+                       p->id, i);
+            return -1;
+        }
+        pos += len;
+    }
+
+    if (pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -12,6 +12,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -22,6 +23,7 @@
 #include "socket.h"
 #include "tls.h"
 #include "qemu-file.h"
+#include "postcopy-ram.h"
 #include "trace.h"
 #include "multifd.h"
 
@@ -263,6 +265,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(p->normal_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -276,6 +279,13 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    for (i = 0; i < p->zero_num; i++) {
+        /* there are architectures where ram_addr_t is 32 bit */
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->normal_num + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -324,10 +334,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->normal_num == 0) {
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -341,6 +359,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->host = block->host;
+    p->block = block;
     for (i = 0; i < p->normal_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
@@ -353,6 +372,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (block->used_length - page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
     return 0;
 }
 
@@ -392,6 +423,24 @@ struct {
  * false.
  */
 
+/*
+ * With multifd-zero-page the channel threads decide which pages are
+ * zero, so the page counters can only be updated once a channel has
+ * processed its pages.  Must be called with p->mutex held.
+ */
+static void multifd_send_account_pages(QEMUFile *f, MultiFDSendParams *p)
+{
+    uint64_t transferred = p->unacct_normal_pages * qemu_target_page_size();
+
+    qemu_file_update_transfer(f, transferred);
+    ram_counters.multifd_bytes += transferred;
+    ram_counters.transferred += transferred;
+    ram_counters.normal += p->unacct_normal_pages;
+    ram_counters.duplicate += p->unacct_zero_pages;
+    p->unacct_normal_pages = 0;
+    p->unacct_zero_pages = 0;
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
@@ -433,8 +482,16 @@ static int multifd_send_pages(QEMUFile *f)
     p->packet_num = multifd_send_state->packet_num++;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
-    transferred = ((uint64_t) pages->num) * qemu_target_page_size()
-                + p->packet_len;
+    if (migration_in_postcopy()) {
+        p->flags |= MULTIFD_FLAG_POSTCOPY;
+    }
+    if (migrate_use_multifd_zero_page()) {
+        multifd_send_account_pages(f, p);
+        transferred = p->packet_len;
+    } else {
+        transferred = ((uint64_t) pages->num) * qemu_target_page_size()
+                    + p->packet_len;
+    }
     qemu_file_update_transfer(f, transferred);
     ram_counters.multifd_bytes += transferred;
     ram_counters.transferred += transferred;
@@ -472,6 +529,27 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
     return 1;
 }
 
+/*
+ * Send the packet being filled if it holds the page at @offset of @block.
+ * The dirty bit of a queued page is already clear, so a postcopy request
+ * for it would otherwise wait until the packet happens to fill up.
+ */
+int multifd_flush_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
+{
+    MultiFDPages_t *pages = multifd_send_state->pages;
+    int i;
+
+    if (pages->block != block) {
+        return 0;
+    }
+    for (i = 0; i < pages->num; i++) {
+        if (pages->offset[i] == offset) {
+            return multifd_send_pages(f);
+        }
+    }
+    return 0;
+}
+
 static void multifd_send_terminate_threads(Error *err)
 {
     int i;
@@ -484,7 +562,8 @@ static void multifd_send_terminate_threads(Error *err)
         if (s->state == MIGRATION_STATUS_SETUP ||
             s->state == MIGRATION_STATUS_PRE_SWITCHOVER ||
             s->state == MIGRATION_STATUS_DEVICE ||
-            s->state == MIGRATION_STATUS_ACTIVE) {
+            s->state == MIGRATION_STATUS_ACTIVE ||
+            s->state == MIGRATION_STATUS_POSTCOPY_ACTIVE) {
             migrate_set_state(&s->state, s->state,
                               MIGRATION_STATUS_FAILED);
         }
@@ -553,6 +632,8 @@ void multifd_save_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_send_state->ops->send_cleanup(p, &local_err);
         if (local_err) {
             migrate_set_error(migrate_get_current(), local_err);
@@ -568,19 +649,51 @@ void multifd_save_cleanup(void)
     multifd_send_state = NULL;
 }
 
-void multifd_send_sync_main(QEMUFile *f)
+static int multifd_zero_copy_flush(QIOChannel *c)
+{
+    int ret;
+    Error *err = NULL;
+
+    ret = qio_channel_flush(c, &err);
+    if (ret < 0) {
+        error_report_err(err);
+        return -1;
+    }
+    if (ret == 1) {
+        dirty_sync_missed_zero_copy();
+    }
+
+    return ret;
+}
+
+int multifd_send_sync_main(QEMUFile *f)
 {
     int i;
+    bool flush_zero_copy;
 
     if (!migrate_use_multifd()) {
-        return;
+        return 0;
     }
     if (multifd_send_state->pages->num) {
         if (multifd_send_pages(f) < 0) {
             error_report("%s: multifd_send_pages fail", __func__);
-            return;
+            return -1;
         }
     }
+
+    /*
+     * When using zero-copy, it's necessary to flush the pages before any of
+     * the pages can be sent again, so we'll make sure the new version of the
+     * pages will always arrive _later_ than the old pages.
+     *
+     * Currently we achieve this by flushing the zero-page requested writes
+     * per ram iteration, but in the future we could potentially optimize it
+     * to be less frequent, e.g. only after we finished one whole scanning of
+     * all the dirty bitmaps.
+     */
+
+    flush_zero_copy = migrate_use_zero_copy_send();
+
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
@@ -591,7 +704,7 @@ void multifd_send_sync_main(QEMUFile *f)
         if (p->quit) {
             error_report("%s: channel %d has already quit", __func__, i);
             qemu_mutex_unlock(&p->mutex);
-            return;
+            return -1;
         }
 
         p->packet_num = multifd_send_state->packet_num++;
@@ -608,14 +721,29 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        if (flush_zero_copy && p->c && (multifd_zero_copy_flush(p->c) < 0)) {
+            return -1;
+        }
+
+        if (migrate_use_multifd_zero_page()) {
+            WITH_QEMU_LOCK_GUARD(&p->mutex) {
+                multifd_send_account_pages(f, p);
+            }
+        }
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
+
+    return 0;
 }
 
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
     Error *local_err = NULL;
+    bool use_zero_page = migrate_use_multifd_zero_page();
+    bool use_zero_copy_send = migrate_use_zero_copy_send();
+    size_t page_size = qemu_target_page_size();
     int ret = 0;
 
     trace_multifd_send_thread_start(p->id);
@@ -639,15 +767,25 @@ static void *multifd_send_thread(void *opaque)
         if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
             uint32_t flags = p->flags;
-            p->iovs_num = 1;
+            p->iovs_num = use_zero_copy_send ? 0 : 1;
             p->normal_num = 0;
+            p->zero_num = 0;
 
             for (int i = 0; i < p->pages->num; i++) {
-                p->normal[p->normal_num] = p->pages->offset[i];
+                ram_addr_t offset = p->pages->offset[i];
+
+                if (use_zero_page &&
+                    buffer_is_zero(p->pages->block->host + offset,
+                                   page_size)) {
+                    p->zero[p->zero_num] = offset;
+                    p->zero_num++;
+                    continue;
+                }
+                p->normal[p->normal_num] = offset;
                 p->normal_num++;
             }
 
-            if (p->normal_num) {
+            if (p->normal_num || p->zero_num) {
                 ret = multifd_send_state->ops->send_prepare(p, &local_err);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
@@ -658,18 +796,31 @@ static void *multifd_send_thread(void *opaque)
             p->flags = 0;
             p->num_packets++;
             p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
+            p->unacct_normal_pages += p->normal_num;
+            p->unacct_zero_pages += p->zero_num;
             p->pages->num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, p->normal_num, flags,
-                               p->next_packet_size);
+            trace_multifd_send(p->id, packet_num, p->normal_num, p->zero_num,
+                               flags, p->next_packet_size);
 
-            p->iov[0].iov_len = p->packet_len;
-            p->iov[0].iov_base = p->packet;
+            if (use_zero_copy_send) {
+                /* Send header first, without zerocopy */
+                ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                            p->packet_len, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            } else {
+                /* Send header using the same writev call */
+                p->iov[0].iov_len = p->packet_len;
+                p->iov[0].iov_base = p->packet;
+            }
 
-            ret = qio_channel_writev_all(p->c, p->iov, p->iovs_num,
-                                         &local_err);
+            ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num, NULL,
+                                              0, p->write_flags, &local_err);
             if (ret != 0) {
                 break;
             }
@@ -712,7 +863,8 @@ out:
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -845,6 +997,13 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     if (qio_task_propagate_error(task, &local_err)) {
         goto cleanup;
     } else {
+        if (migrate_use_zero_copy_send() &&
+            !qio_channel_has_feature(QIO_CHANNEL(sioc),
+                                     QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+            error_setg(&local_err, "multifd %d: zero copy send is not "
+                       "supported by the host", p->id);
+            goto cleanup;
+        }
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
         p->running = true;
@@ -913,6 +1072,14 @@ int multifd_save_setup(Error **errp)
         /* We need one extra place for the packet header */
         p->iov = g_new0(struct iovec, page_count + 1);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
+
+        if (migrate_use_zero_copy_send()) {
+            p->write_flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+        } else {
+            p->write_flags = 0;
+        }
+
         socket_send_channel_create(multifd_new_send_channel_async, p);
     }
 
@@ -938,6 +1105,8 @@ struct {
     QemuSemaphore sem_sync;
     /* global number of generated multifd packets */
     uint64_t packet_num;
+    /* set once the guest RAM is registered for postcopy */
+    QemuEvent postcopy_listen;
     /* multifd ops */
     MultiFDMethods *ops;
 } *multifd_recv_state;
@@ -974,6 +1143,8 @@ static void multifd_recv_terminate_threads(Error *err)
         }
         qemu_mutex_unlock(&p->mutex);
     }
+    /* Channels waiting to place postcopy pages must notice they quit */
+    qemu_event_set(&multifd_recv_state->postcopy_listen);
 }
 
 int multifd_load_cleanup(Error **errp)
@@ -1014,9 +1185,16 @@ int multifd_load_cleanup(Error **errp)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
+        qemu_vfree(p->postcopy_buf);
+        p->postcopy_buf = NULL;
+        g_free(p->postcopy_buf_offset);
+        p->postcopy_buf_offset = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_event_destroy(&multifd_recv_state->postcopy_listen);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -1052,10 +1230,103 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/*
+ * Called once postcopy_ram_incoming_setup() has registered the guest RAM
+ * with userfaultfd: from then on the pages can be placed.
+ */
+void multifd_recv_postcopy_listen(void)
+{
+    if (!migrate_use_multifd()) {
+        return;
+    }
+    qemu_event_set(&multifd_recv_state->postcopy_listen);
+}
+
+/**
+ * multifd_recv_postcopy_pages: read the pages of a postcopy packet
+ *
+ * Once postcopy runs, the guest RAM is registered with userfaultfd and
+ * each page has to be placed atomically, which also wakes up the vCPUs
+ * faulting on it.  So the pages are read into a staging buffer first,
+ * then placed with UFFDIO_COPY, or UFFDIO_ZEROPAGE for the zero pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_recv_postcopy_pages(MultiFDRecvParams *p, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    size_t page_size = qemu_target_page_size();
+    ram_addr_t *normal = p->normal;
+    RAMBlock *block = p->block;
+    int i, ret;
+
+    if (!p->postcopy_buf) {
+        error_setg(errp, "multifd %u: received postcopy pages without "
+                   "multifd-postcopy", p->id);
+        return -1;
+    }
+    if ((p->normal_num || p->zero_num) &&
+        qemu_ram_pagesize(block) != page_size) {
+        error_setg(errp, "multifd %u: postcopy pages of ram block %s "
+                   "don't match its host page size", p->id, block->idstr);
+        return -1;
+    }
+
+    qemu_event_wait(&multifd_recv_state->postcopy_listen);
+    if (p->quit) {
+        return 0;
+    }
+
+    if (p->normal_num) {
+        /* Have the method read the pages into the staging buffer */
+        p->host = p->postcopy_buf;
+        p->normal = p->postcopy_buf_offset;
+        ret = multifd_recv_state->ops->recv_pages(p, errp);
+        p->host = block->host;
+        p->normal = normal;
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    /*
+     * A page can already be there when it was sent again after a postcopy
+     * recovery; placing it twice would fail with EEXIST.
+     */
+    for (i = 0; i < p->normal_num; i++) {
+        if (ramblock_recv_bitmap_test_byte_offset(block, normal[i])) {
+            continue;
+        }
+        ret = postcopy_place_page(mis, block->host + normal[i],
+                                  p->postcopy_buf + i * page_size, block);
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %u: failed to place page",
+                             p->id);
+            return -1;
+        }
+    }
+    for (i = 0; i < p->zero_num; i++) {
+        if (ramblock_recv_bitmap_test_byte_offset(block, p->zero[i])) {
+            continue;
+        }
+        ret = postcopy_place_page_zero(mis, block->host + p->zero[i], block);
+        if (ret) {
+            error_setg_errno(errp, -ret,
+                             "multifd %u: failed to place zero page", p->id);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
     Error *local_err = NULL;
+    size_t page_size = qemu_target_page_size();
     int ret;
 
     trace_multifd_recv_thread_start(p->id);
@@ -1085,19 +1356,31 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         flags = p->flags;
-        /* recv methods don't know how to handle the SYNC flag */
-        p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, p->normal_num, flags,
-                           p->next_packet_size);
+        /* recv methods don't know how to handle the SYNC and POSTCOPY flags */
+        p->flags &= ~(MULTIFD_FLAG_SYNC | MULTIFD_FLAG_POSTCOPY);
+        trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                           flags, p->next_packet_size);
         p->num_packets++;
         p->total_normal_pages += p->normal_num;
+        p->total_zero_pages += p->zero_num;
         qemu_mutex_unlock(&p->mutex);
 
-        if (p->normal_num) {
-            ret = multifd_recv_state->ops->recv_pages(p, &local_err);
+        if (flags & MULTIFD_FLAG_POSTCOPY) {
+            ret = multifd_recv_postcopy_pages(p, &local_err);
             if (ret != 0) {
                 break;
             }
+        } else {
+            if (p->normal_num) {
+                ret = multifd_recv_state->ops->recv_pages(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            }
+
+            for (int i = 0; i < p->zero_num; i++) {
+                ram_handle_compressed(p->host + p->zero[i], 0, page_size);
+            }
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
@@ -1115,7 +1398,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1138,6 +1422,7 @@ int multifd_load_setup(Error **errp)
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     qatomic_set(&multifd_recv_state->count, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    qemu_event_init(&multifd_recv_state->postcopy_listen, false);
     multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
@@ -1153,6 +1438,15 @@ int multifd_load_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
+        if (migrate_multifd_postcopy()) {
+            p->postcopy_buf = qemu_memalign(qemu_real_host_page_size,
+                                            MULTIFD_PACKET_SIZE);
+            p->postcopy_buf_offset = g_new0(ram_addr_t, page_count);
+            for (uint32_t j = 0; j < page_count; j++) {
+                p->postcopy_buf_offset[j] = j * qemu_target_page_size();
+            }
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
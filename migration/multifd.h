@@ -22,8 +22,11 @@ int multifd_load_cleanup(Error **errp);
 bool multifd_recv_all_channels_created(void);
 bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
-void multifd_send_sync_main(QEMUFile *f);
+int multifd_send_sync_main(QEMUFile *f);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+int multifd_flush_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+void multifd_recv_postcopy_listen(void);
+void multifd_xbzrle_zero_page(ram_addr_t addr);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -34,6 +37,11 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
+#define MULTIFD_FLAG_LZ4 (4 << 1)
+
+/* The pages were sent during postcopy, and must be placed atomically */
+#define MULTIFD_FLAG_POSTCOPY (1 << 4)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -49,7 +57,10 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* zero pages, their offsets follow the normal ones */
+    uint32_t zero_pages;
+    uint32_t unused32[1];    /* Reserved for future use */
+    uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -88,6 +99,8 @@ typedef struct {
     bool quit;
     /* is the yank function registered */
     bool registered_yank;
+    /* multifd flags for sending ram */
+    int write_flags;
     /* thread has work to do */
     int pending_job;
     /* array of pages to sent */
@@ -107,6 +120,12 @@ typedef struct {
     uint64_t num_packets;
     /* non zero pages sent through this channel */
     uint64_t total_normal_pages;
+    /* zero pages sent through this channel */
+    uint64_t total_zero_pages;
+    /* non zero pages not yet accounted in ram_counters */
+    uint64_t unacct_normal_pages;
+    /* zero pages not yet accounted in ram_counters */
+    uint64_t unacct_zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* buffers to send */
@@ -117,6 +136,10 @@ typedef struct {
     ram_addr_t *normal;
     /* num of non zero pages */
     uint32_t normal_num;
+    /* Pages that are zero */
+    ram_addr_t *zero;
+    /* num of zero pages */
+    uint32_t zero_num;
     /* used for compression methods */
     void *data;
 }  MultiFDSendParams;
@@ -139,6 +162,8 @@ typedef struct {
     bool quit;
     /* ramblock host address */
     uint8_t *host;
+    /* ramblock of the pages */
+    RAMBlock *block;
     /* packet allocated len */
     uint32_t packet_len;
     /* pointer to the packet */
@@ -154,6 +179,8 @@ typedef struct {
     uint64_t num_packets;
     /* non zero pages recv through this channel */
     uint64_t total_normal_pages;
+    /* zero pages recv through this channel */
+    uint64_t total_zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* buffers to recv */
@@ -162,6 +189,14 @@ typedef struct {
     ram_addr_t *normal;
     /* num of non zero pages */
     uint32_t normal_num;
+    /* Pages that are zero */
+    ram_addr_t *zero;
+    /* num of zero pages */
+    uint32_t zero_num;
+    /* buffer where postcopy pages are received before being placed */
+    uint8_t *postcopy_buf;
+    /* offset of each page in postcopy_buf */
+    ram_addr_t *postcopy_buf_offset;
     /* used for de-compression methods */
     void *data;
 } MultiFDRecvParams;
@@ -19,9 +19,12 @@
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
 #include "qemu/madvise.h"
+#include "qemu/host-utils.h"
+#include "qemu/lockable.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
+#include "qemu-file-channel.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
 #include "ram.h"
@@ -33,6 +36,8 @@
 #include "trace.h"
 #include "hw/boards.h"
 #include "exec/ramblock.h"
+#include "socket.h"
+#include "yank_functions.h"
 
 /* Arbitrary limit on size of each discard command,
  * keeps them around ~200 bytes
@@ -172,10 +177,63 @@ static uint32List *get_vcpu_blocktime_list(PostcopyBlocktimeContext *ctx)
     return list;
 }
 
+static unsigned int postcopy_latency_bucket(uint32_t latency_us)
+{
+    int shift;
+
+    if (latency_us < (1 << POSTCOPY_LATENCY_SUB_BITS)) {
+        return latency_us;
+    }
+
+    shift = 31 - clz32(latency_us) - POSTCOPY_LATENCY_SUB_BITS;
+    return ((shift + 1) << POSTCOPY_LATENCY_SUB_BITS) +
+           ((latency_us >> shift) & ((1 << POSTCOPY_LATENCY_SUB_BITS) - 1));
+}
+
+/* Largest latency that falls in bucket @index */
+static uint64_t postcopy_latency_bucket_max(unsigned int index)
+{
+    unsigned int sub = index & ((1 << POSTCOPY_LATENCY_SUB_BITS) - 1);
+    int shift;
+
+    if (index < (1 << POSTCOPY_LATENCY_SUB_BITS)) {
+        return index;
+    }
+
+    shift = (index >> POSTCOPY_LATENCY_SUB_BITS) - 1;
+    return ((uint64_t)((1 << POSTCOPY_LATENCY_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+/* Must be called with page_request_mutex held */
+static void postcopy_latency_record(MigrationIncomingState *mis,
+                                    uint32_t latency_us)
+{
+    mis->postcopy_latency_buckets[postcopy_latency_bucket(latency_us)]++;
+    mis->postcopy_latency_count++;
+}
+
+/* Must be called with page_request_mutex held, and a latency recorded */
+static uint64_t postcopy_latency_percentile(MigrationIncomingState *mis,
+                                            unsigned int percent)
+{
+    uint64_t rank = DIV_ROUND_UP(mis->postcopy_latency_count * percent, 100);
+    uint64_t seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < POSTCOPY_LATENCY_BUCKETS - 1; i++) {
+        seen += mis->postcopy_latency_buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    return postcopy_latency_bucket_max(i);
+}
+
 /*
  * This function just populates MigrationInfo from postcopy's
- * blocktime context. It will not populate MigrationInfo,
- * unless postcopy-blocktime capability was set.
+ * fault latency statistics and blocktime context.  The blocktime
+ * is only populated if postcopy-blocktime capability was set.
  *
  * @info: pointer to MigrationInfo to populate
  */
@@ -184,6 +242,15 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
     MigrationIncomingState *mis = migration_incoming_get_current();
     PostcopyBlocktimeContext *bc = mis->blocktime_ctx;
 
+    WITH_QEMU_LOCK_GUARD(&mis->page_request_mutex) {
+        if (mis->postcopy_latency_count) {
+            info->has_postcopy_latency_p50 = true;
+            info->postcopy_latency_p50 = postcopy_latency_percentile(mis, 50);
+            info->has_postcopy_latency_p99 = true;
+            info->postcopy_latency_p99 = postcopy_latency_percentile(mis, 99);
+        }
+    }
+
     if (!bc) {
         return;
     }
@@ -567,6 +634,18 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    if (mis->postcopy_prio_thread_created) {
+        /*
+         * The preempt thread quits when the source ends the preempt
+         * channel at the end of postcopy.  A failed postcopy exits QEMU
+         * right after this, so don't wait for a channel that may never end.
+         */
+        if (mis->state != MIGRATION_STATUS_FAILED) {
+            qemu_thread_join(&mis->postcopy_prio_thread);
+        }
+        mis->postcopy_prio_thread_created = false;
+    }
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -891,6 +970,54 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
                                       affected_cpu);
 }
 
+static void postcopy_pause_ram_fast_load(MigrationIncomingState *mis)
+{
+    trace_postcopy_pause_fast_load();
+    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+    qemu_sem_wait(&mis->postcopy_pause_sem_fast_load);
+    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
+    trace_postcopy_pause_fast_load_continued();
+}
+
+/*
+ * Load the pages sent on the postcopy preempt channel, which are the ones
+ * the page faults asked for.  The source ends the channel with an EOS.
+ */
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    int ret;
+
+    trace_postcopy_preempt_thread_entry();
+    rcu_register_thread();
+    qemu_sem_post(&mis->thread_sync_sem);
+
+    /* The source connects the channel asynchronously, wait for it */
+    qemu_sem_wait(&mis->postcopy_qemufile_dst_done);
+
+    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
+    while (true) {
+        /*
+         * RAMBlocks are looked up under RCU, as in ram_load().  Leave the
+         * critical section while paused, so that RCU can make progress.
+         */
+        WITH_RCU_READ_LOCK_GUARD() {
+            ret = ram_load_postcopy(mis->postcopy_qemufile_dst,
+                                    RAM_CHANNEL_POSTCOPY);
+        }
+        if (!ret) {
+            break;
+        }
+        /* The channel broke, wait for postcopy recovery to replace it */
+        postcopy_pause_ram_fast_load(mis);
+    }
+    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+
+    rcu_unregister_thread();
+    trace_postcopy_preempt_thread_exit();
+    return NULL;
+}
+
 static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 {
     trace_postcopy_pause_fault_thread();
@@ -1102,8 +1229,8 @@ static int postcopy_temp_pages_setup(MigrationIncomingState *mis)
     int err, i, channels;
     void *temp_page;
 
-    /* TODO: will be boosted when enable postcopy preemption */
-    mis->postcopy_channels = 1;
+    /* The preempt channel needs its own temp page */
+    mis->postcopy_channels = migrate_postcopy_preempt() ? RAM_CHANNEL_MAX : 1;
 
     channels = mis->postcopy_channels;
     mis->postcopy_tmp_pages = g_malloc0_n(sizeof(PostcopyTmpPage), channels);
@@ -1185,6 +1312,14 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
         return -1;
     }
 
+    if (migrate_postcopy_preempt()) {
+        /* This uses the RAM_CHANNEL_POSTCOPY temp page set up above */
+        postcopy_thread_create(mis, &mis->postcopy_prio_thread,
+                               "postcopy/preempt", postcopy_preempt_thread,
+                               QEMU_THREAD_JOINABLE);
+        mis->postcopy_prio_thread_created = true;
+    }
+
     trace_postcopy_ram_enable_notify();
 
     return 0;
@@ -1211,17 +1346,23 @@ static int qemu_ufd_copy_ioctl(MigrationIncomingState *mis, void *host_addr,
         ret = ioctl(userfault_fd, UFFDIO_ZEROPAGE, &zero_struct);
     }
     if (!ret) {
+        uint32_t request_us;
+
         qemu_mutex_lock(&mis->page_request_mutex);
         ramblock_recv_bitmap_set_range(rb, host_addr,
                                        pagesize / qemu_target_page_size());
         /*
          * If this page resolves a page fault for a previous recorded faulted
-         * address, take a special note to maintain the requested page list.
+         * address, take a special note to maintain the requested page list,
+         * and account for how long the fault took to service.
          */
-        if (g_tree_lookup(mis->page_requested, host_addr)) {
+        request_us = (uintptr_t)g_tree_lookup(mis->page_requested, host_addr);
+        if (request_us) {
             g_tree_remove(mis->page_requested, host_addr);
             mis->page_requested_count--;
             trace_postcopy_page_req_del(host_addr, mis->page_requested_count);
+            postcopy_latency_record(mis,
+                (uint32_t)qemu_clock_get_us(QEMU_CLOCK_REALTIME) - request_us);
         }
         qemu_mutex_unlock(&mis->page_request_mutex);
         mark_postcopy_blocktime_end((uintptr_t)host_addr);
@@ -1368,6 +1509,50 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
 #endif
 
 /* ------------------------------------------------------------------------- */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file)
+{
+    /* The preempt thread doesn't run in a coroutine, so it must block */
+    qemu_file_set_blocking(file, true);
+    mis->postcopy_qemufile_dst = file;
+    /* A new channel doesn't continue the RAMBlock of the previous one */
+    mis->last_recv_block[RAM_CHANNEL_POSTCOPY] = NULL;
+    trace_postcopy_preempt_new_channel();
+    qemu_sem_post(&mis->postcopy_qemufile_dst_done);
+}
+
+static void postcopy_preempt_send_channel_new(QIOTask *task, gpointer opaque)
+{
+    MigrationState *s = opaque;
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *local_err = NULL;
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        migrate_set_error(s, local_err);
+        error_free(local_err);
+    } else {
+        migration_ioc_register_yank(ioc);
+        s->postcopy_qemufile_src = qemu_fopen_channel_output(ioc);
+        trace_postcopy_preempt_new_channel();
+    }
+    object_unref(OBJECT(ioc));
+
+    /* The waiter checks postcopy_qemufile_src to know whether it failed */
+    qemu_sem_post(&s->postcopy_qemufile_src_sem);
+}
+
+int postcopy_preempt_establish_channel(MigrationState *s)
+{
+    if (!migrate_postcopy_preempt()) {
+        return 0;
+    }
+
+    /* The connection completes in the main loop */
+    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+
+    return s->postcopy_qemufile_src ? 0 : -1;
+}
+
 void postcopy_temp_page_reset(PostcopyTmpPage *tmp_page)
 {
     tmp_page->target_pages = 0;
@@ -106,6 +106,14 @@ PostcopyState postcopy_state_set(PostcopyState new_state);
 
 void postcopy_fault_thread_notify(MigrationIncomingState *mis);
 
+/*
+ * Connect the postcopy preempt channel from the source, and wait for it.
+ * Returns 0 on success or if postcopy-preempt is disabled.
+ */
+int postcopy_preempt_establish_channel(MigrationState *s);
+/* The destination got the postcopy preempt channel */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file);
+
 /*
  * To be called once at the start before any device initialisation
  */
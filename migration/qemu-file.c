@@ -867,3 +867,62 @@ QIOChannel *qemu_file_get_ioc(QEMUFile *file)
 {
     return file->has_ioc ? QIO_CHANNEL(file->opaque) : NULL;
 }
+
+/*
+ * Return the position in the underlying seekable channel that the next
+ * qemu_put_* or qemu_get_* call will use, or -1 on error.
+ *
+ * Unlike qemu_ftell(), this is the real offset in the channel, which
+ * qemu_set_offset() may have moved; qemu_ftell() only counts the bytes
+ * that went through the file.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    Error *local_err = NULL;
+    off_t ret;
+
+    if (!ioc) {
+        qemu_file_set_error(f, -EINVAL);
+        return -1;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    }
+    ret = qio_channel_io_seek(ioc, 0, SEEK_CUR, &local_err);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EINVAL, local_err);
+        return -1;
+    }
+    /* Data was read ahead into the buffer, but hasn't been consumed */
+    return ret - (f->buf_size - f->buf_index);
+}
+
+/*
+ * Move the position in the underlying seekable channel, e.g. to skip
+ * a region that is accessed at fixed offsets instead of through the
+ * file.  Pending output is flushed and buffered input dropped first.
+ *
+ * Returns 0 on success or a negative errno, also set as file error.
+ */
+int qemu_set_offset(QEMUFile *f, off_t offset)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    Error *local_err = NULL;
+
+    if (!ioc) {
+        qemu_file_set_error(f, -EINVAL);
+        return -EINVAL;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+    if (qio_channel_io_seek(ioc, offset, SEEK_SET, &local_err) < 0) {
+        qemu_file_set_error_obj(f, -EINVAL, local_err);
+        return -EINVAL;
+    }
+    return qemu_file_get_error(f);
+}
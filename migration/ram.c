@@ -52,6 +52,7 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
@@ -305,6 +306,8 @@ struct RAMState {
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
     RAMBlock *last_sent_block;
+    /* Same as last_sent_block, for the postcopy preempt channel */
+    RAMBlock *postcopy_last_sent_block;
     /* Last dirty target page we have sent */
     ram_addr_t last_page;
     /* last ram version we have seen */
@@ -362,6 +365,16 @@ static bool postcopy_has_request(RAMState *rs)
     return !QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests);
 }
 
+/*
+ * Whether requested pages go through the postcopy preempt channel, which
+ * only exists once postcopy has started.
+ */
+static bool postcopy_preempt_active(void)
+{
+    return migrate_postcopy_preempt() &&
+           migrate_get_current()->postcopy_qemufile_src;
+}
+
 void precopy_infrastructure_init(void)
 {
     notifier_with_return_list_init(&precopy_notifier_list);
@@ -394,6 +407,11 @@ uint64_t ram_bytes_remaining(void)
 
 MigrationStats ram_counters;
 
+void dirty_sync_missed_zero_copy(void)
+{
+    ram_counters.dirty_sync_missed_zero_copy++;
+}
+
 static void ram_transferred_add(uint64_t bytes)
 {
     if (runstate_is_running()) {
@@ -414,6 +432,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* Whether the page was requested by the destination */
+    bool         postcopy_requested;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -1003,6 +1023,181 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Parallel dirty bitmap sync.  RAMBlocks are split into chunks that the
+ * migration thread and a pool of dirty-sync-threads - 1 workers pick up
+ * in any order.  The chunk size is a multiple of the pages covered by a
+ * bitmap word, so no two chunks ever touch the same word of the bitmaps.
+ */
+#define DIRTY_SYNC_CHUNK_SIZE (256ULL << 20)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} DirtySyncChunk;
+
+typedef struct {
+    QemuThread thread;
+    /* pages found dirty by this worker during the last pass */
+    uint64_t new_dirty_pages;
+} DirtySyncWorker;
+
+typedef struct {
+    DirtySyncWorker *workers;
+    int num_workers;
+    /* posted once per worker to start a pass or to make it quit */
+    QemuSemaphore sem_start;
+    /* posted by every worker when it is done with a pass */
+    QemuSemaphore sem_done;
+    bool quit;
+    /* chunks of the current pass, and index of the next one to sync */
+    GArray *chunks;
+    unsigned int next_chunk;
+} DirtySyncState;
+
+static DirtySyncState *dirty_sync_state;
+
+/* Called with RCU critical section */
+static uint64_t dirty_sync_run_chunks(DirtySyncState *ds)
+{
+    uint64_t new_dirty_pages = 0;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&ds->next_chunk)) < ds->chunks->len) {
+        DirtySyncChunk *chunk = &g_array_index(ds->chunks, DirtySyncChunk, i);
+
+        new_dirty_pages += cpu_physical_memory_sync_dirty_bitmap(chunk->block,
+                                                                 chunk->start,
+                                                                 chunk->length);
+    }
+    return new_dirty_pages;
+}
+
+static void *dirty_sync_thread(void *opaque)
+{
+    DirtySyncWorker *worker = opaque;
+    DirtySyncState *ds = dirty_sync_state;
+
+    rcu_register_thread();
+    while (true) {
+        qemu_sem_wait(&ds->sem_start);
+        if (qatomic_read(&ds->quit)) {
+            break;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            worker->new_dirty_pages = dirty_sync_run_chunks(ds);
+        }
+        qemu_sem_post(&ds->sem_done);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+static void dirty_sync_threads_cleanup(void)
+{
+    DirtySyncState *ds = dirty_sync_state;
+    int i;
+
+    if (!ds) {
+        return;
+    }
+
+    qatomic_set(&ds->quit, true);
+    for (i = 0; i < ds->num_workers; i++) {
+        qemu_sem_post(&ds->sem_start);
+    }
+    for (i = 0; i < ds->num_workers; i++) {
+        qemu_thread_join(&ds->workers[i].thread);
+    }
+    qemu_sem_destroy(&ds->sem_start);
+    qemu_sem_destroy(&ds->sem_done);
+    g_array_free(ds->chunks, true);
+    g_free(ds->workers);
+    g_free(ds);
+    dirty_sync_state = NULL;
+}
+
+static void dirty_sync_threads_setup(void)
+{
+    int thread_count = migrate_dirty_sync_threads() - 1;
+    DirtySyncState *ds;
+    int i;
+
+    if (thread_count <= 0) {
+        return;
+    }
+
+    ds = g_new0(DirtySyncState, 1);
+    ds->workers = g_new0(DirtySyncWorker, thread_count);
+    ds->num_workers = thread_count;
+    ds->chunks = g_array_new(false, false, sizeof(DirtySyncChunk));
+    qemu_sem_init(&ds->sem_start, 0);
+    qemu_sem_init(&ds->sem_done, 0);
+    dirty_sync_state = ds;
+
+    for (i = 0; i < thread_count; i++) {
+        qemu_thread_create(&ds->workers[i].thread, "dirtysync",
+                           dirty_sync_thread, &ds->workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+/*
+ * Only blocks whose offset and size are multiples of the pages covered
+ * by a bitmap word take the lockless fast path of
+ * cpu_physical_memory_sync_dirty_bitmap(); the others have to be synced
+ * by the migration thread alone.
+ */
+static bool ramblock_sync_dirty_bitmap_can_split(RAMBlock *rb)
+{
+    ram_addr_t word_size = (ram_addr_t)BITS_PER_LONG << TARGET_PAGE_BITS;
+
+    return !(rb->offset & (word_size - 1)) &&
+           !(rb->used_length & (word_size - 1));
+}
+
+/* Called with RCU critical section */
+static void ramblock_sync_dirty_bitmap_parallel(RAMState *rs)
+{
+    DirtySyncState *ds = dirty_sync_state;
+    uint64_t new_dirty_pages;
+    RAMBlock *block;
+    int i;
+
+    g_array_set_size(ds->chunks, 0);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        DirtySyncChunk chunk = { .block = block };
+
+        if (!ramblock_sync_dirty_bitmap_can_split(block)) {
+            ramblock_sync_dirty_bitmap(rs, block);
+            continue;
+        }
+        for (chunk.start = 0; chunk.start < block->used_length;
+             chunk.start += DIRTY_SYNC_CHUNK_SIZE) {
+            chunk.length = MIN(DIRTY_SYNC_CHUNK_SIZE,
+                               block->used_length - chunk.start);
+            g_array_append_val(ds->chunks, chunk);
+        }
+    }
+
+    ds->next_chunk = 0;
+    for (i = 0; i < ds->num_workers; i++) {
+        qemu_sem_post(&ds->sem_start);
+    }
+    new_dirty_pages = dirty_sync_run_chunks(ds);
+    for (i = 0; i < ds->num_workers; i++) {
+        qemu_sem_wait(&ds->sem_done);
+    }
+    for (i = 0; i < ds->num_workers; i++) {
+        new_dirty_pages += ds->workers[i].new_dirty_pages;
+    }
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1094,7 +1289,8 @@ static void migration_trigger_throttle(RAMState *rs)
     /* During block migration the auto-converge logic incorrectly detects
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
-    if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+    if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+        !blk_mig_bulk_active()) {
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -1105,8 +1301,17 @@ static void migration_trigger_throttle(RAMState *rs)
             (++rs->dirty_rate_high_cnt >= 2)) {
             trace_migration_throttle();
             rs->dirty_rate_high_cnt = 0;
-            mig_throttle_guest_down(bytes_dirty_period,
-                                    bytes_dirty_threshold);
+            if (migrate_dirty_limit()) {
+                /*
+                 * Only the vCPUs dirtying memory faster than the limit
+                 * get slowed down, instead of the whole guest.
+                 */
+                trace_migration_dirty_limit_guest(migrate_vcpu_dirty_limit());
+                dirtylimit_set_migration(migrate_vcpu_dirty_limit());
+            } else {
+                mig_throttle_guest_down(bytes_dirty_period,
+                                        bytes_dirty_threshold);
+            }
         }
     }
 }
@@ -1114,6 +1319,7 @@ static void migration_trigger_throttle(RAMState *rs)
 static void migration_bitmap_sync(RAMState *rs)
 {
     RAMBlock *block;
+    int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int64_t end_time;
 
     ram_counters.dirty_sync_count++;
@@ -1127,8 +1333,12 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (dirty_sync_state) {
+            ramblock_sync_dirty_bitmap_parallel(rs);
+        } else {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
         }
         ram_counters.remaining = ram_bytes_remaining();
     }
@@ -1137,6 +1347,12 @@ static void migration_bitmap_sync(RAMState *rs)
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
+    ram_counters.dirty_sync_latency =
+        qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    ram_counters.dirty_sync_latency_max =
+        MAX(ram_counters.dirty_sync_latency_max,
+            ram_counters.dirty_sync_latency);
+
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     /* more than 1 second = 1000 millisecons */
@@ -1351,7 +1567,10 @@ static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
     if (multifd_queue_page(rs->f, block, offset) < 0) {
         return -1;
     }
-    ram_counters.normal++;
+    /* with multifd-zero-page the channels do the accounting */
+    if (!migrate_use_multifd_zero_page()) {
+        ram_counters.normal++;
+    }
 
     return 1;
 }
@@ -1958,6 +2177,15 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
     ram_addr_t offset;
 
     block = unqueue_page(rs, &offset);
+    pss->postcopy_requested = !!block;
+
+    if (block && migrate_multifd_postcopy()) {
+        /*
+         * The page may wait in a multifd packet, and then is not dirty
+         * anymore.  Errors make the migration fail in multifd itself.
+         */
+        multifd_flush_page(rs->f, block, offset);
+    }
 
     if (!block) {
         /*
@@ -2091,6 +2319,31 @@ static bool save_page_use_compression(RAMState *rs)
     return true;
 }
 
+/*
+ * Do not use multifd for:
+ * 1. Compression as the first page in the new block should be posted out
+ *    before sending the compressed page
+ * 2. In postcopy, unless multifd-postcopy is enabled, and then still not:
+ *    a. for the pages requested by the destination, which mustn't wait
+ *       for a multifd packet to fill up
+ *    b. when host pages span several target pages, because one whole host
+ *       page should be placed at once, and a packet may end in its middle
+ *    c. with xbzrle compression, whose deltas need the previous contents
+ *       of the page, which the destination discarded
+ */
+static bool save_page_use_multifd(RAMState *rs, PageSearchStatus *pss)
+{
+    if (save_page_use_compression(rs) || !migrate_use_multifd()) {
+        return false;
+    }
+    if (!migration_in_postcopy()) {
+        return true;
+    }
+    return migrate_multifd_postcopy() && !pss->postcopy_requested &&
+        qemu_ram_pagesize(pss->block) == TARGET_PAGE_SIZE &&
+        migrate_multifd_compression() != MULTIFD_COMPRESSION_XBZRLE;
+}
+
 /*
  * try to compress the page before posting it out, return true if the page
  * has been properly handled by compression, otherwise needs other
@@ -2125,6 +2378,136 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
     return false;
 }
 
+/*
+ * With the mapped-ram capability, the pages of each RAM block are not
+ * sent through the stream, but written at a fixed place in the
+ * migration file.  The stream carries, after the idstr and length of
+ * each block in the RAM_SAVE_FLAG_MEM_SIZE list, a MappedRamHeader
+ * locating the rest of the block's region:
+ *
+ *   | header | bitmap | padding | pages ... | (stream continues)
+ *
+ * The bitmap, written at the end of the migration, has a bit set for
+ * every page that holds data; zero pages are left as holes in the file.
+ * Pages are aligned so that the destination can read large runs of
+ * them straight into guest memory.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+typedef struct {
+    uint32_t version;
+    uint64_t page_size;
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
+} QEMU_PACKED MappedRamHeader;
+
+/* The bitmap is stored as little-endian 64 bit words */
+static uint64_t mapped_ram_bitmap_size(RAMBlock *block)
+{
+    return DIV_ROUND_UP(block->used_length >> TARGET_PAGE_BITS, 64) * 8;
+}
+
+static int mapped_ram_save_header(QEMUFile *f, RAMBlock *block)
+{
+    MappedRamHeader header;
+    off_t offset = qemu_get_offset(f);
+
+    if (offset < 0) {
+        return -1;
+    }
+
+    block->bitmap_offset = offset + sizeof(header);
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(block),
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    header.version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header.page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+    header.bitmap_offset = cpu_to_be64(block->bitmap_offset);
+    header.pages_offset = cpu_to_be64(block->pages_offset);
+    qemu_put_buffer(f, (uint8_t *)&header, sizeof(header));
+
+    trace_ram_mapped_ram_save_header(block->idstr, block->bitmap_offset,
+                                     block->pages_offset);
+
+    /* Leave room for the pages, the stream goes on after them */
+    return qemu_set_offset(f, block->pages_offset + block->used_length);
+}
+
+static int mapped_ram_save_bitmap(QEMUFile *f, RAMBlock *block)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    uint64_t size = mapped_ram_bitmap_size(block);
+    unsigned long *le_bitmap = bitmap_new(size * BITS_PER_BYTE);
+    Error *local_err = NULL;
+    ssize_t ret;
+
+    bitmap_to_le(le_bitmap, block->file_bmap, pages);
+    ret = qio_channel_pwrite(ioc, (char *)le_bitmap, size,
+                             block->bitmap_offset, &local_err);
+    g_free(le_bitmap);
+
+    if (ret != size) {
+        if (!local_err) {
+            error_setg(&local_err, "Short write of mapped-ram bitmap");
+        }
+        qemu_file_set_error_obj(f, -EIO, local_err);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * ram_save_mapped_page: write a page at its place in the migration file
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(rs->f);
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+    uint8_t *p = block->host + offset;
+    Error *local_err = NULL;
+    size_t done = 0;
+    ssize_t ret;
+
+    if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        /* The destination's memory is zero already, punch no data in */
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    while (done < TARGET_PAGE_SIZE) {
+        ret = qio_channel_pwrite(ioc, (char *)p + done,
+                                 TARGET_PAGE_SIZE - done,
+                                 block->pages_offset + offset + done,
+                                 &local_err);
+        if (ret <= 0) {
+            if (!local_err) {
+                error_setg(&local_err, "Unable to write page to file");
+            }
+            qemu_file_set_error_obj(rs->f, -EIO, local_err);
+            return -EIO;
+        }
+        done += ret;
+    }
+    set_bit(page, block->file_bmap);
+
+    qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    ram_transferred_add(TARGET_PAGE_SIZE);
+    ram_counters.mapped_ram_bytes += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -2147,6 +2530,18 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
+    if (migrate_mapped_ram()) {
+        return ram_save_mapped_page(rs, block, offset);
+    }
+
+    /*
+     * The multifd channel threads look for zero pages themselves, don't
+     * scan the page here in the migration thread.
+     */
+    if (migrate_use_multifd_zero_page() && save_page_use_multifd(rs, pss)) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -2157,17 +2552,15 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
             xbzrle_cache_zero_page(rs, block->offset + offset);
             XBZRLE_cache_unlock();
         }
+        /* ... and so must the multifd channels, for the same reason */
+        if (migrate_use_multifd() &&
+            migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE) {
+            multifd_xbzrle_zero_page(block->offset + offset);
+        }
         return res;
     }
 
-    /*
-     * Do not use multifd for:
-     * 1. Compression as the first page in the new block should be posted out
-     *    before sending the compressed page
-     * 2. In postcopy as one whole host page should be placed
-     */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    if (save_page_use_multifd(rs, pss)) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -2216,9 +2609,11 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
             pages += tmppages;
             /*
              * Allow rate limiting to happen in the middle of huge pages if
-             * something is sent in the current iteration.
+             * something is sent in the current iteration, unless it's sent
+             * on the postcopy preempt channel which isn't rate limited.
              */
-            if (pagesize_bits > 1 && tmppages > 0) {
+            if (pagesize_bits > 1 && tmppages > 0 &&
+                !(pss->postcopy_requested && postcopy_preempt_active())) {
                 migration_rate_limit();
             }
         }
@@ -2233,6 +2628,45 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
     return (res < 0 ? res : pages);
 }
 
+/**
+ * ram_save_host_page_urgent: send a requested host page on the preempt channel
+ *
+ * The page goes on the postcopy preempt channel so that it doesn't queue up
+ * behind the background pages still in flight on the main channel.  Errors
+ * on the preempt channel are reported on the main one too, so that postcopy
+ * pauses and recovers both.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ */
+static int ram_save_host_page_urgent(RAMState *rs, PageSearchStatus *pss)
+{
+    QEMUFile *main_f = rs->f;
+    RAMBlock *main_last_sent_block = rs->last_sent_block;
+    int pages, ret;
+
+    trace_postcopy_preempt_send_host_page(pss->block->idstr, pss->page);
+
+    rs->f = migrate_get_current()->postcopy_qemufile_src;
+    rs->last_sent_block = rs->postcopy_last_sent_block;
+
+    pages = ram_save_host_page(rs, pss);
+    qemu_fflush(rs->f);
+    ret = qemu_file_get_error(rs->f);
+
+    rs->postcopy_last_sent_block = rs->last_sent_block;
+    rs->last_sent_block = main_last_sent_block;
+    rs->f = main_f;
+
+    if (ret) {
+        qemu_file_set_error(rs->f, ret);
+        return ret;
+    }
+    return pages;
+}
+
 /**
  * ram_find_and_save_block: finds a dirty page and sends it to f
  *
@@ -2260,6 +2694,7 @@ static int ram_find_and_save_block(RAMState *rs)
     pss.block = rs->last_seen_block;
     pss.page = rs->last_page;
     pss.complete_round = false;
+    pss.postcopy_requested = false;
 
     if (!pss.block) {
         pss.block = QLIST_FIRST_RCU(&ram_list.blocks);
@@ -2275,7 +2710,11 @@ static int ram_find_and_save_block(RAMState *rs)
         }
 
         if (found) {
-            pages = ram_save_host_page(rs, &pss);
+            if (pss.postcopy_requested && postcopy_preempt_active()) {
+                pages = ram_save_host_page_urgent(rs, &pss);
+            } else {
+                pages = ram_save_host_page(rs, &pss);
+            }
         }
     } while (!pages && again);
 
@@ -2385,10 +2824,13 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
     compress_threads_save_cleanup();
+    dirty_sync_threads_cleanup();
     ram_state_cleanup(rsp);
 }
 
@@ -2396,6 +2838,7 @@ static void ram_state_reset(RAMState *rs)
 {
     rs->last_seen_block = NULL;
     rs->last_sent_block = NULL;
+    rs->postcopy_last_sent_block = NULL;
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->xbzrle_enabled = false;
@@ -2903,20 +3346,32 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
     RAMBlock *block;
+    int ret;
 
     if (compress_threads_save_setup()) {
         return -1;
     }
+    dirty_sync_threads_setup();
 
     /* migration has already setup the bitmap, reuse it. */
     if (!migration_in_colo_state()) {
         if (ram_init_all(rsp) != 0) {
             compress_threads_save_cleanup();
+            dirty_sync_threads_cleanup();
             return -1;
         }
     }
     (*rsp)->f = f;
 
+    if (migrate_mapped_ram() &&
+        (!qemu_file_get_ioc(f) ||
+         !qio_channel_has_feature(qemu_file_get_ioc(f),
+                                  QIO_CHANNEL_FEATURE_SEEKABLE))) {
+        error_report("Mapped RAM needs a seekable migration channel, "
+                     "such as file:");
+        return -1;
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
 
@@ -2931,13 +3386,25 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                block->file_bmap =
+                    bitmap_new(block->used_length >> TARGET_PAGE_BITS);
+                ret = mapped_ram_save_header(f, block);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
         }
     }
 
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
 
-    multifd_send_sync_main(f);
+    ret = multifd_send_sync_main(f);
+    if (ret < 0) {
+        return ret;
+    }
+
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     qemu_fflush(f);
 
@@ -3046,7 +3513,11 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
 out:
     if (ret >= 0
         && migration_is_setup_or_active(migrate_get_current()->state)) {
-        multifd_send_sync_main(rs->f);
+        ret = multifd_send_sync_main(rs->f);
+        if (ret < 0) {
+            return ret;
+        }
+
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
         ram_transferred_add(8);
@@ -3104,14 +3575,38 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         flush_compressed_data(rs);
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
+
+        if (ret >= 0 && migrate_mapped_ram()) {
+            RAMBlock *block;
+
+            RAMBLOCK_FOREACH_MIGRATABLE(block) {
+                ret = mapped_ram_save_bitmap(f, block);
+                if (ret < 0) {
+                    break;
+                }
+            }
+        }
     }
 
     if (ret >= 0) {
-        multifd_send_sync_main(rs->f);
+        ret = multifd_send_sync_main(rs->f);
+        if (ret < 0) {
+            return ret;
+        }
+
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
 
+    if (ret >= 0 && postcopy_preempt_active()) {
+        /* This ends the preempt thread on the destination */
+        QEMUFile *preempt_f = migrate_get_current()->postcopy_qemufile_src;
+
+        qemu_put_be64(preempt_f, RAM_SAVE_FLAG_EOS);
+        qemu_fflush(preempt_f);
+        ret = qemu_file_get_error(preempt_f);
+    }
+
     return ret;
 }
 
@@ -3188,11 +3683,13 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  * @mis: the migration incoming state pointer
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: the channel we're using
  */
 static inline RAMBlock *ram_block_from_stream(MigrationIncomingState *mis,
-                                              QEMUFile *f, int flags)
+                                              QEMUFile *f, int flags,
+                                              int channel)
 {
-    RAMBlock *block = mis->last_recv_block;
+    RAMBlock *block = mis->last_recv_block[channel];
     char id[256];
     uint8_t len;
 
@@ -3219,7 +3716,7 @@ static inline RAMBlock *ram_block_from_stream(MigrationIncomingState *mis,
         return NULL;
     }
 
-    mis->last_recv_block = block;
+    mis->last_recv_block[channel] = block;
 
     return block;
 }
@@ -3634,19 +4131,20 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
- * rcu_read_lock is taken prior to this being called.
+ * Called in postcopy mode by ram_load() for the main channel, with
+ * rcu_read_lock taken prior to this being called, and by the preempt
+ * thread for the postcopy preempt channel.
  *
  * @f: QEMUFile where to send the data
+ * @channel: the channel to use for loading
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
-    /* Currently we only use channel 0.  TODO: use all the channels */
-    PostcopyTmpPage *tmp_page = &mis->postcopy_tmp_pages[0];
+    PostcopyTmpPage *tmp_page = &mis->postcopy_tmp_pages[channel];
 
     while (!ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr;
@@ -3673,7 +4171,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE)) {
-            block = ram_block_from_stream(mis, f, flags);
+            block = ram_block_from_stream(mis, f, flags, channel);
             if (!block) {
                 ret = -EINVAL;
                 break;
@@ -3778,7 +4276,9 @@ static int ram_load_postcopy(QEMUFile *f)
 
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
-            multifd_recv_sync_main();
+            if (channel == RAM_CHANNEL_PRECOPY) {
+                multifd_recv_sync_main();
+            }
             break;
         default:
             error_report("Unknown combination of migration flags: 0x%x"
@@ -3873,6 +4373,161 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/* A contiguous range of pages of a block read back by one thread */
+typedef struct {
+    QemuThread thread;
+    QIOChannel *ioc;
+    RAMBlock *block;
+    unsigned long *bitmap;
+    /* first page of the range */
+    unsigned long start;
+    /* page after the end of the range */
+    unsigned long end;
+    Error *err;
+} MappedRamLoadRange;
+
+static void *mapped_ram_load_thread(void *opaque)
+{
+    MappedRamLoadRange *range = opaque;
+    RAMBlock *block = range->block;
+    unsigned long run_start, run_end;
+
+    run_start = find_next_bit(range->bitmap, range->end, range->start);
+    while (run_start < range->end) {
+        ram_addr_t offset = (ram_addr_t)run_start << TARGET_PAGE_BITS;
+        size_t len, done = 0;
+        ssize_t ret;
+
+        /* Read each run of pages held by the file with as few calls */
+        run_end = find_next_zero_bit(range->bitmap, range->end, run_start);
+        len = (size_t)(run_end - run_start) << TARGET_PAGE_BITS;
+
+        while (done < len) {
+            ret = qio_channel_pread(range->ioc,
+                                    (char *)block->host + offset + done,
+                                    len - done,
+                                    block->pages_offset + offset + done,
+                                    &range->err);
+            if (ret <= 0) {
+                if (!range->err) {
+                    error_setg(&range->err, "Unexpected end of migration "
+                               "file in RAM block %s", block->idstr);
+                }
+                return NULL;
+            }
+            done += ret;
+        }
+        ramblock_recv_bitmap_set_range(block, block->host + offset,
+                                       run_end - run_start);
+
+        run_start = find_next_bit(range->bitmap, range->end, run_end);
+    }
+    return NULL;
+}
+
+/**
+ * mapped_ram_load_block: read back a RAM block of a mapped-ram file
+ *
+ * Parse the MappedRamHeader that follows the block in the
+ * RAM_SAVE_FLAG_MEM_SIZE list, then read all the pages the file holds
+ * into guest memory from a pool of threads, each one handling a
+ * contiguous part of the block.  Leaves the stream past the block's
+ * region of the file.
+ *
+ * Returns 0 for success or a negative errno
+ *
+ * @f: QEMUFile where to read the header from
+ * @block: RAM block to load
+ */
+static int mapped_ram_load_block(QEMUFile *f, RAMBlock *block)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    uint64_t bitmap_size = mapped_ram_bitmap_size(block);
+    int nthreads = migrate_mapped_ram_threads();
+    unsigned long *le_bitmap, *bitmap, per_thread;
+    MappedRamLoadRange *ranges;
+    MappedRamHeader header;
+    Error *local_err = NULL;
+    int i, ret = 0;
+
+    if (!ioc || !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_report("Mapped RAM needs a seekable migration channel, "
+                     "such as file:");
+        return -EINVAL;
+    }
+
+    if (qemu_get_buffer(f, (uint8_t *)&header, sizeof(header)) !=
+        sizeof(header)) {
+        return qemu_file_get_error(f) ?: -EINVAL;
+    }
+    if (be32_to_cpu(header.version) != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram header version %u for "
+                     "RAM block %s", be32_to_cpu(header.version),
+                     block->idstr);
+        return -EINVAL;
+    }
+    if (be64_to_cpu(header.page_size) != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size for RAM block %s: "
+                     "%" PRIu64 " != %" PRIu64, block->idstr,
+                     be64_to_cpu(header.page_size),
+                     (uint64_t)TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+    block->bitmap_offset = be64_to_cpu(header.bitmap_offset);
+    block->pages_offset = be64_to_cpu(header.pages_offset);
+
+    le_bitmap = bitmap_new(bitmap_size * BITS_PER_BYTE);
+    if (qio_channel_pread(ioc, (char *)le_bitmap, bitmap_size,
+                          block->bitmap_offset, &local_err) != bitmap_size) {
+        if (local_err) {
+            error_report_err(local_err);
+        } else {
+            error_report("Short read of mapped-ram bitmap for RAM block %s",
+                         block->idstr);
+        }
+        g_free(le_bitmap);
+        return -EIO;
+    }
+    bitmap = bitmap_new(pages);
+    bitmap_from_le(bitmap, le_bitmap, pages);
+    g_free(le_bitmap);
+
+    per_thread = MAX(DIV_ROUND_UP(pages, nthreads), 1);
+    nthreads = MAX(DIV_ROUND_UP(pages, per_thread), 1);
+    trace_ram_mapped_ram_load(block->idstr, pages, nthreads);
+
+    ranges = g_new0(MappedRamLoadRange, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        ranges[i].ioc = ioc;
+        ranges[i].block = block;
+        ranges[i].bitmap = bitmap;
+        ranges[i].start = MIN(i * per_thread, pages);
+        ranges[i].end = MIN(ranges[i].start + per_thread, pages);
+        qemu_thread_create(&ranges[i].thread, "mapped-ram",
+                           mapped_ram_load_thread, &ranges[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_join(&ranges[i].thread);
+        if (ranges[i].err) {
+            if (!ret) {
+                error_report_err(ranges[i].err);
+                ret = -EIO;
+            } else {
+                error_free(ranges[i].err);
+            }
+        }
+    }
+    g_free(ranges);
+    g_free(bitmap);
+
+    if (ret) {
+        return ret;
+    }
+    return qemu_set_offset(f, block->pages_offset + block->used_length);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3924,7 +4579,8 @@ static int ram_load_precopy(QEMUFile *f)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(mis, f, flags);
+            RAMBlock *block = ram_block_from_stream(mis, f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -4013,6 +4669,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = mapped_ram_load_block(f, block);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -4101,7 +4760,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
      */
     WITH_RCU_READ_LOCK_GUARD() {
         if (postcopy_running) {
-            ret = ram_load_postcopy(f);
+            ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
         } else {
             ret = ram_load_precopy(f);
         }
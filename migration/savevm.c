@@ -40,6 +40,7 @@
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
+#include "multifd.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-migration.h"
 #include "qapi/qmp/json-writer.h"
@@ -1978,6 +1979,7 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
             postcopy_ram_incoming_cleanup(mis);
             return -1;
         }
+        multifd_recv_postcopy_listen();
     }
 
     trace_loadvm_postcopy_handle_listen("after uffd");
@@ -2119,6 +2121,15 @@ static int loadvm_postcopy_handle_resume(MigrationIncomingState *mis)
      */
     mis->last_rb = NULL;
 
+    if (migrate_postcopy_preempt()) {
+        /*
+         * The source connects the new preempt channel before asking to
+         * resume; wait for it, then let the preempt thread use it.
+         */
+        qemu_sem_wait(&mis->postcopy_qemufile_dst_done);
+        qemu_sem_post(&mis->postcopy_pause_sem_fast_load);
+    }
+
     /*
      * This means source VM is ready to resume the postcopy migration.
      */
@@ -2575,6 +2586,16 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 {
     int i;
 
+    if (mis->postcopy_qemufile_dst) {
+        qemu_file_shutdown(mis->postcopy_qemufile_dst);
+        /* Taking the mutex makes sure that the preempt thread has paused */
+        qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
+        migration_ioc_unregister_yank_from_file(mis->postcopy_qemufile_dst);
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+        qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+    }
+
     /*
      * If network is interrupted, any temp page we received will be useless
      * because we didn't mark them as "received" in receivedmap.  After a
@@ -2694,7 +2715,8 @@ out:
          * recovering.
          */
         if (postcopy_state_get() == POSTCOPY_INCOMING_RUNNING &&
-            migrate_postcopy_ram() && postcopy_pause_incoming(mis)) {
+            migrate_postcopy_ram() && !migrate_multifd_postcopy() &&
+            postcopy_pause_incoming(mis)) {
             /* Reset f to point to the newly created channel */
             f = mis->from_src_file;
             goto retry;
@@ -159,6 +159,9 @@ socket_start_incoming_migration_internal(SocketAddress *saddr,
     if (migrate_use_multifd()) {
         num = migrate_multifd_channels();
     }
+    if (migrate_postcopy_preempt()) {
+        num++;
+    }
 
     if (qio_net_listener_open_sync(listener, saddr, num, errp) < 0) {
         object_unref(OBJECT(listener));
@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,17 +25,14 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
     long res;
     uint8_t *nzrun_start = NULL;
 
-    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
-               sizeof(long)));
-
     while (i < slen) {
         /* overflow */
         if (d + 2 > dlen) {
@@ -126,6 +124,385 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+/*
+ * Vectorized encoders.  A zrun always ends at the first byte that
+ * differs and an nzrun at the first byte that is equal again, so these
+ * produce exactly the same output as xbzrle_encode_buffer_int(); only
+ * the way the run boundaries are found changes.
+ */
+typedef int (*xbzrle_scan_fn)(const uint8_t *old_buf, const uint8_t *new_buf,
+                              int i, int slen);
+
+static inline __attribute__((always_inline)) int
+xbzrle_encode_runs(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                   uint8_t *dst, int dlen,
+                   xbzrle_scan_fn skip_equal, xbzrle_scan_fn skip_diff)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, end;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        end = skip_equal(old_buf, new_buf, i, slen);
+        zrun_len = end - i;
+        i = end;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        end = skip_diff(old_buf, new_buf, i, slen);
+        nzrun_len = end - i;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + i, nzrun_len);
+        d += nzrun_len;
+        i = end;
+    }
+
+    return d;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* Bit n is set if byte n of the two 32-byte blocks is equal.  */
+static inline uint32_t xbzrle_eq_mask_avx2(const uint8_t *a, const uint8_t *b)
+{
+    __m256i x = _mm256_loadu_si256((const __m256i *)a);
+    __m256i y = _mm256_loadu_si256((const __m256i *)b);
+
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+}
+
+static inline int xbzrle_skip_equal_avx2(const uint8_t *old_buf,
+                                         const uint8_t *new_buf,
+                                         int i, int slen)
+{
+    uint32_t mask;
+
+    /* Mostly clean pages are the common case, go 128 bytes at a time.  */
+    while (i + 128 <= slen) {
+        mask = xbzrle_eq_mask_avx2(old_buf + i, new_buf + i) &
+               xbzrle_eq_mask_avx2(old_buf + i + 32, new_buf + i + 32) &
+               xbzrle_eq_mask_avx2(old_buf + i + 64, new_buf + i + 64) &
+               xbzrle_eq_mask_avx2(old_buf + i + 96, new_buf + i + 96);
+        if (unlikely(mask != UINT32_MAX)) {
+            break;
+        }
+        i += 128;
+    }
+    while (i + 32 <= slen) {
+        mask = ~xbzrle_eq_mask_avx2(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz32(mask);
+        }
+        i += 32;
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int xbzrle_skip_diff_avx2(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    uint32_t mask;
+
+    while (i + 32 <= slen) {
+        mask = xbzrle_eq_mask_avx2(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz32(mask);
+        }
+        i += 32;
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_skip_equal_avx2, xbzrle_skip_diff_avx2);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+#include <immintrin.h>
+
+/* Bit n is set if byte n of the two 64-byte blocks is equal.  */
+static inline uint64_t xbzrle_eq_mask_avx512(const uint8_t *a,
+                                             const uint8_t *b)
+{
+    __m512i x = _mm512_loadu_si512(a);
+    __m512i y = _mm512_loadu_si512(b);
+
+    return _mm512_cmpeq_epi8_mask(x, y);
+}
+
+static inline int xbzrle_skip_equal_avx512(const uint8_t *old_buf,
+                                           const uint8_t *new_buf,
+                                           int i, int slen)
+{
+    uint64_t mask;
+
+    /* Mostly clean pages are the common case, go 256 bytes at a time.  */
+    while (i + 256 <= slen) {
+        mask = xbzrle_eq_mask_avx512(old_buf + i, new_buf + i) &
+               xbzrle_eq_mask_avx512(old_buf + i + 64, new_buf + i + 64) &
+               xbzrle_eq_mask_avx512(old_buf + i + 128, new_buf + i + 128) &
+               xbzrle_eq_mask_avx512(old_buf + i + 192, new_buf + i + 192);
+        if (unlikely(mask != UINT64_MAX)) {
+            break;
+        }
+        i += 256;
+    }
+    while (i + 64 <= slen) {
+        mask = ~xbzrle_eq_mask_avx512(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz64(mask);
+        }
+        i += 64;
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int xbzrle_skip_diff_avx512(const uint8_t *old_buf,
+                                          const uint8_t *new_buf,
+                                          int i, int slen)
+{
+    uint64_t mask;
+
+    while (i + 64 <= slen) {
+        mask = xbzrle_eq_mask_avx512(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz64(mask);
+        }
+        i += 64;
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf,
+                                       int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_skip_equal_avx512,
+                              xbzrle_skip_diff_avx512);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+
+/* Advanced SIMD is architecturally guaranteed on AArch64.  */
+#if defined(__aarch64__) && !defined(HOST_WORDS_BIGENDIAN)
+#define XBZRLE_HAVE_NEON
+#include <arm_neon.h>
+
+/* Nibble n is set if byte n of the two 16-byte blocks is equal.  */
+static inline uint64_t xbzrle_eq_mask_neon(const uint8_t *a, const uint8_t *b)
+{
+    uint8x16_t eq = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+
+    return vget_lane_u64(vreinterpret_u64_u8(
+                         vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+static inline int xbzrle_skip_equal_neon(const uint8_t *old_buf,
+                                         const uint8_t *new_buf,
+                                         int i, int slen)
+{
+    uint64_t mask;
+
+    /* Mostly clean pages are the common case, go 64 bytes at a time.  */
+    while (i + 64 <= slen) {
+        uint8x16_t eq;
+
+        eq = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(old_buf + i),
+                                        vld1q_u8(new_buf + i)),
+                               vceqq_u8(vld1q_u8(old_buf + i + 16),
+                                        vld1q_u8(new_buf + i + 16))),
+                      vandq_u8(vceqq_u8(vld1q_u8(old_buf + i + 32),
+                                        vld1q_u8(new_buf + i + 32)),
+                               vceqq_u8(vld1q_u8(old_buf + i + 48),
+                                        vld1q_u8(new_buf + i + 48))));
+        if (unlikely(vminvq_u8(eq) != 0xff)) {
+            break;
+        }
+        i += 64;
+    }
+    while (i + 16 <= slen) {
+        mask = ~xbzrle_eq_mask_neon(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz64(mask) / 4;
+        }
+        i += 16;
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int xbzrle_skip_diff_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    uint64_t mask;
+
+    while (i + 16 <= slen) {
+        mask = xbzrle_eq_mask_neon(old_buf + i, new_buf + i);
+        if (mask) {
+            return i + ctz64(mask) / 4;
+        }
+        i += 16;
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_skip_equal_neon, xbzrle_skip_diff_neon);
+}
+#endif /* __aarch64__ */
+
+/*
+ * Note that for test_xbzrle_encode_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX512BW 1
+#define CACHE_AVX2     2
+#define CACHE_NEON     4
+
+#ifdef XBZRLE_HAVE_NEON
+# define INIT_CACHE CACHE_NEON
+# define INIT_ACCEL xbzrle_encode_buffer_neon
+#else
+# define INIT_CACHE 0
+# define INIT_ACCEL xbzrle_encode_buffer_int
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static int (*encode_accel)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+    INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+        xbzrle_encode_buffer_int;
+#ifdef XBZRLE_HAVE_NEON
+    if (cache & CACHE_NEON) {
+        fn = xbzrle_encode_buffer_neon;
+    }
+#endif
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        fn = xbzrle_encode_buffer_avx512;
+    }
+#endif
+    encode_accel = fn;
+}
+
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* See util/bufferiszero.c for the meaning of 0xe6.  */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512F) &&
+                (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX512BW_OPT || CONFIG_AVX2_OPT */
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /* If no bits set, we just tested xbzrle_encode_buffer_int, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    return encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
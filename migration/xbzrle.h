@@ -18,4 +18,7 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
+
+/* Switch to the next vectorized encoder, for testing and benchmarking.  */
+bool test_xbzrle_encode_next_accel(void);
 #endif
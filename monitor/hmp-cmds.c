@@ -278,10 +278,18 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        monitor_printf(mon, "dirty sync latency: %" PRIu64 " us "
+                       "(max %" PRIu64 " us)\n",
+                       info->ram->dirty_sync_latency,
+                       info->ram->dirty_sync_latency_max);
         monitor_printf(mon, "page size: %" PRIu64 " kbytes\n",
                        info->ram->page_size >> 10);
         monitor_printf(mon, "multifd bytes: %" PRIu64 " kbytes\n",
                        info->ram->multifd_bytes >> 10);
+        if (info->ram->mapped_ram_bytes) {
+            monitor_printf(mon, "mapped-ram bytes: %" PRIu64 " kbytes\n",
+                           info->ram->mapped_ram_bytes >> 10);
+        }
         monitor_printf(mon, "pages-per-second: %" PRIu64 "\n",
                        info->ram->pages_per_second);
 
@@ -305,6 +313,11 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "postcopy ram: %" PRIu64 " kbytes\n",
                            info->ram->postcopy_bytes >> 10);
         }
+        if (info->ram->dirty_sync_missed_zero_copy) {
+            monitor_printf(mon,
+                           "Zero-copy-send fallbacks happened: %" PRIu64 " times\n",
+                           info->ram->dirty_sync_missed_zero_copy);
+        }
     }
 
     if (info->has_disk) {
@@ -367,6 +380,12 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         g_free(str);
         visit_free(v);
     }
+    if (info->has_postcopy_latency_p50) {
+        monitor_printf(mon, "postcopy fault latency: p50 %" PRIu64
+                       " us, p99 %" PRIu64 " us\n",
+                       info->postcopy_latency_p50,
+                       info->postcopy_latency_p99);
+    }
     if (info->has_socket_address) {
         SocketAddressList *addr;
 
@@ -499,6 +518,15 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: '%s'\n",
             MigrationParameter_str(MIGRATION_PARAMETER_TLS_AUTHZ),
             params->tls_authz);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_DIRTY_SYNC_THREADS),
+            params->dirty_sync_threads);
+        monitor_printf(mon, "%s: %" PRIu64 " MB/s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT),
+            params->vcpu_dirty_limit);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MAPPED_RAM_THREADS),
+            params->mapped_ram_threads);
 
         if (params->has_block_bitmap_mapping) {
             const BitmapMigrationNodeAliasList *bmnal;
@@ -1344,6 +1372,18 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         error_setg(&err, "The block-bitmap-mapping parameter can only be set "
                    "through QMP");
         break;
+    case MIGRATION_PARAMETER_DIRTY_SYNC_THREADS:
+        p->has_dirty_sync_threads = true;
+        visit_type_uint8(v, param, &p->dirty_sync_threads, &err);
+        break;
+    case MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT:
+        p->has_vcpu_dirty_limit = true;
+        visit_type_uint64(v, param, &p->vcpu_dirty_limit, &err);
+        break;
+    case MIGRATION_PARAMETER_MAPPED_RAM_THREADS:
+        p->has_mapped_ram_threads = true;
+        visit_type_uint8(v, param, &p->mapped_ram_threads, &err);
+        break;
     default:
         assert(0);
     }
@@ -26,6 +26,9 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/main-loop.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -99,6 +102,15 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /*
+     * With the iothreads option, client connections are assigned to these
+     * IOThreads in turn and stay there.  Otherwise they run in, and follow,
+     * the AioContext of the export.
+     */
+    IOThread **iothreads;
+    size_t nr_iothreads;
+    size_t next_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -126,6 +138,7 @@ struct NBDClient {
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
+    AioContext *ctx; /* The AioContext serving the requests of this client */
 
     Coroutine *recv_coroutine;
 
@@ -138,6 +151,7 @@ struct NBDClient {
     QTAILQ_ENTRY(NBDClient) next;
     int nb_requests;
     bool closing;
+    bool close_negotiated;
 
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
@@ -1303,6 +1317,21 @@ static int nbd_negotiate_options(NBDClient *client, Error **errp)
     }
 }
 
+/*
+ * The AioContext that serves a newly negotiated client of @exp.  Clients
+ * are only negotiated in the main loop, so no locking is needed.
+ */
+static AioContext *nbd_export_next_client_ctx(NBDExport *exp)
+{
+    IOThread *iothread;
+
+    if (!exp->nr_iothreads) {
+        return exp->common.ctx;
+    }
+    iothread = exp->iothreads[exp->next_iothread++ % exp->nr_iothreads];
+    return iothread_get_aio_context(iothread);
+}
+
 /* nbd_negotiate
  * Return:
  * -errno  on error, errp is set
@@ -1350,9 +1379,12 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         return ret;
     }
 
-    /* Attach the channel to the same AioContext as the export */
-    if (client->exp && client->exp->common.ctx) {
-        qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
+    /* Attach the channel to the AioContext serving the client */
+    if (client->exp) {
+        client->ctx = nbd_export_next_client_ctx(client->exp);
+    }
+    if (client->ctx) {
+        qio_channel_attach_aio_context(client->ioc, client->ctx);
     }
 
     assert(!client->optlen);
@@ -1452,33 +1484,53 @@ static int nbd_receive_request(NBDClient *client, NBDRequest *request,
 
 void nbd_client_get(NBDClient *client)
 {
-    client->refcount++;
+    qatomic_inc(&client->refcount);
+}
+
+/* Runs in the main thread, which owns the client list of the export */
+static void nbd_client_free(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    qio_channel_detach_aio_context(client->ioc);
+    object_unref(OBJECT(client->sioc));
+    object_unref(OBJECT(client->ioc));
+    if (client->tlscreds) {
+        object_unref(OBJECT(client->tlscreds));
+    }
+    g_free(client->tlsauthz);
+    if (client->exp) {
+        QTAILQ_REMOVE(&client->exp->clients, client, next);
+        blk_exp_unref(&client->exp->common);
+    }
+    g_free(client->export_meta.bitmaps);
+    g_free(client);
 }
 
 void nbd_client_put(NBDClient *client)
 {
-    if (--client->refcount == 0) {
+    if (qatomic_fetch_dec(&client->refcount) == 1) {
         /* The last reference should be dropped by client->close,
          * which is called by client_close.
          */
         assert(client->closing);
 
-        qio_channel_detach_aio_context(client->ioc);
-        object_unref(OBJECT(client->sioc));
-        object_unref(OBJECT(client->ioc));
-        if (client->tlscreds) {
-            object_unref(OBJECT(client->tlscreds));
-        }
-        g_free(client->tlsauthz);
-        if (client->exp) {
-            QTAILQ_REMOVE(&client->exp->clients, client, next);
-            blk_exp_unref(&client->exp->common);
+        if (qemu_in_main_thread()) {
+            nbd_client_free(client);
+        } else {
+            aio_bh_schedule_oneshot(qemu_get_aio_context(), nbd_client_free,
+                                    client);
         }
-        g_free(client->export_meta.bitmaps);
-        g_free(client);
     }
 }
 
+static void client_close_fn_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    client->close_fn(client, client->close_negotiated);
+}
+
 static void client_close(NBDClient *client, bool negotiated)
 {
     if (client->closing) {
@@ -1493,9 +1545,19 @@ static void client_close(NBDClient *client, bool negotiated)
     qio_channel_shutdown(client->ioc, QIO_CHANNEL_SHUTDOWN_BOTH,
                          NULL);
 
-    /* Also tell the client, so that they release their reference.  */
+    /*
+     * Also tell the client, so that they release their reference.  The
+     * owner of the connection lives in the main thread, while requests
+     * fail in the AioContext of the client.
+     */
     if (client->close_fn) {
-        client->close_fn(client, negotiated);
+        if (qemu_in_main_thread()) {
+            client->close_fn(client, negotiated);
+        } else {
+            client->close_negotiated = negotiated;
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    client_close_fn_bh, client);
+        }
     }
 }
 
@@ -1504,7 +1566,7 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     NBDRequestData *req;
 
     assert(client->nb_requests <= MAX_NBD_REQUESTS - 1);
-    client->nb_requests++;
+    qatomic_inc(&client->nb_requests);
 
     req = g_new0(NBDRequestData, 1);
     nbd_client_get(client);
@@ -1521,9 +1583,9 @@ static void nbd_request_put(NBDRequestData *req)
     }
     g_free(req);
 
-    client->nb_requests--;
+    qatomic_dec(&client->nb_requests);
 
-    if (client->quiescing && client->nb_requests == 0) {
+    if (qatomic_read(&client->quiescing) && client->nb_requests == 0) {
         aio_wait_kick();
     }
 
@@ -1541,7 +1603,13 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
 
     exp->common.ctx = ctx;
 
+    /* Clients in the export's IOThreads stay where they are */
+    if (exp->nr_iothreads) {
+        return;
+    }
+
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        client->ctx = ctx;
         qio_channel_attach_aio_context(client->ioc, ctx);
 
         assert(client->nb_requests == 0);
@@ -1557,11 +1625,30 @@ static void blk_aio_detach(void *opaque)
 
     trace_nbd_blk_aio_detach(exp->name, exp->common.ctx);
 
+    exp->common.ctx = NULL;
+
+    if (exp->nr_iothreads) {
+        return;
+    }
+
     QTAILQ_FOREACH(client, &exp->clients, next) {
         qio_channel_detach_aio_context(client->ioc);
+        client->ctx = NULL;
     }
+}
 
-    exp->common.ctx = NULL;
+/*
+ * Runs in the IOThread of a client: stop waiting for the next request so
+ * that the drained section does not depend on the client sending one.
+ */
+static void nbd_client_wake_read_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    if (client->recv_coroutine != NULL && client->read_yielding) {
+        qemu_aio_coroutine_enter(client->ctx, client->recv_coroutine);
+    }
+    nbd_client_put(client);
 }
 
 static void nbd_drained_begin(void *opaque)
@@ -1570,7 +1657,12 @@ static void nbd_drained_begin(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = true;
+        qatomic_set(&client->quiescing, true);
+        if (exp->nr_iothreads && client->ctx) {
+            nbd_client_get(client);
+            aio_bh_schedule_oneshot(client->ctx, nbd_client_wake_read_bh,
+                                    client);
+        }
     }
 }
 
@@ -1580,7 +1672,7 @@ static void nbd_drained_end(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = false;
+        qatomic_set(&client->quiescing, false);
         nbd_client_receive_next_request(client);
     }
 }
@@ -1591,12 +1683,15 @@ static bool nbd_drained_poll(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        if (client->nb_requests != 0) {
+        if (qatomic_read(&client->nb_requests) != 0) {
             /*
              * If there's a coroutine waiting for a request on nbd_read_eof()
              * enter it here so we don't depend on the client to wake it up.
+             * Clients in the export's IOThreads are woken up by
+             * nbd_drained_begin() instead.
              */
-            if (client->recv_coroutine != NULL && client->read_yielding) {
+            if (!exp->nr_iothreads && client->recv_coroutine != NULL &&
+                client->read_yielding) {
                 qemu_aio_coroutine_enter(exp->common.ctx,
                                          client->recv_coroutine);
             }
@@ -1642,8 +1737,9 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     int64_t size;
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
-    bool shared = !exp_args->writable;
+    bool multi_conn;
     strList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1673,6 +1769,13 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return -EEXIST;
     }
 
+    for (iothreads = arg->iothreads; iothreads; iothreads = iothreads->next) {
+        if (!iothread_by_id(iothreads->value)) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            return -EINVAL;
+        }
+    }
+
     size = blk_getlength(blk);
     if (size < 0) {
         error_setg_errno(errp, -size,
@@ -1693,11 +1796,33 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     exp->description = g_strdup(arg->description);
     exp->nbdflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
+
+    /*
+     * All connections go through the same BlockBackend, so what one client
+     * reads reflects the completed writes of all others, and a flush on any
+     * connection makes every write completed before it persistent
+     * (bdrv_co_flush() covers all writes up to bs->write_gen).  That is
+     * what NBD_FLAG_CAN_MULTI_CONN promises for writable exports as well.
+     */
+    switch (arg->multi_conn) {
+    case ON_OFF_AUTO_ON:
+        multi_conn = true;
+        break;
+    case ON_OFF_AUTO_OFF:
+        multi_conn = false;
+        break;
+    case ON_OFF_AUTO_AUTO:
+        multi_conn = readonly;
+        break;
+    default:
+        abort();
+    }
+    if (multi_conn) {
+        exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
+
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
-        if (shared) {
-            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
-        }
     } else {
         exp->nbdflags |= (NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES |
                           NBD_FLAG_SEND_FAST_ZERO);
@@ -1761,6 +1886,22 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
      */
     blk_set_disable_request_queuing(blk, true);
 
+    /*
+     * Clients in the export's IOThreads receive requests and send replies
+     * there, but use the BlockBackend in its own AioContext, see nbd_trip().
+     */
+    for (iothreads = arg->iothreads; iothreads; iothreads = iothreads->next) {
+        exp->nr_iothreads++;
+    }
+    if (exp->nr_iothreads) {
+        exp->iothreads = g_new(IOThread *, exp->nr_iothreads);
+        for (i = 0, iothreads = arg->iothreads; iothreads;
+             i++, iothreads = iothreads->next) {
+            exp->iothreads[i] = iothread_by_id(iothreads->value);
+            object_ref(OBJECT(exp->iothreads[i]));
+        }
+    }
+
     blk_add_aio_context_notifier(blk, blk_aio_attached, blk_aio_detach, exp);
 
     blk_set_dev_ops(blk, &nbd_block_ops, exp);
@@ -1842,6 +1983,11 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    for (i = 0; i < exp->nr_iothreads; i++) {
+        object_unref(OBJECT(exp->iothreads[i]));
+    }
+    g_free(exp->iothreads);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -2656,7 +2802,18 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
+        /*
+         * The block layer is not thread-safe, so requests of clients served
+         * in other IOThreads move to the AioContext of the export while they
+         * use its BlockBackend.  The AioContext lock is then only held while
+         * the coroutine runs there, not across the yields for I/O and for
+         * writing the reply.
+         */
+        AioContext *client_ctx = qemu_get_current_aio_context();
+
+        aio_co_reschedule_self(blk_get_aio_context(client->exp->common.blk));
         ret = nbd_handle_request(client, &request, req->data, &local_err);
+        aio_co_reschedule_self(client_ctx);
     }
     if (ret < 0) {
         error_prepend(&local_err, "Failed to send reply: ");
@@ -2691,7 +2848,7 @@ static void nbd_client_receive_next_request(NBDClient *client)
         !client->quiescing) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(client->ctx, client->recv_coroutine);
     }
 }
 
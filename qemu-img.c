@@ -84,6 +84,7 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_STATS = 278,
 };
 
 typedef enum OutputFormat {
@@ -201,6 +202,8 @@ static void QEMU_NORETURN help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--stats' prints the time spent and the throughput of each stage of the\n"
+           "       conversion (read, waiting for in-order writes, write)\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1639,6 +1642,30 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/*
+ * Each request of the convert pipeline goes through these stages.  The
+ * target driver does its compression or encryption in the write stage.
+ */
+enum ImgConvertStage {
+    CONVERT_STAGE_READ,
+    CONVERT_STAGE_WAIT,     /* waiting for earlier writes (in order mode) */
+    CONVERT_STAGE_WRITE,
+    CONVERT_STAGE__MAX,
+};
+
+static const char *const convert_stage_names[CONVERT_STAGE__MAX] = {
+    [CONVERT_STAGE_READ]  = "read",
+    [CONVERT_STAGE_WAIT]  = "in-order wait",
+    [CONVERT_STAGE_WRITE] = "write",
+};
+
+typedef struct ImgConvertStageStats {
+    int64_t bytes;
+    int64_t busy_ns;    /* time with at least one request in the stage */
+    int64_t busy_start;
+    int active;
+} ImgConvertStageStats;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1654,6 +1681,7 @@ typedef struct ImgConvertState {
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
+    bool compressed_multi_cluster;
     bool target_is_new;
     bool target_has_backing;
     int64_t target_backing_sectors; /* negative if unknown */
@@ -1671,8 +1699,52 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+    int64_t start_ns;
+    ImgConvertStageStats stages[CONVERT_STAGE__MAX];
 } ImgConvertState;
 
+static void convert_stage_enter(ImgConvertState *s, enum ImgConvertStage stage)
+{
+    ImgConvertStageStats *st = &s->stages[stage];
+
+    if (!st->active++) {
+        st->busy_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+}
+
+static void convert_stage_leave(ImgConvertState *s, enum ImgConvertStage stage,
+                                int64_t bytes)
+{
+    ImgConvertStageStats *st = &s->stages[stage];
+
+    st->bytes += bytes;
+    if (!--st->active) {
+        st->busy_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - st->busy_start;
+    }
+}
+
+static void convert_print_stats(ImgConvertState *s)
+{
+    double total = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->start_ns) /
+                   (double)NANOSECONDS_PER_SECOND;
+    int i;
+
+    printf("Converted %" PRId64 " bytes in %.3f seconds\n",
+           s->total_sectors * BDRV_SECTOR_SIZE, total);
+    for (i = 0; i < CONVERT_STAGE__MAX; i++) {
+        ImgConvertStageStats *st = &s->stages[i];
+        double busy = st->busy_ns / (double)NANOSECONDS_PER_SECOND;
+
+        printf("  %-14s %" PRId64 " bytes, busy %.3f s (%.1f%%)",
+               convert_stage_names[i], st->bytes, busy,
+               total > 0 ? 100 * busy / total : 0);
+        if (i != CONVERT_STAGE_WAIT && busy > 0) {
+            printf(", %.1f MiB/s", st->bytes / busy / MiB);
+        }
+        printf("\n");
+    }
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1844,6 +1916,31 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
     return 0;
 }
 
+/*
+ * Compressed clusters need to be written as a whole.  Return whether the
+ * first cluster in @buf is zero, and set *@pnum to the number of sectors
+ * (at most @n) of the run of whole clusters that are all zero or all
+ * contain data, starting with the first one.
+ */
+static bool convert_compressed_is_zero(ImgConvertState *s, const uint8_t *buf,
+                                       int n, int *pnum)
+{
+    int len = MIN(n, s->cluster_sectors);
+    bool zero = buffer_is_zero(buf, len * BDRV_SECTOR_SIZE);
+    int run = len;
+
+    while (run < n) {
+        len = MIN(n - run, s->cluster_sectors);
+        if (buffer_is_zero(buf + run * BDRV_SECTOR_SIZE,
+                           len * BDRV_SECTOR_SIZE) != zero) {
+            break;
+        }
+        run += len;
+    }
+
+    *pnum = run;
+    return zero;
+}
 
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
@@ -1868,14 +1965,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write for completely zeroed
+             * clusters. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 !convert_compressed_is_zero(s, buf, n, &n)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1995,7 +2092,9 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 retry:
         copy_range = s->copy_range && s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
+            convert_stage_enter(s, CONVERT_STAGE_READ);
             ret = convert_co_read(s, sector_num, n, buf);
+            convert_stage_leave(s, CONVERT_STAGE_READ, n * BDRV_SECTOR_SIZE);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2008,14 +2107,17 @@ retry:
 
         if (s->wr_in_order) {
             /* keep writes in order */
+            convert_stage_enter(s, CONVERT_STAGE_WAIT);
             while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
                 s->wait_sector_num[index] = sector_num;
                 qemu_coroutine_yield();
             }
             s->wait_sector_num[index] = -1;
+            convert_stage_leave(s, CONVERT_STAGE_WAIT, 0);
         }
 
         if (s->ret == -EINPROGRESS) {
+            convert_stage_enter(s, CONVERT_STAGE_WRITE);
             if (copy_range) {
                 ret = convert_co_copy_range(s, sector_num, n);
                 if (ret) {
@@ -2025,6 +2127,8 @@ retry:
             } else {
                 ret = convert_co_write(s, sector_num, n, buf, status);
             }
+            convert_stage_leave(s, CONVERT_STAGE_WRITE,
+                                ret < 0 ? 0 : n * BDRV_SECTOR_SIZE);
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2070,14 +2174,22 @@ static int convert_do_copy(ImgConvertState *s)
         s->has_zero_init = bdrv_has_zero_init(blk_bs(s->target));
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, only one cluster
+     * can be copied at a time, unless the target can compress several
+     * clusters of a request in parallel.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        if (s->compressed_multi_cluster) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
+        }
     }
 
     while (sector_num < s->total_sectors) {
@@ -2095,6 +2207,7 @@ static int convert_do_copy(ImgConvertState *s)
     /* Do the copy */
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
+    s->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     qemu_co_mutex_init(&s->lock);
     for (i = 0; i < s->num_coroutines; i++) {
@@ -2216,6 +2329,7 @@ static int img_convert(int argc, char **argv)
     bool explict_min_sparse = false;
     bool bitmaps = false;
     bool skip_broken = false;
+    bool stats = false;
     int64_t rate_limit = 0;
 
     ImgConvertState s = (ImgConvertState) {
@@ -2238,6 +2352,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"stats", no_argument, 0, OPTION_STATS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2372,6 +2487,9 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_STATS:
+            stats = true;
+            break;
         }
     }
 
@@ -2737,6 +2855,7 @@ static int img_convert(int argc, char **argv)
         }
     } else {
         s.compressed = s.compressed || bdi.needs_compressed_writes;
+        s.compressed_multi_cluster = bdi.multi_cluster_compressed_writes;
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
@@ -2756,6 +2875,9 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (!ret && stats && !s.quiet && s.start_ns) {
+        convert_print_stats(&s);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
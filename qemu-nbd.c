@@ -70,6 +70,8 @@
 #define QEMU_NBD_OPT_PID_FILE      265
 #define QEMU_NBD_OPT_SELINUX_LABEL 266
 #define QEMU_NBD_OPT_TLSHOSTNAME   267
+#define QEMU_NBD_OPT_MULTI_CONN    268
+#define QEMU_NBD_OPT_IOTHREAD      269
 
 #define MBR_SIZE 512
 
@@ -100,6 +102,9 @@ static void usage(const char *name)
 "  -k, --socket=PATH         path to the unix socket\n"
 "                            (default '"SOCKET_PATH"')\n"
 "  -e, --shared=NUM          device can be shared by NUM clients (default '1')\n"
+"      --multi-conn=MODE     advertise multiple connections (on, off, auto)\n"
+"      --iothread=ID         serve client connections in the IOThread ID,\n"
+"                            may be given several times\n"
 "  -t, --persistent          don't exit on the last connection\n"
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
@@ -536,6 +541,8 @@ int main(int argc, char **argv)
         { "detect-zeroes", required_argument, NULL,
           QEMU_NBD_OPT_DETECT_ZEROES },
         { "shared", required_argument, NULL, 'e' },
+        { "multi-conn", required_argument, NULL, QEMU_NBD_OPT_MULTI_CONN },
+        { "iothread", required_argument, NULL, QEMU_NBD_OPT_IOTHREAD },
         { "format", required_argument, NULL, 'f' },
         { "persistent", no_argument, NULL, 't' },
         { "verbose", no_argument, NULL, 'v' },
@@ -569,6 +576,9 @@ int main(int argc, char **argv)
     const char *export_description = NULL;
     strList *bitmaps = NULL;
     bool alloc_depth = false;
+    OnOffAuto multi_conn = ON_OFF_AUTO_AUTO;
+    strList *iothreads = NULL;
+    strList **iothreads_tail = &iothreads;
     const char *tlscredsid = NULL;
     const char *tlshostname = NULL;
     bool imageOpts = false;
@@ -709,6 +719,18 @@ int main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
             break;
+        case QEMU_NBD_OPT_MULTI_CONN:
+            multi_conn = qapi_enum_parse(&OnOffAuto_lookup, optarg,
+                                         ON_OFF_AUTO_AUTO, &local_err);
+            if (local_err) {
+                error_reportf_err(local_err,
+                                  "Failed to parse multi-conn mode: ");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case QEMU_NBD_OPT_IOTHREAD:
+            QAPI_LIST_APPEND(iothreads_tail, g_strdup(optarg));
+            break;
         case 'f':
             fmt = optarg;
             break;
@@ -784,7 +806,8 @@ int main(int argc, char **argv)
         }
         if (export_name || export_description || dev_offset ||
             device || disconnect || fmt || sn_id_or_name || bitmaps ||
-            alloc_depth || seen_aio || seen_discard || seen_cache) {
+            alloc_depth || seen_aio || seen_discard || seen_cache ||
+            multi_conn != ON_OFF_AUTO_AUTO || iothreads) {
             error_report("List mode is incompatible with per-device settings");
             exit(EXIT_FAILURE);
         }
@@ -800,6 +823,12 @@ int main(int argc, char **argv)
         export_name = "";
     }
 
+    if (multi_conn == ON_OFF_AUTO_ON && shared == 1) {
+        error_report("--multi-conn=on requires --shared to allow more than "
+                     "one client");
+        exit(EXIT_FAILURE);
+    }
+
     if (!trace_init_backends()) {
         exit(1);
     }
@@ -1107,6 +1136,10 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            .has_multi_conn       = true,
+            .multi_conn           = multi_conn,
+            .has_iothreads        = !!iothreads,
+            .iothreads            = iothreads,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
@@ -151,6 +151,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                hot-threshold=n (TCG superblock formation threshold, default 0)\n"
+    "                tb-cache=file (persistent TCG translation cache)\n"
+    "                async-translate=n (TCG background translation threads, default 0)\n"
+    "                jmp-cache-bits=n (log2 of TCG jump cache sets, default 12)\n"
+    "                jmp-cache-ways=1|2|4 (TCG jump cache associativity, default 1)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -185,6 +190,45 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``hot-threshold=n``
+        Retranslate a TCG translation block as a superblock once it has
+        been executed n times. A superblock follows forward branches
+        within the guest page, leaving through side exits when they are
+        taken. Only supported by some targets, and never used with
+        icount. The default is 0, which disables superblock formation.
+
+    ``tb-cache=file``
+        Keep the code generated by TCG in file, and reuse it in later runs
+        instead of translating the same guest code again. Translated code
+        is only reused when the guest code is unchanged, and when it would
+        be placed at the same host address by the same QEMU binary with the
+        same configuration, so address space layout randomization must be
+        disabled (for example with ``setarch -R``). Several QEMU processes
+        can use the same file at the same time; a process with a different
+        configuration replaces it with a new file. The file must not be
+        shared between hosts with different CPUs. Only supported by some
+        targets.
+
+    ``async-translate=n``
+        With multi-threaded TCG, let vCPUs translate guest code without
+        optimization, and start n threads that translate it again with
+        full optimization in the background. This reduces the time vCPUs
+        spend translating during boot. Only supported by some targets.
+        The default is 0, which disables asynchronous translation.
+
+    ``jmp-cache-bits=n``
+        Size the per-vCPU TCG jump cache, which maps guest virtual
+        addresses to translation blocks, to 2^n sets. n must be between
+        8 and 16; the default is 12. A guest with a large working set of
+        code, such as a big kernel, may benefit from a larger cache. The
+        misses of each vCPU are shown by the ``info jit`` monitor
+        command. Lookups are slightly faster with the default geometry.
+
+    ``jmp-cache-ways=1|2|4``
+        Make the TCG jump cache 2- or 4-way set-associative, reducing
+        conflicts between blocks whose addresses map to the same set.
+        The default is 1, a direct-mapped cache.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -1217,6 +1261,18 @@ SRST
             Specifies the AIO backend (threads/native/io_uring,
             default: threads)
 
+        ``aio-fixed-buffers``
+            With ``aio=io_uring``, register guest RAM with the io_uring
+            instance so that requests do not need to pin and map guest
+            pages.  All guest RAM gets pinned, which also disables RAM
+            discards such as ballooning. (on/off, default: off)
+
+        ``aio-iopoll``
+            With ``aio=io_uring`` and ``cache.direct=on``, submit reads
+            and writes through an io_uring instance whose kernel thread
+            picks up requests and polls the device for completions.
+            Lowers latency at the cost of CPU time. (on/off, default: off)
+
         ``locking``
             Specifies whether the image file is protected with Linux OFD
             / POSIX locks. The default is to use the Linux Open File
@@ -1294,6 +1350,14 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``cluster-pool-size``
+            Reserve data clusters for allocating writes this many bytes
+            at a time, so that concurrent first writes update the
+            refcounts once per batch. Clusters still reserved when QEMU
+            exits without closing the image show up as leaks, which
+            ``qemu-img check -r leaks`` repairs (default: 0, which
+            disables the pool)
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
@@ -4440,6 +4504,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                load the migration stream from the given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4459,6 +4525,11 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Load the migration stream from a given file, as written by
+    ``migrate file:filename``.  Required to load a file written with
+    the ``mapped-ram`` migration capability.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# Bench copy offloading of mirror and backup block-jobs
+#
+# Both images are on the same file system, so that copies can be offloaded
+# with reflinks or copy_file_range().  Each job is compared with the same
+# job copying through bounce buffers: for backup by disabling
+# x-perf.use-copy-range, for mirror by putting a blkdebug node (which cannot
+# offload copies) between the target image and its file.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+import sys
+import os
+import subprocess
+import json
+
+import simplebench
+from results_to_text import results_to_text
+from bench_block_job import bench_block_copy, drv_file
+
+
+IMAGE_SIZE = '4G'
+
+
+def bench_func(env, case):
+    source = os.path.join(case['dir'], 'copy-offload-source.raw')
+    target = os.path.join(case['dir'], 'copy-offload-target.raw')
+
+    # A fresh target for every run, so that nothing is shared with the
+    # source before the job starts
+    try:
+        os.remove(target)
+    except OSError:
+        pass
+    subprocess.run([env['qemu-img-binary'], 'create', '-f', 'raw', target,
+                    IMAGE_SIZE], stdout=subprocess.DEVNULL,
+                   stderr=subprocess.DEVNULL, check=True)
+
+    target_node = drv_file(target, o_direct=False)
+    if not env['offload'] and env['cmd'] == 'blockdev-mirror':
+        target_node = {'driver': 'blkdebug', 'image': target_node}
+
+    cmd_options = {}
+    if env['cmd'] == 'blockdev-backup':
+        cmd_options['x-perf'] = {'use-copy-range': env['offload']}
+
+    return bench_block_copy(env['qemu-binary'], env['cmd'], cmd_options,
+                            {'driver': 'raw',
+                             'file': drv_file(source, o_direct=False)},
+                            {'driver': 'raw', 'file': target_node})
+
+
+def prepare_source(qemu_img, qemu_io, path):
+    source = os.path.join(path, 'copy-offload-source.raw')
+    subprocess.run([qemu_img, 'create', '-f', 'raw', source, IMAGE_SIZE],
+                   stdout=subprocess.DEVNULL, check=True)
+    subprocess.run([qemu_io, '-f', 'raw', '-c',
+                    f'write -P 0x5a 0 {IMAGE_SIZE}', source],
+                   stdout=subprocess.DEVNULL, check=True)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 5:
+        print(f'USAGE: {sys.argv[0]} <qemu binary> <qemu-img binary> '
+              '<qemu-io binary> DISK_NAME:DIR_PATH ...')
+        exit(1)
+
+    qemu, qemu_img, qemu_io = sys.argv[1:4]
+
+    envs = []
+    for cmd in ('blockdev-backup', 'blockdev-mirror'):
+        for offload in (False, True):
+            envs.append({
+                'id': f"{cmd.split('-')[1]}, "
+                      f"{'offload' if offload else 'bounce buffers'}",
+                'cmd': cmd,
+                'offload': offload,
+                'qemu-binary': qemu,
+                'qemu-img-binary': qemu_img
+            })
+
+    cases = []
+    for disk in sys.argv[4:]:
+        name, path = disk.split(':')
+        prepare_source(qemu_img, qemu_io, path)
+        cases.append({
+            'id': f'{name}, {IMAGE_SIZE} raw',
+            'dir': path
+        })
+
+    result = simplebench.bench(bench_func, envs, cases, count=3)
+    print(results_to_text(result))
+    with open('results.json', 'w') as f:
+        json.dump(result, f, indent=4)
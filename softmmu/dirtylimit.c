@@ -0,0 +1,311 @@
+/*
+ * Dirty page rate limit implementation code
+ *
+ * Each vCPU with a limit is put to sleep every time its KVM dirty ring
+ * gets full.  Once per period the dirty page rate of every vCPU is
+ * measured from the ring counts, and the sleep time of the limited
+ * vCPUs is adjusted so that their rings fill up at the limit rate.
+ * vCPUs that dirty memory more slowly than their limit never sleep.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "exec/memory.h"
+#include "exec/target_page.h"
+#include "hw/boards.h"
+#include "hw/core/cpu.h"
+#include "sysemu/dirtylimit.h"
+#include "sysemu/kvm.h"
+#include "trace.h"
+
+/* Period over which the dirty page rate of the vCPUs is measured */
+#define DIRTYLIMIT_CALC_PERIOD_MS 1000
+/* Longest sleep imposed on a vCPU for one full dirty ring */
+#define DIRTYLIMIT_THROTTLE_MAX_US (2 * G_USEC_PER_SEC)
+/* vCPUs sleep in slices so that they can still be stopped quickly */
+#define DIRTYLIMIT_SLEEP_SLICE_US 10000
+
+typedef struct VcpuDirtyLimitState {
+    /* dirty page rate limit in MB/s, 0 if the vCPU is not limited */
+    uint64_t quota;
+    /* dirty page rate in MB/s measured over the last period */
+    uint64_t current_rate;
+    /* CPUState.dirty_pages at the start of the current period */
+    uint64_t last_dirty_pages;
+} VcpuDirtyLimitState;
+
+typedef struct DirtyLimitState {
+    VcpuDirtyLimitState *states;
+    int max_cpus;
+    /* number of vCPUs with a limit */
+    int limited_nvcpu;
+    QEMUTimer *timer;
+    int64_t last_calc_ms;
+} DirtyLimitState;
+
+/* Protected by the BQL, only exists while at least one vCPU is limited */
+static DirtyLimitState *dirtylimit_state;
+
+/*
+ * Limits set through QMP, indexed by cpu_index, and the limit of every
+ * vCPU while migration throttles the guest.  Protected by the BQL.  A
+ * vCPU with both limits gets the lower one.
+ */
+static uint64_t *dirtylimit_user_quota;
+static uint64_t dirtylimit_migration_quota;
+
+static void dirtylimit_adjust_throttle(CPUState *cpu, VcpuDirtyLimitState *v)
+{
+    uint64_t ring_bytes = (uint64_t)kvm_dirty_ring_size() *
+                          qemu_target_page_size();
+    int64_t throttle_us = qatomic_read(&cpu->throttle_us_per_full);
+    int64_t ring_full_us, quota_full_us;
+
+    if (!v->current_rate) {
+        throttle_us = 0;
+    } else {
+        /*
+         * Time it takes to fill the ring at the measured rate, which
+         * already includes the current sleep, and at the quota.  Adding
+         * the difference to the sleep makes the ring fill at the quota.
+         */
+        ring_full_us = ring_bytes * G_USEC_PER_SEC / (v->current_rate * MiB);
+        quota_full_us = ring_bytes * G_USEC_PER_SEC / (v->quota * MiB);
+        throttle_us += quota_full_us - ring_full_us;
+    }
+    throttle_us = MIN(MAX(throttle_us, 0), DIRTYLIMIT_THROTTLE_MAX_US);
+
+    trace_dirtylimit_adjust_throttle(cpu->cpu_index, v->quota,
+                                     v->current_rate, throttle_us);
+    qatomic_set(&cpu->throttle_us_per_full, throttle_us);
+}
+
+static void dirtylimit_calc_tick(void *opaque)
+{
+    DirtyLimitState *s = dirtylimit_state;
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    int64_t period = MAX(now - s->last_calc_ms, 1);
+    CPUState *cpu;
+
+    /* Collect the pages that are still sitting in the dirty rings */
+    memory_global_dirty_log_sync();
+
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *v = &s->states[cpu->cpu_index];
+        uint64_t dirty_pages = cpu->dirty_pages;
+
+        v->current_rate = (dirty_pages - v->last_dirty_pages) *
+                          qemu_target_page_size() * 1000 / period / MiB;
+        v->last_dirty_pages = dirty_pages;
+        if (v->quota) {
+            dirtylimit_adjust_throttle(cpu, v);
+        }
+    }
+
+    s->last_calc_ms = now;
+    timer_mod(s->timer, now + DIRTYLIMIT_CALC_PERIOD_MS);
+}
+
+static void dirtylimit_state_init(void)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    DirtyLimitState *s = g_new0(DirtyLimitState, 1);
+    CPUState *cpu;
+
+    s->max_cpus = ms->smp.max_cpus;
+    s->states = g_new0(VcpuDirtyLimitState, s->max_cpus);
+    s->timer = timer_new_ms(QEMU_CLOCK_REALTIME, dirtylimit_calc_tick, NULL);
+    dirtylimit_state = s;
+
+    memory_global_dirty_log_start(GLOBAL_DIRTY_LIMIT);
+
+    CPU_FOREACH(cpu) {
+        s->states[cpu->cpu_index].last_dirty_pages = cpu->dirty_pages;
+    }
+    s->last_calc_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    timer_mod(s->timer, s->last_calc_ms + DIRTYLIMIT_CALC_PERIOD_MS);
+}
+
+static void dirtylimit_state_finalize(void)
+{
+    DirtyLimitState *s = dirtylimit_state;
+
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_LIMIT);
+
+    timer_free(s->timer);
+    g_free(s->states);
+    g_free(s);
+    dirtylimit_state = NULL;
+}
+
+static void dirtylimit_apply_vcpu(int cpu_index)
+{
+    uint64_t quota = dirtylimit_migration_quota;
+    VcpuDirtyLimitState *v;
+
+    if (dirtylimit_user_quota && dirtylimit_user_quota[cpu_index] &&
+        (!quota || dirtylimit_user_quota[cpu_index] < quota)) {
+        quota = dirtylimit_user_quota[cpu_index];
+    }
+
+    if (!dirtylimit_state) {
+        if (!quota) {
+            return;
+        }
+        dirtylimit_state_init();
+    }
+
+    assert(cpu_index < dirtylimit_state->max_cpus);
+    v = &dirtylimit_state->states[cpu_index];
+    if (!v->quota && quota) {
+        dirtylimit_state->limited_nvcpu++;
+    } else if (v->quota && !quota) {
+        dirtylimit_state->limited_nvcpu--;
+        qatomic_set(&qemu_get_cpu(cpu_index)->throttle_us_per_full, 0);
+    }
+    v->quota = quota;
+    trace_dirtylimit_set_vcpu(cpu_index, quota);
+
+    if (!dirtylimit_state->limited_nvcpu) {
+        dirtylimit_state_finalize();
+    }
+}
+
+void dirtylimit_set_vcpu(int cpu_index, uint64_t quota)
+{
+    if (!dirtylimit_user_quota) {
+        MachineState *ms = MACHINE(qdev_get_machine());
+
+        dirtylimit_user_quota = g_new0(uint64_t, ms->smp.max_cpus);
+    }
+
+    dirtylimit_user_quota[cpu_index] = quota;
+    dirtylimit_apply_vcpu(cpu_index);
+}
+
+void dirtylimit_set_all(uint64_t quota)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        dirtylimit_set_vcpu(cpu->cpu_index, quota);
+    }
+}
+
+void dirtylimit_set_migration(uint64_t quota)
+{
+    CPUState *cpu;
+
+    dirtylimit_migration_quota = quota;
+    CPU_FOREACH(cpu) {
+        dirtylimit_apply_vcpu(cpu->cpu_index);
+    }
+}
+
+bool dirtylimit_in_service(void)
+{
+    return !!dirtylimit_state;
+}
+
+void dirtylimit_vcpu_execute(CPUState *cpu)
+{
+    int64_t sleep_us = qatomic_read(&cpu->throttle_us_per_full);
+
+    if (!sleep_us) {
+        return;
+    }
+
+    trace_dirtylimit_vcpu_execute(cpu->cpu_index, sleep_us);
+    while (sleep_us > 0 && !qatomic_read(&cpu->stop)) {
+        int64_t slice_us = MIN(sleep_us, DIRTYLIMIT_SLEEP_SLICE_US);
+
+        g_usleep(slice_us);
+        sleep_us -= slice_us;
+    }
+}
+
+static bool dirtylimit_check(bool has_cpu_index, int64_t cpu_index,
+                             Error **errp)
+{
+    if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+        error_setg(errp, "dirty page limit requires KVM with accelerator"
+                   " property 'dirty-ring-size' set");
+        return false;
+    }
+
+    if (has_cpu_index && !qemu_get_cpu(cpu_index)) {
+        error_setg(errp, "incorrect cpu index specified");
+        return false;
+    }
+
+    return true;
+}
+
+void qmp_set_vcpu_dirty_limit(bool has_cpu_index,
+                              int64_t cpu_index,
+                              uint64_t dirty_rate,
+                              Error **errp)
+{
+    if (!dirtylimit_check(has_cpu_index, cpu_index, errp)) {
+        return;
+    }
+
+    if (!dirty_rate) {
+        error_setg(errp, "dirty rate must be at least 1 MB/s");
+        return;
+    }
+
+    if (has_cpu_index) {
+        dirtylimit_set_vcpu(cpu_index, dirty_rate);
+    } else {
+        dirtylimit_set_all(dirty_rate);
+    }
+}
+
+void qmp_cancel_vcpu_dirty_limit(bool has_cpu_index,
+                                 int64_t cpu_index,
+                                 Error **errp)
+{
+    if (!dirtylimit_check(has_cpu_index, cpu_index, errp)) {
+        return;
+    }
+
+    if (has_cpu_index) {
+        dirtylimit_set_vcpu(cpu_index, 0);
+    } else {
+        dirtylimit_set_all(0);
+    }
+}
+
+DirtyLimitInfoList *qmp_query_vcpu_dirty_limit(Error **errp)
+{
+    DirtyLimitInfoList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!dirtylimit_state) {
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *v = &dirtylimit_state->states[cpu->cpu_index];
+        DirtyLimitInfo *info;
+
+        if (!v->quota) {
+            continue;
+        }
+        info = g_malloc0(sizeof(*info));
+        info->cpu_index = cpu->cpu_index;
+        info->limit_rate = v->quota;
+        info->current_rate = v->current_rate;
+        QAPI_LIST_APPEND(tail, info);
+    }
+
+    return head;
+}
@@ -961,7 +961,7 @@ void cpu_check_watchpoint(CPUState *cpu, vaddr addr, vaddr len,
 #endif /* CONFIG_TCG */
 
 /* Called from RCU critical section */
-static RAMBlock *qemu_get_ram_block(ram_addr_t addr)
+static RAMBlock *qemu_try_get_ram_block(ram_addr_t addr)
 {
     RAMBlock *block;
 
@@ -974,9 +974,7 @@ static RAMBlock *qemu_get_ram_block(ram_addr_t addr)
             goto found;
         }
     }
-
-    fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
-    abort();
+    return NULL;
 
 found:
     /* It is safe to write mru_block outside the iothread lock.  This
@@ -999,6 +997,18 @@ found:
     return block;
 }
 
+/* Called from RCU critical section */
+static RAMBlock *qemu_get_ram_block(ram_addr_t addr)
+{
+    RAMBlock *block = qemu_try_get_ram_block(addr);
+
+    if (!block) {
+        fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
+        abort();
+    }
+    return block;
+}
+
 static void tlb_reset_dirty_range_all(ram_addr_t start, ram_addr_t length)
 {
     CPUState *cpu;
@@ -2310,6 +2320,23 @@ void *qemu_map_ram_ptr(RAMBlock *ram_block, ram_addr_t addr)
     return ramblock_ptr(block, addr);
 }
 
+/*
+ * Return a host pointer to @size bytes of guest RAM at @addr, or NULL if
+ * they are not within one RAMBlock, for example because the block was
+ * unplugged.
+ *
+ * Called within RCU critical section.
+ */
+void *qemu_try_map_ram_ptr(ram_addr_t addr, ram_addr_t size)
+{
+    RAMBlock *block = qemu_try_get_ram_block(addr);
+
+    if (!block || addr - block->offset + size > block->used_length) {
+        return NULL;
+    }
+    return qemu_map_ram_ptr(block, addr - block->offset);
+}
+
 /* Return a host pointer to guest's ram. Similar to qemu_map_ram_ptr
  * but takes a size argument.
  *
@@ -26,6 +26,11 @@ LuringState *luring_init(Error **errp)
     abort();
 }
 
+LuringState *luring_init_polled(Error **errp)
+{
+    abort();
+}
+
 void luring_cleanup(LuringState *s)
 {
     abort();
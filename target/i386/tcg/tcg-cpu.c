@@ -54,6 +54,21 @@ static void x86_cpu_synchronize_from_tb(CPUState *cs,
     cpu->env.eip = tb->pc - tb->cs_base;
 }
 
+/* Besides the TB flags, the translator checks the CPUID vendor and features */
+static void x86_cpu_tb_cache_fingerprint(CPUState *cs, GString *s)
+{
+    X86CPU *cpu = X86_CPU(cs);
+    CPUX86State *env = &cpu->env;
+    int w;
+
+    g_string_append_printf(s, " vendor=%08x:%08x:%08x features=",
+                           env->cpuid_vendor1, env->cpuid_vendor2,
+                           env->cpuid_vendor3);
+    for (w = 0; w < FEATURE_WORDS; w++) {
+        g_string_append_printf(s, "%" PRIx64 ":", env->features[w]);
+    }
+}
+
 #ifndef CONFIG_USER_ONLY
 static bool x86_debug_check_breakpoint(CPUState *cs)
 {
@@ -72,6 +87,9 @@ static const struct TCGCPUOps x86_tcg_ops = {
     .synchronize_from_tb = x86_cpu_synchronize_from_tb,
     .cpu_exec_enter = x86_cpu_exec_enter,
     .cpu_exec_exit = x86_cpu_exec_exit,
+    .persistent_tb = true,
+    .tb_cache_fingerprint = x86_cpu_tb_cache_fingerprint,
+    .async_translate = true,
 #ifdef CONFIG_USER_ONLY
     .fake_user_interrupt = x86_cpu_do_interrupt,
     .record_sigsegv = x86_cpu_record_sigsegv,
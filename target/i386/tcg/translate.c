@@ -40,6 +40,9 @@
 #define PREFIX_VEX    0x20
 #define PREFIX_REX    0x40
 
+/* Maximum number of conditional branches leaving a superblock */
+#define MAX_SIDE_EXITS 8
+
 #ifdef TARGET_X86_64
 # define ctztl  ctz64
 # define clztl  clz64
@@ -104,6 +107,12 @@ typedef struct DisasContext {
     bool repz_opt; /* optimize jumps within repz instructions */
     bool cc_op_dirty;
 
+    /* superblock translation of a hot TB, see CF_HOT */
+    bool superblock;
+    int side_exits;
+    TCGLabel *side_exit_label[MAX_SIDE_EXITS];
+    target_ulong side_exit_eip[MAX_SIDE_EXITS];
+
     CCOp cc_op;  /* current CC operation */
     int mem_index; /* select memory access functions */
     uint32_t flags; /* all execution flags */
@@ -2331,12 +2340,38 @@ static void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
     }
 }
 
+/*
+ * In a superblock, translation continues at the target of a direct jump
+ * if it is further in the page where the TB starts.
+ */
+static bool gen_superblock_jmp(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (!s->superblock || pc <= s->pc ||
+        ((pc ^ s->base.pc_first) & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    s->pc = pc;
+    return true;
+}
+
 static inline void gen_jcc(DisasContext *s, int b,
                            target_ulong val, target_ulong next_eip)
 {
     TCGLabel *l1, *l2;
 
-    if (s->jmp_opt) {
+    if (s->superblock && s->side_exits < MAX_SIDE_EXITS && val > next_eip) {
+        /*
+         * Forward branch in a superblock: leave through a side exit
+         * emitted by i386_tr_tb_stop, and go on with the fallthrough.
+         */
+        l1 = gen_new_label();
+        gen_jcc1(s, b, l1);
+        s->side_exit_label[s->side_exits] = l1;
+        s->side_exit_eip[s->side_exits] = val;
+        s->side_exits++;
+    } else if (s->jmp_opt) {
         l1 = gen_new_label();
         gen_jcc1(s, b, l1);
 
@@ -6737,7 +6772,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        if (!gen_superblock_jmp(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0xea: /* ljmp im */
         {
@@ -6759,7 +6796,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        if (!gen_superblock_jmp(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -8591,7 +8630,10 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     /* select memory access functions */
     dc->mem_index = 0;
 #ifdef CONFIG_SOFTMMU
-    dc->mem_index = cpu_mmu_index(env, false);
+    /* As cpu_mmu_index(), but TBs may be translated on another thread.  */
+    dc->mem_index = cpl == 3 ? MMU_USER_IDX :
+        (!(flags & HF_SMAP_MASK) || (flags & AC_MASK))
+        ? MMU_KNOSMAP_IDX : MMU_KSMAP_IDX;
 #endif
     dc->cpuid_features = env->features[FEAT_1_EDX];
     dc->cpuid_ext_features = env->features[FEAT_1_ECX];
@@ -8607,6 +8649,9 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
      * is accounted separately.
      */
     dc->repz_opt = !dc->jmp_opt && !(cflags & CF_USE_ICOUNT);
+    dc->superblock = (cflags & CF_HOT) && dc->jmp_opt &&
+                     !(cflags & CF_USE_ICOUNT);
+    dc->side_exits = 0;
 
     dc->T0 = tcg_temp_new();
     dc->T1 = tcg_temp_new();
@@ -8680,11 +8725,21 @@ static void i386_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
 static void i386_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *dc = container_of(dcbase, DisasContext, base);
+    int i;
 
     if (dc->base.is_jmp == DISAS_TOO_MANY) {
         gen_jmp_im(dc, dc->base.pc_next - dc->cs_base);
         gen_eob(dc);
     }
+
+    /* gen_jcc1 has already stored cc_op before each side exit.  */
+    for (i = 0; i < dc->side_exits; i++) {
+        gen_set_label(dc->side_exit_label[i]);
+        dc->cc_op = CC_OP_DYNAMIC;
+        dc->cc_op_dirty = false;
+        gen_jmp_im(dc, dc->side_exit_eip[i]);
+        gen_jr(dc, dc->tmp0);
+    }
 }
 
 static void i386_tr_disas_log(const DisasContextBase *dcbase,
@@ -8703,6 +8758,7 @@ static const TranslatorOps i386_tr_ops = {
     .translate_insn     = i386_tr_translate_insn,
     .tb_stop            = i386_tr_tb_stop,
     .disas_log          = i386_tr_disas_log,
+    .hot_superblocks    = true,
 };
 
 /* generate intermediate code for basic block 'tb'.  */
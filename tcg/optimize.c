@@ -50,6 +50,8 @@ typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
     TCGTempSet temps_used;
+    /* Keep the data of globals and local temps across conditional branches */
+    bool ebb;
 
     /* In flight values from optimization. */
     uint64_t a_mask;  /* mask bit is 0 iff value identical to first input */
@@ -692,8 +694,30 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
     int i, nb_oargs;
 
     /*
-     * For an opcode that ends a BB, reset all temp data.
-     * We do no cross-BB optimization.
+     * A conditional branch does not end the extended basic block: the
+     * fallthrough is only reached from here, so the data of the globals
+     * and local temps remains valid.  The normal temps die at the branch.
+     */
+    if (ctx->ebb && (def->flags & TCG_OPF_COND_BRANCH)) {
+        TCGContext *s = ctx->tcg;
+
+        for (i = find_first_bit(ctx->temps_used.l, s->nb_temps);
+             i < s->nb_temps;
+             i = find_next_bit(ctx->temps_used.l, s->nb_temps, i + 1)) {
+            TCGTemp *ts = &s->temps[i];
+
+            if (ts->kind == TEMP_NORMAL) {
+                reset_ts(ts);
+                clear_bit(i, ctx->temps_used.l);
+            }
+        }
+        ctx->prev_mb = NULL;
+        return;
+    }
+
+    /*
+     * For any other opcode that ends a BB, reset all temp data.
+     * Without @ebb, we do no cross-BB optimization.
      */
     if (def->flags & TCG_OPF_BB_END) {
         memset(&ctx->temps_used, 0, sizeof(ctx->temps_used));
@@ -2023,11 +2047,11 @@ static bool fold_xor(OptContext *ctx, TCGOp *op)
 }
 
 /* Propagate constants and copies, fold constant expressions. */
-void tcg_optimize(TCGContext *s)
+void tcg_optimize(TCGContext *s, bool ebb)
 {
     int nb_temps, i;
     TCGOp *op, *op_next;
-    OptContext ctx = { .tcg = s };
+    OptContext ctx = { .tcg = s, .ebb = ebb };
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
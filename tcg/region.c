@@ -28,6 +28,7 @@
 #include "qemu/mprotect.h"
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
@@ -45,6 +46,10 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Once all regions have been handed out, the oldest full regions can be
+ * evicted (see tcg_region_evict()) and handed out again, instead of
+ * flushing the whole buffer.
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -60,6 +65,10 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t gen; /* number of region allocations since the last reset */
+    uint64_t *alloc_gen; /* .gen at the time each region was allocated */
+    unsigned long *evicted; /* evicted regions, available for allocation */
+    size_t n_evicted;
 };
 
 static struct tcg_region_state region;
@@ -167,10 +176,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* @p must point into the rw view of code_gen_buffer */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -182,18 +204,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
         }
     }
 
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -287,6 +298,14 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+/* Call with @rt->lock held */
+static void tcg_region_tree_reset__locked(struct tcg_region_tree *rt)
+{
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -295,9 +314,7 @@ static void tcg_region_tree_reset_all(void)
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
 
-        /* Increment the refcount first so that destroy acts as a reset */
-        g_tree_ref(rt->tree);
-        g_tree_destroy(rt->tree);
+        tcg_region_tree_reset__locked(rt);
     }
     tcg_region_tree_unlock_all();
 }
@@ -335,11 +352,19 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t i;
+
+    if (region.current < region.n) {
+        i = region.current++;
+    } else if (region.n_evicted) {
+        i = find_first_bit(region.evicted, region.n);
+        clear_bit(i, region.evicted);
+        region.n_evicted--;
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, i);
+    region.alloc_gen[i] = region.gen++;
     return false;
 }
 
@@ -388,6 +413,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.gen = 0;
+    bitmap_zero(region.evicted, region.n);
+    region.n_evicted = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -398,34 +426,139 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Returns true if tcg_region_alloc() would succeed, i.e. if there is no
+ * need to evict regions or to flush the whole buffer.
+ */
+bool tcg_region_available(void)
+{
+    bool ret;
+
+    qemu_mutex_lock(&region.lock);
+    ret = region.current < region.n || region.n_evicted;
+    qemu_mutex_unlock(&region.lock);
+    return ret;
+}
+
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/* Call with region.lock held */
+static bool tcg_region_in_use__locked(size_t i)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int j;
+
+    if (i >= region.current || test_bit(i, region.evicted)) {
+        return true;
+    }
+    for (j = 0; j < n_ctxs; j++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[j]);
+
+        if (tcg_region_index(s->code_gen_buffer) == i) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Evict up to @n of the least recently allocated regions that are full.
+ * @evict_tb is called for each TB of these regions, and must unlink the
+ * TB from everything that may still reference it; the regions are then
+ * emptied and made available for allocation again.
+ *
+ * Returns the number of evicted regions, which is zero if every region
+ * is in use by a TCG context.
+ *
+ * Call from a safe-work context.
+ */
+size_t tcg_region_evict(size_t n, void (*evict_tb)(TranslationBlock *tb))
+{
+    g_autofree unsigned long *victims = bitmap_new(region.n);
+    size_t n_victims;
+    size_t i, j;
+
+    qemu_mutex_lock(&region.lock);
+    for (n_victims = 0; n_victims < n; n_victims++) {
+        size_t oldest = region.n;
+
+        for (i = 0; i < region.n; i++) {
+            if (test_bit(i, victims) || tcg_region_in_use__locked(i)) {
+                continue;
+            }
+            if (oldest == region.n ||
+                region.alloc_gen[i] < region.alloc_gen[oldest]) {
+                oldest = i;
+            }
+        }
+        if (oldest == region.n) {
+            break;
+        }
+        set_bit(oldest, victims);
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    for (i = find_first_bit(victims, region.n); i < region.n;
+         i = find_next_bit(victims, region.n, i + 1)) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+        g_autoptr(GPtrArray) tbs = g_ptr_array_new();
+        void *start, *end;
+
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+        qemu_mutex_unlock(&rt->lock);
+
+        for (j = 0; j < tbs->len; j++) {
+            evict_tb(g_ptr_array_index(tbs, j));
+        }
+
+        qemu_mutex_lock(&rt->lock);
+        tcg_region_tree_reset__locked(rt);
+        qemu_mutex_unlock(&rt->lock);
+
+        tcg_region_bounds(i, &start, &end);
+        qemu_mutex_lock(&region.lock);
+        region.agg_size_full -= end - start - TCG_HIGHWATER;
+        set_bit(i, region.evicted);
+        region.n_evicted++;
+        qemu_mutex_unlock(&region.lock);
+    }
+    return n_victims;
+}
+
+/*
+ * Number of regions for each TCG context.  Regions are the unit of
+ * eviction, so use several of them even if a single context translates.
+ */
+#define TCG_REGIONS_PER_CTX 8
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
-#ifdef CONFIG_USER_ONLY
-    return 1;
-#else
-    size_t n_regions;
+    /* Try to have regions of at least 2 MB. */
+    size_t n_regions = tb_size / (2 * MiB);
 
+#ifndef CONFIG_USER_ONLY
     /*
      * It is likely that some vCPUs will translate more code than others,
      * so we first try to set more regions than max_cpus, with those regions
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
-    }
-
-    /*
-     * Try to have more regions than max_cpus, with each region being >= 2 MB.
-     * If we can't, then just allocate one region per vCPU thread.
-     */
-    n_regions = tb_size / (2 * MiB);
-    if (n_regions <= max_cpus) {
-        return max_cpus;
+    if (max_cpus > 1 && qemu_tcg_mttcg_enabled()) {
+        if (n_regions <= max_cpus) {
+            return max_cpus;
+        }
+        return MIN(n_regions, max_cpus * TCG_REGIONS_PER_CTX);
     }
-    return MIN(n_regions, max_cpus * 8);
 #endif
+
+    /* A single TCG context, either in !MTTCG or in user-mode */
+    return MAX(1, MIN(n_regions, TCG_REGIONS_PER_CTX));
 }
 
 /*
@@ -710,12 +843,14 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG the single TCG thread moves
+ * through a few regions, so that the oldest ones can be evicted.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
  *
- * In user-mode we use a single region.  Having multiple regions in user-mode
+ * In user-mode all threads share a single TCG context, which moves through
+ * a few regions like in !MTTCG.  Having one region per thread in user-mode
  * is not supported, because the number of vCPU threads (recall that each thread
  * spawned by the guest corresponds to a vCPU thread) is only bounded by the
  * OS, and usually this number is huge (tens of thousands is not uncommon).
@@ -786,6 +921,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.alloc_gen = g_new0(uint64_t, region.n);
+    region.evicted = bitmap_new(region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -893,3 +1030,41 @@ size_t tcg_code_capacity(void)
 
     return capacity;
 }
+
+/* Returns the number of regions that code_gen_buffer is split into. */
+size_t tcg_region_count(void)
+{
+    /* no need for synchronization; set at init time */
+    return region.n;
+}
+
+/*
+ * Execution counters of the TBs, indexed by the position of the TB in
+ * code_gen_buffer.  They live outside the buffer so that generated code
+ * never stores into it.  TBs are allocated at least tb_exec_count_stride
+ * bytes apart (see tcg_tb_alloc), so each TB gets a slot of its own.
+ */
+static uint32_t *tb_exec_counts;
+static size_t tb_exec_count_stride;
+
+void tcg_region_init_exec_counts(void)
+{
+    tb_exec_count_stride = ROUND_UP(sizeof(TranslationBlock),
+                                    qemu_icache_linesize);
+    tb_exec_counts = g_new0(uint32_t,
+                            region.total_size / tb_exec_count_stride + 1);
+}
+
+/* The generated code embeds the counter addresses */
+const void *tcg_region_exec_counts(void)
+{
+    return tb_exec_counts;
+}
+
+uint32_t *tcg_tb_exec_count(const TranslationBlock *tb)
+{
+    size_t off = (const void *)tb - region.start_aligned;
+
+    tcg_debug_assert(tb_exec_counts && off < region.total_size);
+    return &tb_exec_counts[off / tb_exec_count_stride];
+}
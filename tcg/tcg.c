@@ -69,6 +69,7 @@
 /* Forward declarations for functions declared in tcg-target.c.inc and
    used here. */
 static void tcg_target_init(TCGContext *s);
+static void tcg_target_host_features(GString *s);
 static void tcg_target_qemu_prologue(TCGContext *s);
 static bool patch_reloc(tcg_insn_unit *code_ptr, int type,
                         intptr_t value, intptr_t addend);
@@ -694,6 +695,12 @@ void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus)
     tcg_region_init(tb_size, splitwx, max_cpus);
 }
 
+/* Append the host features that the generated code relies on to @s */
+void tcg_host_features(GString *s)
+{
+    tcg_target_host_features(s);
+}
+
 /*
  * Allocate TBs right before their corresponding translated code, making
  * sure that TBs and code are on different cache lines.
@@ -4230,7 +4237,14 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
-    tcg_optimize(s);
+    /*
+     * A quick translation is soon replaced by an optimized one.  Only
+     * superblocks, which have many side exits, are optimized across
+     * conditional branches.
+     */
+    if (!(tb_cflags(tb) & CF_QUICK)) {
+        tcg_optimize(s, tb_cflags(tb) & CF_HOT);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
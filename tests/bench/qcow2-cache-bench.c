@@ -0,0 +1,168 @@
+/*
+ * qcow2 metadata cache benchmark
+ *
+ * Random 4k reads over a large sparse qcow2 image.  One cluster of each
+ * populated L2 table range is written as zeroes, so that the L2 table
+ * exists but no data needs to be read: the run time is dominated by the
+ * L2 cache lookups.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qapi/qmp/qdict.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+
+#define READ_SIZE 4096
+
+/* One L2 table of a 64k cluster image maps 512 MiB */
+#define L2_TABLE_RANGE (512 * MiB)
+
+static uint64_t image_size = 4 * TiB;
+static uint64_t table_stride = 16;
+static const char *l2_cache_size = "32M";
+static const char *l2_cache_entry_size = "4k";
+static unsigned long nr_reads = 1000000;
+
+static const char commands_string[] =
+    " -s = image size (default 4T)\n"
+    " -t = populate every t-th L2 table (default 16)\n"
+    " -c = l2-cache-size (default 32M)\n"
+    " -e = l2-cache-entry-size (default 4k)\n"
+    " -n = number of reads (default 1000000)\n";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "c:e:hn:s:t:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'c':
+            l2_cache_size = optarg;
+            break;
+        case 'e':
+            l2_cache_entry_size = optarg;
+            break;
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            nr_reads = atol(optarg);
+            break;
+        case 's':
+            if (qemu_strtosz(optarg, NULL, &image_size) < 0) {
+                fprintf(stderr, "Invalid image size '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 't':
+            table_stride = atol(optarg);
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+
+    if (!table_stride || image_size < L2_TABLE_RANGE * table_stride) {
+        fprintf(stderr, "The image must have at least one populated "
+                "L2 table\n");
+        exit(1);
+    }
+}
+
+static void print_cache_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = bdrv_get_specific_stats(bs);
+    Qcow2CacheStats *l2;
+
+    assert(stats && stats->driver == BLOCKDEV_DRIVER_QCOW2);
+    l2 = stats->u.qcow2.l2_cache;
+    printf("L2 cache hits:      %" PRIu64 "\n", l2->hits);
+    printf("L2 cache misses:    %" PRIu64 "\n", l2->misses);
+    printf("L2 cache evictions: %" PRIu64 "\n", l2->evictions);
+    qapi_free_BlockStatsSpecific(stats);
+}
+
+int main(int argc, char *argv[])
+{
+    g_autofree char *filename = NULL;
+    uint64_t nr_tables;
+    uint8_t *buf;
+    BlockBackend *blk;
+    QDict *options;
+    GRand *rand;
+    int64_t start, elapsed;
+    unsigned long i;
+    int fd;
+
+    parse_args(argc, argv);
+
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    fd = g_file_open_tmp("qcow2-cache-bench-XXXXXX", &filename, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+
+    bdrv_img_create(filename, "qcow2", NULL, NULL, NULL, image_size, 0, true,
+                    &error_abort);
+
+    options = qdict_new();
+    qdict_put_str(options, "driver", "qcow2");
+    qdict_put_str(options, "l2-cache-size", l2_cache_size);
+    qdict_put_str(options, "l2-cache-entry-size", l2_cache_entry_size);
+    blk = blk_new_open(filename, NULL, options, BDRV_O_RDWR, &error_abort);
+
+    nr_tables = image_size / L2_TABLE_RANGE / table_stride;
+    for (i = 0; i < nr_tables; i++) {
+        int ret = blk_pwrite_zeroes(blk, i * table_stride * L2_TABLE_RANGE,
+                                    64 * KiB, 0);
+        g_assert(ret >= 0);
+    }
+
+    buf = blk_blockalign(blk, READ_SIZE);
+    rand = g_rand_new_with_seed(1);
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < nr_reads; i++) {
+        uint64_t table = g_rand_int_range(rand, 0, nr_tables);
+        uint64_t offset = (uint64_t)g_rand_int_range(rand, 0,
+                                                     L2_TABLE_RANGE / READ_SIZE)
+                          * READ_SIZE;
+        int ret = blk_pread(blk, table * table_stride * L2_TABLE_RANGE + offset,
+                            buf, READ_SIZE);
+        g_assert(ret >= 0);
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    printf("%lu random %d byte reads over %" PRIu64 " L2 tables in "
+           "%.3f s: %.0f reads/s\n", nr_reads, READ_SIZE, nr_tables,
+           elapsed / 1e6, nr_reads / (elapsed / 1e6));
+    print_cache_stats(blk_bs(blk));
+
+    g_rand_free(rand);
+    qemu_vfree(buf);
+    blk_unref(blk);
+    unlink(filename);
+
+    return 0;
+}
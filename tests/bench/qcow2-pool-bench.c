@@ -0,0 +1,160 @@
+/*
+ * qcow2 cluster pool benchmark
+ *
+ * Allocating writes with many requests in flight: every request writes
+ * 4k into a cluster of its own that is still unallocated, so each one
+ * has to allocate a data cluster.  Compare "-p 0", which disables the
+ * cluster pool, with a pool size.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+
+#define WRITE_SIZE 4096
+#define CLUSTER_SIZE (64 * KiB)
+
+static const char *pool_size = "1M";
+static unsigned long nr_writes = 100000;
+static unsigned int queue_depth = 32;
+static bool nocache;
+
+static const char commands_string[] =
+    " -p = cluster-pool-size (default 1M, 0 disables the pool)\n"
+    " -n = number of writes (default 100000)\n"
+    " -q = number of writes in flight (default 32)\n"
+    " -d = open the image with cache.direct=on\n";
+
+typedef struct {
+    BlockBackend *blk;
+    QEMUIOVector qiov;
+    unsigned long next;
+    unsigned long done;
+    unsigned int in_flight;
+} BenchState;
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "dhn:p:q:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'd':
+            nocache = true;
+            break;
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            nr_writes = atol(optarg);
+            break;
+        case 'p':
+            pool_size = optarg;
+            break;
+        case 'q':
+            queue_depth = atoi(optarg);
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+
+    if (!nr_writes || !queue_depth) {
+        fprintf(stderr, "-n and -q must be positive\n");
+        exit(1);
+    }
+}
+
+static void submit_writes(BenchState *b);
+
+static void write_cb(void *opaque, int ret)
+{
+    BenchState *b = opaque;
+
+    g_assert(ret >= 0);
+    b->in_flight--;
+    b->done++;
+    submit_writes(b);
+}
+
+static void submit_writes(BenchState *b)
+{
+    while (b->in_flight < queue_depth && b->next < nr_writes) {
+        uint64_t offset = b->next++ * CLUSTER_SIZE;
+
+        b->in_flight++;
+        blk_aio_pwritev(b->blk, offset, &b->qiov, 0, write_cb, b);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_autofree char *filename = NULL;
+    BenchState b = { 0 };
+    QDict *options;
+    uint8_t *buf;
+    int64_t start, elapsed;
+    int fd;
+
+    parse_args(argc, argv);
+
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    fd = g_file_open_tmp("qcow2-pool-bench-XXXXXX", &filename, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+
+    bdrv_img_create(filename, "qcow2", NULL, NULL, NULL,
+                    nr_writes * CLUSTER_SIZE, 0, true, &error_abort);
+
+    options = qdict_new();
+    qdict_put_str(options, "driver", "qcow2");
+    qdict_put_str(options, "cluster-pool-size", pool_size);
+    b.blk = blk_new_open(filename, NULL, options,
+                         BDRV_O_RDWR | (nocache ? BDRV_O_NOCACHE : 0),
+                         &error_abort);
+
+    buf = blk_blockalign(b.blk, WRITE_SIZE);
+    memset(buf, 0xa5, WRITE_SIZE);
+    qemu_iovec_init_buf(&b.qiov, buf, WRITE_SIZE);
+
+    start = g_get_monotonic_time();
+    submit_writes(&b);
+    while (b.done < nr_writes) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+    g_assert(blk_flush(b.blk) == 0);
+    elapsed = g_get_monotonic_time() - start;
+
+    printf("%lu allocating %d byte writes, %u in flight, "
+           "cluster-pool-size=%s: %.3f s, %.0f writes/s\n",
+           nr_writes, WRITE_SIZE, queue_depth, pool_size,
+           elapsed / 1e6, nr_writes / (elapsed / 1e6));
+
+    qemu_vfree(buf);
+    blk_unref(b.blk);
+    unlink(filename);
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Xor Based Zero Run Length Encoding speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define XBZRLE_PAGE_SIZE 4096
+#define XBZRLE_BENCH_PAGES (64 * MiB / XBZRLE_PAGE_SIZE)
+#define XBZRLE_BENCH_TOTAL (4 * GiB)
+#define XBZRLE_BENCH_RUN 32
+
+typedef struct XBZRLEBenchProfile {
+    const char *name;
+    /* Dirty bytes per million bytes of the page */
+    unsigned ppm;
+} XBZRLEBenchProfile;
+
+static const XBZRLEBenchProfile profiles[] = {
+    { "clean", 0 },
+    { "0.1%", 1000 },
+    { "1%", 10000 },
+    { "10%", 100000 },
+    { "50%", 500000 },
+};
+
+static void dirty_pages(uint8_t *old_buf, uint8_t *new_buf, unsigned ppm)
+{
+    size_t runs = (uint64_t)XBZRLE_PAGE_SIZE * ppm / 1000000 /
+                  XBZRLE_BENCH_RUN;
+    size_t i, j;
+
+    memcpy(new_buf, old_buf, XBZRLE_BENCH_PAGES * XBZRLE_PAGE_SIZE);
+
+    /* Sub-run-sized ratios still touch one byte per page */
+    if (ppm && !runs) {
+        for (i = 0; i < XBZRLE_BENCH_PAGES; i++) {
+            new_buf[i * XBZRLE_PAGE_SIZE +
+                    g_test_rand_int_range(0, XBZRLE_PAGE_SIZE)] ^= 0xff;
+        }
+        return;
+    }
+
+    for (i = 0; i < XBZRLE_BENCH_PAGES; i++) {
+        uint8_t *page = new_buf + i * XBZRLE_PAGE_SIZE;
+
+        for (j = 0; j < runs; j++) {
+            int start = g_test_rand_int_range(0, XBZRLE_PAGE_SIZE -
+                                                 XBZRLE_BENCH_RUN);
+            int k;
+
+            for (k = start; k < start + XBZRLE_BENCH_RUN; k++) {
+                page[k] = ~page[k];
+            }
+        }
+    }
+}
+
+static void test_xbzrle_encode_speed(void)
+{
+    size_t buf_size = XBZRLE_BENCH_PAGES * XBZRLE_PAGE_SIZE;
+    uint8_t *old_buf = g_malloc(buf_size);
+    uint8_t *new_buf = g_malloc(buf_size);
+    uint8_t *dst = g_malloc(XBZRLE_PAGE_SIZE);
+    uint32_t *p = (uint32_t *)old_buf;
+    int accel = 0;
+    size_t i;
+
+    for (i = 0; i < buf_size / sizeof(*p); i++) {
+        p[i] = g_test_rand_int();
+    }
+
+    /*
+     * The first encoder is the best one for this host, the last one is
+     * the scalar fallback.
+     */
+    do {
+        for (i = 0; i < ARRAY_SIZE(profiles); i++) {
+            uint64_t done = 0;
+            size_t page = 0;
+
+            dirty_pages(old_buf, new_buf, profiles[i].ppm);
+
+            g_test_timer_start();
+            while (done < XBZRLE_BENCH_TOTAL) {
+                size_t offset = page * XBZRLE_PAGE_SIZE;
+
+                xbzrle_encode_buffer(old_buf + offset, new_buf + offset,
+                                     XBZRLE_PAGE_SIZE, dst, XBZRLE_PAGE_SIZE);
+                page = (page + 1) % XBZRLE_BENCH_PAGES;
+                done += XBZRLE_PAGE_SIZE;
+            }
+            g_test_timer_elapsed();
+
+            g_test_message("xbzrle encode: encoder %d dirty %s %.2f GB/sec",
+                           accel, profiles[i].name,
+                           done / g_test_timer_last() / GiB);
+        }
+        accel++;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/xbzrle/benchmark/encode", test_xbzrle_encode_speed);
+
+    return g_test_run();
+}
@@ -15,6 +15,7 @@
 #include "libqos/libqtest.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/range.h"
@@ -474,6 +475,10 @@ typedef struct {
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* Send requested pages over a separate postcopy channel */
+    bool postcopy_preempt;
+    /* Keep sending background pages over multifd during postcopy */
+    bool postcopy_multifd;
     char *opts_source;
     char *opts_target;
 } MigrateStart;
@@ -666,6 +671,8 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
                                     MigrateStart *args)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    bool postcopy_preempt = args->postcopy_preempt;
+    bool postcopy_multifd = args->postcopy_multifd;
     QTestState *from, *to;
 
     if (test_migrate_start(&from, &to, uri, &args)) {
@@ -676,6 +683,20 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
     migrate_set_capability(to, "postcopy-ram", true);
     migrate_set_capability(to, "postcopy-blocktime", true);
 
+    if (postcopy_preempt) {
+        migrate_set_capability(from, "postcopy-preempt", true);
+        migrate_set_capability(to, "postcopy-preempt", true);
+    }
+
+    if (postcopy_multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+        migrate_set_capability(from, "multifd", true);
+        migrate_set_capability(to, "multifd", true);
+        migrate_set_capability(from, "multifd-postcopy", true);
+        migrate_set_capability(to, "multifd-postcopy", true);
+    }
+
     /* We want to pick a speed slow enough that the test completes
      * quickly, but that it doesn't complete precopy even on a slow
      * machine, so also set the downtime.
@@ -722,6 +743,47 @@ static void test_postcopy(void)
     migrate_postcopy_complete(from, to);
 }
 
+static void test_postcopy_preempt(void)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp_return;
+
+    args->postcopy_preempt = true;
+
+    if (migrate_postcopy_prepare(&from, &to, args)) {
+        return;
+    }
+    migrate_postcopy_start(from, to);
+    wait_for_migration_complete(from);
+
+    /* Make sure we get at least one "B" on destination */
+    wait_for_serial("dest_serial");
+
+    /* The guest faulted on pages during postcopy, so latencies are known */
+    rsp_return = migrate_query(to);
+    g_assert(qdict_haskey(rsp_return, "postcopy-latency-p50"));
+    g_assert_cmpint(qdict_get_int(rsp_return, "postcopy-latency-p50"), <=,
+                    qdict_get_int(rsp_return, "postcopy-latency-p99"));
+    qobject_unref(rsp_return);
+
+    test_migrate_end(from, to, true);
+}
+
+static void test_postcopy_multifd(void)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    args->postcopy_multifd = true;
+
+    if (migrate_postcopy_prepare(&from, &to, args)) {
+        return;
+    }
+    migrate_postcopy_start(from, to);
+    migrate_postcopy_complete(from, to);
+}
+
 static void test_postcopy_recovery(void)
 {
     MigrateStart *args = migrate_start_new();
@@ -799,11 +861,12 @@ static void test_baddest(void)
     test_migrate_end(from, to, false);
 }
 
-static void test_precopy_unix_common(bool dirty_ring)
+static void test_precopy_unix_common(bool dirty_ring, int dirty_sync_threads)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
+    QDict *rsp_return, *rsp_ram;
 
     args->use_dirty_ring = dirty_ring;
 
@@ -819,6 +882,7 @@ static void test_precopy_unix_common(bool dirty_ring)
     migrate_set_parameter_int(from, "downtime-limit", 1);
     /* 1GB/s */
     migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+    migrate_set_parameter_int(from, "dirty-sync-threads", dirty_sync_threads);
 
     /* Wait for the first serial output from the source */
     wait_for_serial("src_serial");
@@ -827,6 +891,14 @@ static void test_precopy_unix_common(bool dirty_ring)
 
     wait_for_migration_pass(from);
 
+    /* A fast enough sync may well be reported as taking 0 us */
+    rsp_return = migrate_query(from);
+    rsp_ram = qdict_get_qdict(rsp_return, "ram");
+    g_assert(rsp_ram);
+    g_assert(qdict_haskey(rsp_ram, "dirty-sync-latency-max"));
+    g_assert_cmpint(qdict_get_int(rsp_ram, "dirty-sync-latency-max"), >=, 0);
+    qobject_unref(rsp_return);
+
     migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
 
     if (!got_stop) {
@@ -844,13 +916,83 @@ static void test_precopy_unix_common(bool dirty_ring)
 static void test_precopy_unix(void)
 {
     /* Using default dirty logging */
-    test_precopy_unix_common(false);
+    test_precopy_unix_common(false, 1);
+}
+
+static void test_precopy_unix_dirty_sync_threads(void)
+{
+    /* Sync the dirty bitmap from a pool of threads */
+    test_precopy_unix_common(false, 4);
 }
 
 static void test_precopy_unix_dirty_ring(void)
 {
     /* Using dirty ring tracking */
-    test_precopy_unix_common(true);
+    test_precopy_unix_common(true, 1);
+}
+
+static int query_vcpu_dirty_limit_count(QTestState *who)
+{
+    QDict *rsp = qtest_qmp(who, "{ 'execute': 'query-vcpu-dirty-limit' }");
+    QList *list;
+    int count;
+
+    g_assert(qdict_haskey(rsp, "return"));
+    list = qdict_get_qlist(rsp, "return");
+    count = list ? qlist_size(list) : 0;
+    qobject_unref(rsp);
+
+    return count;
+}
+
+static void test_precopy_unix_dirty_limit(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    args->use_dirty_ring = true;
+
+    if (test_migrate_start(&from, &to, uri, &args)) {
+        return;
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    qtest_qmp_assert_success(from, "{ 'execute': 'set-vcpu-dirty-limit',"
+                             "  'arguments': { 'cpu-index': 0,"
+                             "                 'dirty-rate': 100 } }");
+    g_assert_cmpint(query_vcpu_dirty_limit_count(from), ==, 1);
+    qtest_qmp_assert_success(from, "{ 'execute': 'cancel-vcpu-dirty-limit' }");
+    g_assert_cmpint(query_vcpu_dirty_limit_count(from), ==, 0);
+
+    migrate_set_capability(from, "dirty-limit", true);
+    migrate_set_parameter_int(from, "vcpu-dirty-limit", 1);
+    /* 1 ms should make it not converge */
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+
+    migrate_qmp(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /* Whatever limits migration set are gone with it */
+    g_assert_cmpint(query_vcpu_dirty_limit_count(from), ==, 0);
+
+    test_migrate_end(from, to, true);
 }
 
 #if 0
@@ -1069,6 +1211,53 @@ static void test_migrate_fd_proto(void)
     test_migrate_end(from, to, true);
 }
 
+static void test_mapped_ram_file(void)
+{
+    MigrateStart *args = migrate_start_new();
+    g_autofree char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+    migrate_set_parameter_int(to, "mapped-ram-threads", 2);
+
+    /* 1 ms should make it not converge */
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    /* Pages dirtied in later passes are rewritten in place */
+    wait_for_migration_pass(from);
+
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+    g_assert_cmpint(read_ram_property_int(from, "mapped-ram-bytes"), >, 0);
+
+    /* Only read the file back once it is complete */
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+}
+
 static void do_test_validate_uuid(MigrateStart *args, bool should_fail)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -1228,7 +1417,7 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static void test_multifd_tcp(const char *method, bool zero_page)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1258,6 +1447,11 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", true);
     migrate_set_capability(to, "multifd", true);
 
+    if (zero_page) {
+        migrate_set_capability(from, "multifd-zero-page", true);
+        migrate_set_capability(to, "multifd-zero-page", true);
+    }
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1286,21 +1480,43 @@ static void test_multifd_tcp(const char *method)
 
 static void test_multifd_tcp_none(void)
 {
-    test_multifd_tcp("none");
+    test_multifd_tcp("none", false);
+}
+
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp("none", true);
 }
 
 static void test_multifd_tcp_zlib(void)
 {
-    test_multifd_tcp("zlib");
+    test_multifd_tcp("zlib", false);
 }
 
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
-    test_multifd_tcp("zstd");
+    test_multifd_tcp("zstd", false);
 }
 #endif
 
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    test_multifd_tcp("lz4", false);
+}
+#endif
+
+static void test_multifd_tcp_xbzrle(void)
+{
+    test_multifd_tcp("xbzrle", false);
+}
+
+static void test_multifd_tcp_xbzrle_zero_page(void)
+{
+    test_multifd_tcp("xbzrle", true);
+}
+
 /*
  * This test does:
  *  source               target
@@ -1462,12 +1678,17 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/postcopy/unix", test_postcopy);
     qtest_add_func("/migration/postcopy/recovery", test_postcopy_recovery);
+    qtest_add_func("/migration/postcopy/preempt/plain", test_postcopy_preempt);
+    qtest_add_func("/migration/postcopy/multifd", test_postcopy_multifd);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
+    qtest_add_func("/migration/precopy/unix/dirty-sync-threads",
+                   test_precopy_unix_dirty_sync_threads);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
+    qtest_add_func("/migration/mapped-ram/file", test_mapped_ram_file);
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
     qtest_add_func("/migration/validate_uuid_error", test_validate_uuid_error);
     qtest_add_func("/migration/validate_uuid_src_not_set",
@@ -1477,15 +1698,25 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
+    qtest_add_func("/migration/multifd/tcp/xbzrle", test_multifd_tcp_xbzrle);
+    qtest_add_func("/migration/multifd/tcp/xbzrle/zero-page",
+                   test_multifd_tcp_xbzrle_zero_page);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
 #endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/lz4", test_multifd_tcp_lz4);
+#endif
 
     if (kvm_dirty_ring_supported()) {
         qtest_add_func("/migration/dirty_ring",
                        test_precopy_unix_dirty_ring);
+        qtest_add_func("/migration/dirty_limit",
+                       test_precopy_unix_dirty_limit);
     }
 
     ret = g_test_run();
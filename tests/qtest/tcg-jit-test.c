@@ -0,0 +1,223 @@
+/*
+ * QTest testcase for the TCG translation cache
+ *
+ * Boot the BIOS and a boot sector with various TCG options, check that
+ * the guest still runs correctly and that "info jit" shows the expected
+ * activity.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqos/libqtest.h"
+#include "boot-sector.h"
+#ifdef __linux__
+#include <sys/personality.h>
+#endif
+
+static char disk[] = "tcg-jit-test-disk-XXXXXX";
+
+/* Return the first number after @name in the output of "info jit" */
+static unsigned long jit_stat(QTestState *qts, const char *name)
+{
+    g_autofree char *info = qtest_hmp(qts, "info jit");
+    const char *p = strstr(info, name);
+
+    g_assert_nonnull(p);
+    return strtoul(p + strlen(name), NULL, 10);
+}
+
+static QTestState *boot(const char *accel_opts, const char *extra_args)
+{
+    QTestState *qts;
+
+    qts = qtest_initf("-accel tcg,%s %s -drive file=%s,format=raw",
+                      accel_opts, extra_args, disk);
+    boot_sector_test(qts);
+    return qts;
+}
+
+/*
+ * With a 4 MB buffer the single TCG context gets two regions.  One
+ * instruction per TB makes the BIOS translate much more code than that,
+ * so the oldest region has to be evicted, possibly several times.
+ */
+static void test_evict(void)
+{
+    QTestState *qts = boot("tb-size=4", "-singlestep");
+
+    g_assert_cmpuint(jit_stat(qts, "gen code regions"), ==, 2);
+    g_assert_cmpuint(jit_stat(qts, "TB evict count"), >, 0);
+    qtest_quit(qts);
+}
+
+/*
+ * The BIOS spends most of its time in a few loops, whose TBs must be
+ * retranslated as superblocks without breaking the boot.
+ */
+static void test_hot(void)
+{
+    QTestState *qts = boot("hot-threshold=100", "");
+
+    g_assert_cmpuint(jit_stat(qts, "TB hot count"), >, 0);
+    qtest_quit(qts);
+}
+
+/*
+ * vCPUs translate without optimization and a worker thread translates
+ * the same code again.  Some requests are dropped because the BIOS
+ * overwrites code it has run, but most must make it.
+ */
+static void test_async_translate(void)
+{
+    QTestState *qts = boot("thread=multi,async-translate=1", "");
+    g_autofree char *info = qtest_hmp(qts, "info jit");
+    const char *p = strstr(info, "TB async count");
+    unsigned long count, dropped;
+
+    g_assert_nonnull(p);
+    g_assert_cmpint(sscanf(p, "TB async count %lu (%lu dropped)",
+                           &count, &dropped), ==, 2);
+    g_assert_cmpuint(count, >, 0);
+    g_assert_cmpuint(dropped, <, count);
+    qtest_quit(qts);
+}
+
+/*
+ * Boot sector for the superblock benchmark: a loop with a conditional
+ * branch in its body runs 2^27 times, then the signature that
+ * boot_sector_test() waits for is written at 0x7c10.
+ */
+static const uint8_t bench_boot_sector[512] = {
+    0xb8, 0x00, 0x00,                   /* 7c00: mov $0,%ax */
+    0x8e, 0xd8,                         /* 7c03: mov %ax,%ds */
+    0xeb, 0x19,                         /* 7c05: jmp 7c20 */
+    [0x10] = 0xce, 0xfa,                /* 7c10: signature */
+    [0x20] = 0x66, 0xb9, 0x00, 0x00, 0x00, 0x08,
+                                        /* 7c20: mov $0x8000000,%ecx */
+    0x66, 0x40,                         /* 7c26: inc %eax */
+    0xa8, 0x01,                         /* 7c28: test $1,%al */
+    0x74, 0x02,                         /* 7c2a: jz 7c2e */
+    0x66, 0x43,                         /* 7c2c: inc %ebx */
+    0x66, 0x49,                         /* 7c2e: dec %ecx */
+    0x75, 0xf4,                         /* 7c30: jnz 7c26 */
+    0xb8, 0xad, 0xde,                   /* 7c32: mov $0xdead,%ax */
+    0xa3, 0x10, 0x7c,                   /* 7c35: mov %ax,0x7c10 */
+    0xfa,                               /* 7c38: cli */
+    0xf4,                               /* 7c39: hlt */
+    0xeb, 0xfd,                         /* 7c3a: jmp 7c39 */
+    [0x1fe] = 0x55, 0xaa,
+};
+
+/* Return the seconds it takes to boot @path, and the number of hot TBs */
+static double bench_boot(const char *path, const char *accel_opts,
+                         unsigned long *hot)
+{
+    gint64 start = g_get_monotonic_time();
+    QTestState *qts;
+    double secs;
+
+    qts = qtest_initf("-accel tcg,%s -drive file=%s,format=raw",
+                      accel_opts, path);
+    boot_sector_test(qts);
+    secs = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+    *hot = jit_stat(qts, "TB hot count");
+    qtest_quit(qts);
+    return secs;
+}
+
+/*
+ * Compare the run time of a branchy guest loop with and without
+ * superblocks.  The time includes the BIOS, which is the same for both
+ * runs, and boot_sector_test() polls every 100 ms.
+ */
+static void bench_hot(void)
+{
+    g_autofree char *path = NULL;
+    unsigned long hot;
+    double base, sb;
+    int fd;
+
+    fd = g_file_open_tmp("tcg-jit-test-bench-XXXXXX", &path, NULL);
+    g_assert(fd >= 0);
+    g_assert_cmpint(write(fd, bench_boot_sector, sizeof(bench_boot_sector)),
+                    ==, sizeof(bench_boot_sector));
+    close(fd);
+
+    base = bench_boot(path, "hot-threshold=0", &hot);
+    g_assert_cmpuint(hot, ==, 0);
+    sb = bench_boot(path, "hot-threshold=100", &hot);
+    g_assert_cmpuint(hot, >, 0);
+
+    g_test_message("superblocks: %.2f s without, %.2f s with "
+                   "hot-threshold=100 (%.2fx)", base, sb, base / sb);
+    unlink(path);
+}
+
+#ifdef __linux__
+/*
+ * Translated code is only reused at the same host address, so run QEMU
+ * without address space randomization.  The second boot then finds at
+ * least the code translated before the runs diverge.
+ */
+static void test_tb_cache(void)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *opts = NULL;
+    int old_persona = personality(0xffffffff);
+    QTestState *qts;
+    int fd;
+
+    if (personality(old_persona | ADDR_NO_RANDOMIZE) < 0) {
+        g_test_skip("cannot disable address space randomization");
+        return;
+    }
+
+    fd = g_file_open_tmp("tcg-jit-test-cache-XXXXXX", &path, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+    opts = g_strdup_printf("tb-cache=%s", path);
+
+    qts = boot(opts, "");
+    g_assert_cmpuint(jit_stat(qts, "TB cache hit/miss"), ==, 0);
+    qtest_quit(qts);
+
+    qts = boot(opts, "");
+    g_assert_cmpuint(jit_stat(qts, "TB cache hit/miss"), >, 0);
+    qtest_quit(qts);
+
+    unlink(path);
+    personality(old_persona);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    if (!qtest_has_accel("tcg")) {
+        return g_test_run();
+    }
+
+    ret = boot_sector_init(disk);
+    if (ret) {
+        return ret;
+    }
+
+    qtest_add_func("tcg-jit/evict", test_evict);
+    qtest_add_func("tcg-jit/hot", test_hot);
+    qtest_add_func("tcg-jit/async-translate", test_async_translate);
+    if (g_test_perf()) {
+        qtest_add_func("tcg-jit/hot-bench", bench_hot);
+    }
+#ifdef __linux__
+    qtest_add_func("tcg-jit/tb-cache", test_tb_cache);
+#endif
+
+    ret = g_test_run();
+    boot_sector_cleanup(disk);
+    return ret;
+}
@@ -752,6 +752,70 @@ static void test_attach_preserve_blk_ctx(void)
     blk_unref(blk);
 }
 
+typedef struct ForeignSubmitTestData {
+    BlockBackend *blk;
+    AioContext *submit_ctx;
+    AioContext *complete_ctx;
+    QEMUIOVector qiov;
+    bool done;
+} ForeignSubmitTestData;
+
+static void test_foreign_submit_cb(void *opaque, int ret)
+{
+    ForeignSubmitTestData *data = opaque;
+
+    g_assert_cmpint(ret, ==, 0);
+    data->complete_ctx = qemu_get_current_aio_context();
+    qatomic_mb_set(&data->done, true);
+    aio_wait_kick();
+}
+
+static void test_foreign_submit_bh(void *opaque)
+{
+    ForeignSubmitTestData *data = opaque;
+    AioContext *ctx = blk_get_aio_context(data->blk);
+
+    data->submit_ctx = qemu_get_current_aio_context();
+    aio_context_acquire(ctx);
+    blk_aio_preadv(data->blk, 0, &data->qiov, 0, test_foreign_submit_cb, data);
+    aio_context_release(ctx);
+}
+
+/*
+ * Requests submitted from another IOThread, with the AioContext lock of
+ * the BlockBackend held, run and complete in the AioContext of the
+ * BlockBackend.  The block layer is not thread-safe.
+ */
+static void test_foreign_submit(void)
+{
+    IOThread *iothread = iothread_new();
+    IOThread *queue_iothread = iothread_new();
+    AioContext *ctx = iothread_get_aio_context(iothread);
+    AioContext *queue_ctx = iothread_get_aio_context(queue_iothread);
+    ForeignSubmitTestData data = {};
+    BlockDriverState *bs;
+    uint8_t buf[512];
+
+    data.blk = blk_new(ctx, BLK_PERM_ALL, BLK_PERM_ALL);
+    bs = bdrv_new_open_driver(&bdrv_test, "base", BDRV_O_RDWR, &error_abort);
+    bs->total_sectors = 65536 / BDRV_SECTOR_SIZE;
+    blk_insert_bs(data.blk, bs, &error_abort);
+    qemu_iovec_init_buf(&data.qiov, buf, sizeof(buf));
+
+    aio_bh_schedule_oneshot(queue_ctx, test_foreign_submit_bh, &data);
+    AIO_WAIT_WHILE(NULL, !qatomic_mb_read(&data.done));
+
+    g_assert(data.submit_ctx == queue_ctx);
+    g_assert(data.complete_ctx == ctx);
+
+    aio_context_acquire(ctx);
+    blk_drain(data.blk);
+    blk_set_aio_context(data.blk, qemu_get_aio_context(), &error_abort);
+    aio_context_release(ctx);
+    bdrv_unref(bs);
+    blk_unref(data.blk);
+}
+
 int main(int argc, char **argv)
 {
     int i;
@@ -772,6 +836,7 @@ int main(int argc, char **argv)
     g_test_add_func("/propagate/basic", test_propagate_basic);
     g_test_add_func("/propagate/diamond", test_propagate_diamond);
     g_test_add_func("/propagate/mirror", test_propagate_mirror);
+    g_test_add_func("/aio/foreign-submit", test_foreign_submit);
 
     return g_test_run();
 }
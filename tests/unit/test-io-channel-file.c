@@ -23,6 +23,7 @@
 #include "io/channel-util.h"
 #include "io-channel-helpers.h"
 #include "qapi/error.h"
+#include "qemu/cutils.h"
 #include "qemu/module.h"
 
 #define TEST_FILE "tests/test-io-channel-file.txt"
@@ -102,6 +103,50 @@ static void test_io_channel_fd(void)
 }
 
 
+#ifdef CONFIG_PREADV
+static void test_io_channel_file_pwritev(void)
+{
+    QIOChannel *ioc;
+    char buf[8];
+
+    unlink(TEST_FILE);
+    ioc = QIO_CHANNEL(qio_channel_file_new_path(
+                          TEST_FILE,
+                          O_RDWR | O_CREAT | O_TRUNC | O_BINARY, TEST_MASK,
+                          &error_abort));
+    g_assert(qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE));
+
+    g_assert_cmpint(qio_channel_pwrite(ioc, "world", 5, 4096,
+                                       &error_abort), ==, 5);
+    g_assert_cmpint(qio_channel_pwrite(ioc, "hello", 5, 0,
+                                       &error_abort), ==, 5);
+
+    /* The current I/O position doesn't move */
+    g_assert_cmpint(qio_channel_io_seek(ioc, 0, SEEK_CUR, &error_abort),
+                    ==, 0);
+
+    g_assert_cmpint(qio_channel_pread(ioc, buf, 5, 4096,
+                                      &error_abort), ==, 5);
+    g_assert(memcmp(buf, "world", 5) == 0);
+    g_assert_cmpint(qio_channel_pread(ioc, buf, 5, 0,
+                                      &error_abort), ==, 5);
+    g_assert(memcmp(buf, "hello", 5) == 0);
+
+    /* The hole in between reads back as zeroes */
+    g_assert_cmpint(qio_channel_pread(ioc, buf, sizeof(buf), 2048,
+                                      &error_abort), ==, sizeof(buf));
+    g_assert(buffer_is_zero(buf, sizeof(buf)));
+
+    /* End of file */
+    g_assert_cmpint(qio_channel_pread(ioc, buf, sizeof(buf), 8192,
+                                      &error_abort), ==, 0);
+
+    unlink(TEST_FILE);
+    object_unref(OBJECT(ioc));
+}
+#endif /* CONFIG_PREADV */
+
+
 #ifndef _WIN32
 static void test_io_channel_pipe(bool async)
 {
@@ -116,6 +161,7 @@ static void test_io_channel_pipe(bool async)
 
     src = QIO_CHANNEL(qio_channel_file_new_fd(fd[1]));
     dst = QIO_CHANNEL(qio_channel_file_new_fd(fd[0]));
+    g_assert(!qio_channel_has_feature(src, QIO_CHANNEL_FEATURE_SEEKABLE));
 
     test = qio_channel_test_new();
     qio_channel_test_run_threads(test, async, src, dst);
@@ -147,6 +193,9 @@ int main(int argc, char **argv)
     g_test_add_func("/io/channel/file", test_io_channel_file);
     g_test_add_func("/io/channel/file/rdwr", test_io_channel_file_rdwr);
     g_test_add_func("/io/channel/file/fd", test_io_channel_fd);
+#ifdef CONFIG_PREADV
+    g_test_add_func("/io/channel/file/pwritev", test_io_channel_file_pwritev);
+#endif
 #ifndef _WIN32
     g_test_add_func("/io/channel/pipe/sync", test_io_channel_pipe_sync);
     g_test_add_func("/io/channel/pipe/async", test_io_channel_pipe_async);
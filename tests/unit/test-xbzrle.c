@@ -174,6 +174,69 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_PAGES 64
+
+/*
+ * Encode the same set of pages with every available encoder and check
+ * that they all produce byte-identical output.
+ */
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *ref = g_malloc(ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    int ref_len[ACCEL_PAGES];
+    bool first = true;
+    int i, j;
+
+    for (i = 0; i < ACCEL_PAGES * XBZRLE_PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+    memcpy(new_buf, old_buf, ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+
+    /* Dirty a growing number of runs of varying length in each page */
+    for (i = 0; i < ACCEL_PAGES; i++) {
+        uint8_t *page = new_buf + i * XBZRLE_PAGE_SIZE;
+
+        for (j = 0; j < i * 4; j++) {
+            int start = g_test_rand_int_range(0, XBZRLE_PAGE_SIZE);
+            int len = g_test_rand_int_range(1, 2 + (i % 8) * 32);
+            int k;
+
+            for (k = start; k < MIN(start + len, XBZRLE_PAGE_SIZE); k++) {
+                page[k] ^= g_test_rand_int_range(0, 4);
+            }
+        }
+    }
+
+    do {
+        for (i = 0; i < ACCEL_PAGES; i++) {
+            int offset = i * XBZRLE_PAGE_SIZE;
+            int dlen;
+
+            dlen = xbzrle_encode_buffer(old_buf + offset, new_buf + offset,
+                                        XBZRLE_PAGE_SIZE, compressed,
+                                        XBZRLE_PAGE_SIZE);
+            if (first) {
+                ref_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(ref + offset, compressed, dlen);
+                }
+            } else {
+                g_assert_cmpint(dlen, ==, ref_len[i]);
+                g_assert(dlen <= 0 || !memcmp(ref + offset, compressed, dlen));
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(ref);
+    g_free(compressed);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +249,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -336,6 +336,11 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    if (ctx->linux_io_uring_poll) {
+        luring_detach_aio_context(ctx->linux_io_uring_poll, ctx);
+        luring_cleanup(ctx->linux_io_uring_poll);
+        ctx->linux_io_uring_poll = NULL;
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -433,6 +438,27 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_setup_linux_io_uring_poll(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring_poll) {
+        return ctx->linux_io_uring_poll;
+    }
+
+    ctx->linux_io_uring_poll = luring_init_polled(errp);
+    if (!ctx->linux_io_uring_poll) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring_poll, ctx);
+    return ctx->linux_io_uring_poll;
+}
+
+LuringState *aio_get_linux_io_uring_poll(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring_poll);
+    return ctx->linux_io_uring_poll;
+}
 #endif
 
 void aio_notify(AioContext *ctx)
@@ -550,6 +576,7 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_poll = NULL;
 #endif
 
     ctx->thread_pool = NULL;